@@ -25,36 +25,73 @@
  POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <limits.h>
+#include <math.h>
 #include <stdio.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
-#include <fcntl.h>
-
-#include <sys/audioio.h>
-#include <sys/ioctl.h>
 
 #include <cdk.h>
+#include <poll.h>
 
 #include <stdbool.h>
 
+#include "ctlsock.h"
+#include "filewatch.h"
+#include "history.h"
+#include "hotplug.h"
+#include "loop.h"
+#include "meter.h"
+#include "mixdev.h"
+#include "mixer.h"
+#include "names.h"
+#include "preset.h"
+#include "probes.h"
+#include "search.h"
+
 #define DEFAULT_MIXER_DEVICE	"/dev/mixer"
+#define DEFAULT_PRESETS		".aiomixer.presets" /* in $HOME */
 
-#define MAX_CONTROLS	(64)
-#define MAX_CLASSES	(16)
+#define MAX_DEVICES	(8)
+#define MAX_METERS	(8)
 
 #define MAX_CONTROL_LEN	(64)
 
+#define COMPACT_ROW_CHANNELS	(8) /* before the bars take two rows */
+
+#define METER_FPS	(10) /* the halfdelay() resolution */
+#define METER_WIDTH	(20)
+#define MAX_WRITE_RATE	(1000) /* per control per second */
+#define DEFAULT_MAX_AGE	(500) /* milliseconds a value is trusted for */
+#define MAX_AGE		(60000)
+#define REVALIDATE_MAX	(8) /* controls read per revalidation */
+#define WATCH_SETTLE	(200) /* ms a watched file must stay unchanged */
+#define WATCH_POLL	(1000) /* where changes cannot be waited for */
+
 #define PAIR_CLASS_BUTTONS_HL	(2)
 #define PAIR_SLIDER		(3)
 #define PAIR_ENUM_SET		(4)
+#define PAIR_ERROR		(5)
 
 struct aiomixer_control {
-	char name[MAX_CONTROL_LEN];
+	const char *name; /* without the class */
+	unsigned label_id; /* widget title, one per channel for VALUE */
 	int dev;
 	int type;
 	int next, prev;
 	int current_chan; /* for VALUE type */
 	bool chans_unlocked; /* for VALUE type */
+	bool compact; /* one slider for all channels, for VALUE type */
+	const mixer_ctrl_t *value; /* last known, kept by the mixdev */
+	struct aiomixer_control *mute; /* mute in the chain, for VALUE type */
+	int mute_on, mute_off; /* its member ords */
+	struct aiomixer_control *mute_of; /* the VALUE muted, if a mute */
+	unsigned pos; /* in the class display order */
+	unsigned group; /* index of the chain's root, itself for roots */
+	unsigned nmembers; /* controls chained to a root */
+	bool expanded; /* whether they are shown, for roots */
+	struct meter *meter; /* levels shown beside it, for VALUE type */
 	union {
 		struct audio_mixer_enum e;
 		struct audio_mixer_set s;
@@ -63,7 +100,7 @@ struct aiomixer_control {
 	union {
 		CDKBUTTONBOX *enum_widget;
 		CDKBUTTONBOX *set_widget;
-		CDKSLIDER *value_widget[8];
+		CDKSLIDER **value_widget; /* one per channel, or compact */
 	};
 };
 
@@ -72,50 +109,174 @@ struct aiomixer_class {
 	int id;
 	CDKLABEL *heading_label;
 	unsigned ncontrols;
-	struct aiomixer_control controls[MAX_CONTROLS];
+	struct aiomixer_control *controls;
+	unsigned *order; /* display order, see group_controls() */
+};
+
+struct aiomixer_device {
+	char name[HOTPLUG_NAME_MAX];
+	struct mixdev *md;
+	struct mixer *device; /* under the wrappers, see detach_device() */
+	bool detached;
+};
+
+struct aiomixer_meter {
+	const char *control;
+	const char *source;
+	struct meter *meter;
+};
+
+struct applying {
+	struct aiomixer *x;
+	const struct preset *preset;
+	bool reported; /* a failure */
+};
+
+struct control_ref {
+	unsigned class_index;
+	unsigned control_index;
 };
 
 struct aiomixer {
 	unsigned nclasses;
-	struct aiomixer_class classes[MAX_CLASSES];
+	struct aiomixer_class *classes;
 	unsigned class_index;
 	unsigned control_index;
-	unsigned top_control;
+	unsigned top_control; /* a display position */
 	CDKSCREEN *screen;
 	CDKLABEL *title_label;
 	CDKBUTTONBOX *class_buttons;
-	int fd;
+	struct mixer *mixer; /* the current device's */
+	struct mixdev *md; /* likewise */
+	struct aiomixer_device devices[MAX_DEVICES];
+	unsigned ndevices, device_index;
+	struct hotplug *hotplug;
+	struct history history;
+	struct presets presets;
+	struct aiomixer_meter meters[MAX_METERS];
+	unsigned nmeters;
+	struct timespec meters_drawn;
+	struct loop *loop;
+	struct ctlsock *ctlsock;
+	unsigned write_rate; /* 0 for no limit */
+	unsigned max_age; /* of values used on focus and for presets */
+	int flush_timer; /* -1 while no writes are held */
+	struct filewatch *watch;
+	const char *watch_path;
+	struct presets watched; /* the file as last applied */
+	int watch_timer; /* -1 while no change is pending */
+	bool watch_pending;
+	bool compact;
+	const char *stats_path;
+	struct names names; /* widget titles, see name_control() */
+	struct aiomixer_control **by_dev; /* the widgets of each control */
+	unsigned ndevs;
+	struct search search;
+	struct control_ref *search_refs;
+	const unsigned *hits;
+	unsigned nhits, hit_index;
+	char query[SEARCH_MAX_QUERY];
 };
 
 static void select_class(struct aiomixer *);
 static void select_class_widget(struct aiomixer *, int);
 static struct aiomixer_class *aiomixer_get_class(struct aiomixer *, int);
 static struct aiomixer_control *aiomixer_get_control(struct aiomixer *, int);
-static void aiomixer_devinfo(struct aiomixer *);
+static int aiomixer_devinfo(struct aiomixer *);
+static struct aiomixer_control *aiomixer_get_control_ref(struct aiomixer *, unsigned);
 static struct aiomixer_control *find_root_control(struct aiomixer *, int);
+static const char *control_name(struct aiomixer *,
+    const struct aiomixer_control *);
+static int name_control(struct aiomixer *, struct aiomixer_class *,
+    struct aiomixer_control *, const struct mixer_devinfo *);
 static char **make_enum_list(struct audio_mixer_enum *);
 static char **make_set_list(struct audio_mixer_set *);
 static size_t sum_str_list_lengths(const char **, size_t);
 static bool control_within_bounds(struct aiomixer *, unsigned);
 static void reposition_visible_widgets(struct aiomixer *);
+static void settle_resize(struct aiomixer *);
+static void relayout(struct aiomixer *);
 static void create_class_widgets(struct aiomixer *, int);
 static void destroy_class_widgets(struct aiomixer *);
-static void enum_get_and_select(int, struct aiomixer_control *);
-static void set_get_and_select(int, struct aiomixer_control *);
-static void levels_get_and_set(int, struct aiomixer_control *);
-static void set_enum(int, int, int);
-static void set_set(int, int, int);
-static void set_level(int, struct aiomixer_control *, int, int);
+static bool read_control(struct aiomixer *, struct aiomixer_control *);
+static void read_class(struct aiomixer *, struct aiomixer_class *);
+static void select_enum_button(struct aiomixer_control *);
+static void select_set_button(struct aiomixer_control *);
+static bool value_fresh(struct aiomixer *, struct aiomixer_control *);
+static void focus_value(struct aiomixer *, struct aiomixer_control *);
+static void revalidate_tick(void *);
+static void set_enum(struct aiomixer *, struct aiomixer_control *, int);
+static void link_companions(struct aiomixer *);
+static void group_controls(struct aiomixer *);
+static bool control_in_class(struct aiomixer_class *, struct aiomixer_control *);
+static bool control_chained(struct aiomixer_class *, struct aiomixer_control *);
+static bool control_hidden(struct aiomixer_class *, struct aiomixer_control *);
+static int step_control(struct aiomixer *, int, int);
+static bool control_visible(struct aiomixer *, struct aiomixer_control *);
+static void draw_marks(struct aiomixer_control *, int);
+static void draw_buttons(struct aiomixer_control *);
+static void draw_slider(struct aiomixer_control *, int);
+static int control_sliders(struct aiomixer_control *);
+static int compact_rows(struct aiomixer_control *);
+static int control_rows(struct aiomixer_control *);
+static CDKSLIDER *channel_slider(struct aiomixer_control *, int);
+static int title_width(struct aiomixer_control *, int);
+static void set_sliders(struct aiomixer_control *);
+static void draw_channels(struct aiomixer_control *);
+static void link_meters(struct aiomixer *);
+static int meter_cell(float, int);
+static void draw_meter(struct aiomixer_control *, int,
+    const struct meter_levels *);
+static void draw_meters(struct aiomixer *, bool);
+static void set_key_timer(struct aiomixer *, bool);
+static void toggle_mute(struct aiomixer *, struct aiomixer_control *);
+static void set_set(struct aiomixer *, struct aiomixer_control *, int);
+static void show_value(struct aiomixer *, int);
+static void undo(struct aiomixer *, bool);
+static struct aiomixer_control *find_control(struct aiomixer *, const char *);
+static void preset_applied(void *, const struct preset_setting *,
+    const mixer_ctrl_t *, const mixer_ctrl_t *, int);
+static int apply_preset(struct aiomixer *, struct preset *);
+static void choose_preset(struct aiomixer *);
+static void set_level(struct aiomixer *, struct aiomixer_control *, int, int);
+static void show_error(struct aiomixer *, const char *, ...);
+static int index_controls(struct aiomixer *);
+static void show_search_hits(struct aiomixer *);
+static int search_changed(EObjectType, void *, void *, chtype);
+static int key_callback_search(EObjectType, void *, void *, chtype);
+static void search_controls(struct aiomixer *);
+static void jump_to_control(struct aiomixer *, unsigned, unsigned);
+static void clear_error(struct aiomixer *);
+static void show_note(struct aiomixer *, const char *, ...);
+static void forget_controls(struct aiomixer *);
+static void create_class_buttons(struct aiomixer *);
+static void switch_device(struct aiomixer *);
+static void attach_device(struct aiomixer *, struct hotplug_event *);
+static void detach_device(struct aiomixer *, const char *);
+static void control_request(void *, const char *, char *, size_t);
+static void hotplug_events(struct aiomixer *);
+static void hotplug_ready(void *, int, short);
+static void meter_tick(void *);
+static struct mixer *throttle_device(struct aiomixer *, struct mixer *);
+static void flush_writes(struct aiomixer *);
+static void flush_tick(void *);
+static int apply_watched(struct aiomixer *);
+static void watch_ready(void *, int, short);
+static void watch_tick(void *);
+static int device_changes(EObjectType, void *, void *, chtype);
+static void close_devices(struct aiomixer *);
 static int key_callback_slider(EObjectType, void *, void *, chtype);
 static int key_callback_class_buttons(EObjectType, void *, void *, chtype);
 static int key_callback_control_buttons(EObjectType, void *, void *, chtype);
 static int key_callback_global(EObjectType, void *, void *, chtype);
+static int key_callback_group(EObjectType, void *, void *, chtype);
 static void add_directional_binds(struct aiomixer *, EObjectType, void *, BINDFN);
 static void add_slider_binds(struct aiomixer *, void *);
 static void add_class_button_binds(struct aiomixer *, void *);
 static void add_control_button_binds(struct aiomixer *, void *);
 static void add_global_binds(struct aiomixer *, EObjectType, void *);
 static void usage(void);
+static void write_stats(struct aiomixer *);
 static void quit(struct aiomixer *);
 static void quit_err(struct aiomixer *, const char *, ...);
 static void quit_perror(struct aiomixer *);
@@ -134,18 +295,18 @@ aiomixer_get_class(struct aiomixer *x, int class_id)
 static struct aiomixer_control *
 aiomixer_get_control(struct aiomixer *x, int dev)
 {
-	unsigned i, j;
-	struct aiomixer_class *class;
-
-	for (i = 0; i < x->nclasses; ++i) {
-		class = &x->classes[i];
-		for (j = 0; j < class->ncontrols; ++j) {
-			if (class->controls[j].dev == dev) {
-				return &class->controls[j];
-			}
-		}
+	if (dev < 0 || (unsigned)dev >= x->ndevs) {
+		return NULL;
 	}
-	return NULL;
+	return x->by_dev[dev];
+}
+
+static struct aiomixer_control *
+aiomixer_get_control_ref(struct aiomixer *x, unsigned search_id)
+{
+	struct control_ref *ref = &x->search_refs[search_id];
+
+	return &x->classes[ref->class_index].controls[ref->control_index];
 }
 
 static struct aiomixer_control *
@@ -154,52 +315,169 @@ find_root_control(struct aiomixer *x, int dev)
 	struct aiomixer_control *ctrl;
 
 	ctrl = aiomixer_get_control(x, dev);
-	while (ctrl->prev != -1) {
+	while (ctrl != NULL && ctrl->prev != -1) {
 		ctrl = aiomixer_get_control(x, ctrl->prev);
 	}
 	return ctrl;
 }
 
-static void
+/*
+ * The qualified name of a control, class.label or class.root.label as
+ * in mixerctl(1), as the device layer keeps it.  The few controls it
+ * has no name for go by their bare label.
+ */
+static const char *
+control_name(struct aiomixer *x, const struct aiomixer_control *control)
+{
+	const char *name = mixdev_name(x->md, control->dev);
+
+	if (name == NULL) {
+		name = mixdev_info(x->md, control->dev)->label.name;
+	}
+	return name;
+}
+
+/*
+ * Widget titles are built once here, never while drawing, one per
+ * channel for level controls.  Returns -1 if out of memory.
+ */
+static int
+name_control(struct aiomixer *x, struct aiomixer_class *class,
+    struct aiomixer_control *control, const struct mixer_devinfo *m)
+{
+	char label[MAX_CONTROL_LEN + 32];
+	char rows[2 * (MIXER_MAX_CHANNELS / COMPACT_ROW_CHANNELS + 1) + 1];
+	struct aiomixer_control **by_dev;
+	const char *display;
+	unsigned n;
+
+	control->dev = m->index;
+	control->name = control_name(x, control);
+	if (mixdev_name(x->md, m->index) != NULL) {
+		/* shown without the class, the class being the heading */
+		control->name += strnlen(class->name, MAX_AUDIO_DEV_LEN) + 1;
+	}
+	control->value = mixdev_value(x->md, m->index);
+	display = control->name;
+
+	if (m->type == AUDIO_MIXER_VALUE) {
+		for (int chan = 0; chan < m->un.v.num_channels; ++chan) {
+			snprintf(label, sizeof(label),
+			    "</16>%s (channel %d)<!16>", display, chan);
+			if ((n = names_add(&x->names, label)) == NAME_NONE) {
+				return -1;
+			}
+			if (chan == 0) {
+				control->label_id = n;
+			}
+		}
+		/* at label_id + channels, with title rows for the bars */
+		for (n = 0; n * COMPACT_ROW_CHANNELS <
+		    (unsigned)m->un.v.num_channels; ++n) {
+			rows[2 * n] = '\n';
+			rows[2 * n + 1] = ' ';
+		}
+		rows[2 * n] = '\0';
+		snprintf(label, sizeof(label), "</16>%s<!16>%s", display, rows);
+		if (names_add(&x->names, label) == NAME_NONE) {
+			return -1;
+		}
+	} else {
+		snprintf(label, sizeof(label), "</16>%s<!16>", display);
+		if ((control->label_id = names_add(&x->names, label)) ==
+		    NAME_NONE) {
+			return -1;
+		}
+	}
+
+	if ((unsigned)m->index >= x->ndevs) {
+		n = m->index + 1;
+		if ((by_dev = realloc(x->by_dev, n * sizeof(*by_dev))) == NULL) {
+			return -1;
+		}
+		memset(by_dev + x->ndevs, 0, (n - x->ndevs) * sizeof(*by_dev));
+		x->by_dev = by_dev;
+		x->ndevs = n;
+	}
+	x->by_dev[m->index] = control;
+	return 0;
+}
+
+/*
+ * Build the classes and controls of the current device from its
+ * enumerated descriptions.  Returns -1 if they could not be allocated.
+ */
+static int
 aiomixer_devinfo(struct aiomixer *x)
 {
-	struct mixer_devinfo m = {0};
+	unsigned ninfo = mixdev_count(x->md);
+	const struct mixer_devinfo *m;
 	struct aiomixer_class *class = NULL;
 	struct aiomixer_control *control = NULL;
-	struct aiomixer_control *prev_ctrl = NULL;
 	struct audio_mixer_enum e;
 	struct audio_mixer_set s;
 	struct audio_mixer_value v;
+	unsigned nclasses = 0;
 	int i;
 
-	for (m.index = 0; ioctl(x->fd, AUDIO_MIXER_DEVINFO, &m) != -1; ++m.index) {
-		if (m.type == AUDIO_MIXER_CLASS && x->nclasses < MAX_CLASSES) {
+	/*
+	 * Size everything up front: controls point at each other (mute,
+	 * mute_of, by_dev), so the arrays must not move once filled.
+	 * There is always a class to look at, even if it is empty.
+	 */
+	for (unsigned n = 0; n < ninfo; ++n) {
+		if (mixdev_info(x->md, n)->type == AUDIO_MIXER_CLASS) {
+			nclasses++;
+		}
+	}
+	if ((x->classes = calloc(nclasses > 0 ? nclasses : 1,
+	    sizeof(x->classes[0]))) == NULL) {
+		return -1;
+	}
+	for (unsigned n = 0; n < ninfo; ++n) {
+		m = mixdev_info(x->md, n);
+		if (m->type == AUDIO_MIXER_CLASS) {
 			class = &x->classes[x->nclasses++];
-			class->id = m.mixer_class;
-			memcpy(class->name, m.label.name, MAX_AUDIO_DEV_LEN);
+			class->id = m->mixer_class;
+			memcpy(class->name, m->label.name, MAX_AUDIO_DEV_LEN);
 		}
 	}
-	for (m.index = 0; ioctl(x->fd, AUDIO_MIXER_DEVINFO, &m) != -1; ++m.index) {
-		switch (m.type) {
+	for (unsigned n = 0; n < ninfo; ++n) {
+		m = mixdev_info(x->md, n);
+		if (m->type != AUDIO_MIXER_CLASS &&
+		    (class = aiomixer_get_class(x, m->mixer_class)) != NULL) {
+			class->ncontrols++; /* counted, then refilled below */
+		}
+	}
+	for (unsigned j = 0; j < x->nclasses; ++j) {
+		class = &x->classes[j];
+		if (class->ncontrols > 0 &&
+		    ((class->controls = calloc(class->ncontrols,
+		    sizeof(class->controls[0]))) == NULL ||
+		    (class->order = calloc(class->ncontrols,
+		    sizeof(class->order[0]))) == NULL)) {
+			while (j < x->nclasses) {
+				x->classes[j++].ncontrols = 0;
+			}
+			return -1;
+		}
+		class->ncontrols = 0;
+	}
+	for (unsigned n = 0; n < ninfo; ++n) {
+		m = mixdev_info(x->md, n);
+		switch (m->type) {
 		case AUDIO_MIXER_ENUM:
-			e = m.un.e;
-			class = aiomixer_get_class(x, m.mixer_class);
-			if (class != NULL && class->ncontrols < MAX_CONTROLS) {
+			e = m->un.e;
+			class = aiomixer_get_class(x, m->mixer_class);
+			if (class != NULL) {
 				control = &class->controls[class->ncontrols++];
-				if (m.prev != -1) {
-					prev_ctrl = find_root_control(x, m.prev);
-					if (prev_ctrl != NULL) {
-						snprintf(control->name, sizeof(control->name),
-						    "%.16s.%16s\n",
-						    prev_ctrl->name, m.label.name);
-					}
-				} else {
-					memcpy(control->name, m.label.name, MAX_AUDIO_DEV_LEN);
-				}
 				control->type = AUDIO_MIXER_ENUM;
-				control->dev = m.index;
-				control->next = m.next;
-				control->prev = m.prev;
+				if (name_control(x, class, control, m) == -1) {
+					return -1;
+				}
+				control->dev = m->index;
+				control->next = m->next;
+				control->prev = m->prev;
 				control->e.num_mem = e.num_mem;
 				for (i = 0; i < e.num_mem; ++i) {
 					control->e.member[i].label = e.member[i].label;
@@ -208,24 +486,17 @@ aiomixer_devinfo(struct aiomixer *x)
 			}
 			break;
 		case AUDIO_MIXER_SET:
-			s = m.un.s;
-			class = aiomixer_get_class(x, m.mixer_class);
-			if (class != NULL && class->ncontrols < MAX_CONTROLS) {
+			s = m->un.s;
+			class = aiomixer_get_class(x, m->mixer_class);
+			if (class != NULL) {
 				control = &class->controls[class->ncontrols++];
-				if (m.prev != -1) {
-					prev_ctrl = find_root_control(x, m.prev);
-					if (prev_ctrl != NULL) {
-						snprintf(control->name, sizeof(control->name),
-						    "%.16s.%.16s\n",
-						    prev_ctrl->name, m.label.name);
-					}
-				} else {
-					memcpy(control->name, m.label.name, MAX_AUDIO_DEV_LEN);
-				}
 				control->type = AUDIO_MIXER_SET;
-				control->dev = m.index;
-				control->next = m.next;
-				control->prev = m.prev;
+				if (name_control(x, class, control, m) == -1) {
+					return -1;
+				}
+				control->dev = m->index;
+				control->next = m->next;
+				control->prev = m->prev;
 				control->s.num_mem = s.num_mem;
 				for (i = 0; i < s.num_mem; ++i) {
 					control->s.member[i].label = s.member[i].label;
@@ -234,30 +505,198 @@ aiomixer_devinfo(struct aiomixer *x)
 			}
 			break;
 		case AUDIO_MIXER_VALUE:
-			v = m.un.v;
-			class = aiomixer_get_class(x, m.mixer_class);
-			if (class != NULL && class->ncontrols < MAX_CONTROLS) {
-				control = &class->controls[class->ncontrols++];
-				if (m.prev != -1) {
-					prev_ctrl = find_root_control(x, m.prev);
-					if (prev_ctrl != NULL) {
-						snprintf(control->name, sizeof(control->name),
-						    "%.16s.%16s\n",
-						    prev_ctrl->name, m.label.name);
-					}
-				} else {
-					memcpy(control->name, m.label.name, MAX_AUDIO_DEV_LEN);
+			v = m->un.v;
+			class = aiomixer_get_class(x, m->mixer_class);
+			if (v.num_channels < 1 ||
+			    v.num_channels > MIXER_MAX_CHANNELS) {
+				break;
+			}
+			if (class != NULL) {
+				control = &class->controls[class->ncontrols];
+				control->value_widget = calloc(v.num_channels,
+				    sizeof(control->value_widget[0]));
+				if (control->value_widget == NULL) {
+					return -1;
 				}
+				class->ncontrols++;
 				control->type = AUDIO_MIXER_VALUE;
-				control->dev = m.index;
-				control->next = m.next;
-				control->prev = m.prev;
+				if (name_control(x, class, control, m) == -1) {
+					return -1;
+				}
+				control->dev = m->index;
+				control->next = m->next;
+				control->prev = m->prev;
 				control->v.num_channels = v.num_channels;
 				control->v.delta = v.delta ? v.delta : 8;
 			}
 			break;
 		}
 	}
+	link_companions(x);
+	group_controls(x);
+	if (index_controls(x) == -1) {
+		return -1;
+	}
+	link_meters(x);
+	return 0;
+}
+
+/*
+ * Resolve the mute enum chained to each level control (for example
+ * outputs.master.mute for outputs.master) once, so that toggling it
+ * takes a single write.
+ */
+static void
+link_companions(struct aiomixer *x)
+{
+	struct aiomixer_control *control, *c, *mute;
+	struct aiomixer_class *class;
+	const char *label;
+	unsigned steps;
+	int on, off;
+
+	for (unsigned i = 0; i < x->nclasses; ++i) {
+		class = &x->classes[i];
+		for (unsigned j = 0; j < class->ncontrols; ++j) {
+			control = &class->controls[j];
+			if (control->type != AUDIO_MIXER_VALUE) {
+				continue;
+			}
+			c = control->prev == -1 ? control :
+			    find_root_control(x, control->prev);
+			/* bounded, in case a driver gets next wrong */
+			for (steps = 0, mute = NULL; c != NULL && steps < x->ndevs;
+			    c = aiomixer_get_control(x, c->next), ++steps) {
+				if (mixdev_is_mute(x->md, c->dev)) {
+					mute = c;
+					break;
+				}
+			}
+			if (mute == NULL) {
+				continue;
+			}
+			on = off = -1;
+			for (int k = 0; k < mute->e.num_mem; ++k) {
+				label = mute->e.member[k].label.name;
+				if (strcmp(label, "on") == 0) {
+					on = mute->e.member[k].ord;
+				} else if (strcmp(label, "off") == 0) {
+					off = mute->e.member[k].ord;
+				}
+			}
+			if (on == -1 || off == -1) {
+				continue;
+			}
+			control->mute = mute;
+			control->mute_on = on;
+			control->mute_off = off;
+			if (mute->mute_of == NULL) {
+				mute->mute_of = control;
+			}
+		}
+	}
+}
+
+/*
+ * Each class is shown as a list of chains: a root control followed by
+ * the controls linked to it through next, indented, which can be
+ * collapsed into the root.  The display order and each control's
+ * place in its chain are worked out once here.
+ */
+static void
+group_controls(struct aiomixer *x)
+{
+	struct aiomixer_control *control, *c;
+	struct aiomixer_class *class;
+	bool *placed;
+	unsigned n, k, steps;
+
+	for (unsigned i = 0; i < x->nclasses; ++i) {
+		class = &x->classes[i];
+		if (class->ncontrols == 0) {
+			continue;
+		}
+		if ((placed = calloc(class->ncontrols, sizeof(*placed))) == NULL) {
+			/* ungrouped, in device order */
+			for (unsigned j = 0; j < class->ncontrols; ++j) {
+				class->order[j] = j;
+				class->controls[j].pos = j;
+				class->controls[j].group = j;
+			}
+			continue;
+		}
+		n = 0;
+		for (unsigned j = 0; j < class->ncontrols; ++j) {
+			control = &class->controls[j];
+			c = find_root_control(x, control->dev);
+			if (placed[j] || (c != control && control_in_class(class, c))) {
+				continue;
+			}
+			class->order[n] = j;
+			control->pos = n++;
+			control->group = j;
+			placed[j] = true;
+			/* bounded, in case a driver gets next wrong */
+			for (c = aiomixer_get_control(x, control->next), steps = 0;
+			    c != NULL && control_in_class(class, c) &&
+			    steps < class->ncontrols;
+			    c = aiomixer_get_control(x, c->next), ++steps) {
+				k = c - class->controls;
+				if (placed[k]) {
+					break;
+				}
+				class->order[n] = k;
+				c->pos = n++;
+				c->group = j;
+				placed[k] = true;
+				control->nmembers++;
+			}
+		}
+		/* chained, but not reachable from their root */
+		for (unsigned j = 0; j < class->ncontrols; ++j) {
+			if (!placed[j]) {
+				class->order[n] = j;
+				class->controls[j].pos = n++;
+				class->controls[j].group = j;
+			}
+		}
+		free(placed);
+	}
+}
+
+/*
+ * The search index covers the qualified names of all controls, in
+ * class order.  Returns -1 if out of memory.
+ */
+static int
+index_controls(struct aiomixer *x)
+{
+	struct aiomixer_class *class;
+	unsigned n = 0;
+
+	for (unsigned i = 0; i < x->nclasses; ++i) {
+		n += x->classes[i].ncontrols;
+	}
+	if (n == 0) {
+		return 0;
+	}
+	if ((x->search_refs = calloc(n, sizeof(*x->search_refs))) == NULL) {
+		return -1;
+	}
+	n = 0;
+	for (unsigned i = 0; i < x->nclasses; ++i) {
+		class = &x->classes[i];
+		for (unsigned j = 0; j < class->ncontrols; ++j) {
+			if (!search_add(&x->search,
+			    control_name(x, &class->controls[j]))) {
+				return -1;
+			}
+			x->search_refs[n].class_index = i;
+			x->search_refs[n].control_index = j;
+			n++;
+		}
+	}
+	return 0;
 }
 
 static char **
@@ -293,22 +732,52 @@ sum_str_list_lengths(const char **list, size_t n)
 	return total;
 }
 
+/*
+ * Reads a control into its last known value, leaving the widgets be.
+ */
+static bool
+read_control(struct aiomixer *x, struct aiomixer_control *control)
+{
+	if (mixdev_read(x->md, control->dev, NULL) < 0) {
+		show_error(x, "AUDIO_MIXER_READ %d failed: %s",
+		    control->dev, strerror(errno));
+		return false;
+	}
+	return true;
+}
+
+/*
+ * Reads every control of a class, and the mutes of its levels, back to
+ * back before any of its widgets are made, so that opening it costs a
+ * round of requests rather than requests interleaved with drawing.
+ */
 static void
-enum_get_and_select(int fd, struct aiomixer_control *control)
+read_class(struct aiomixer *x, struct aiomixer_class *class)
 {
-	mixer_ctrl_t dev = {0};
+	struct aiomixer_control *control;
 
-	dev.dev = control->dev;
-	dev.type = AUDIO_MIXER_ENUM;
+	PROBE2(read__class__start, x->class_index, class->ncontrols);
+	for (unsigned i = 0; i < class->ncontrols; ++i) {
+		control = &class->controls[i];
+		(void)read_control(x, control);
+		if (control->type == AUDIO_MIXER_VALUE &&
+		    control->mute != NULL &&
+		    !control_in_class(class, control->mute)) {
+			(void)read_control(x, control->mute);
+		}
+	}
+	PROBE1(read__class__done, x->class_index);
+}
 
-	if (ioctl(fd, AUDIO_MIXER_READ, &dev) < 0) {
-		fprintf(stderr, "aiomixer: AUDIO_MIXER_READ %d failed: %s\n",
-		    dev.dev, strerror(errno));
+static void
+select_enum_button(struct aiomixer_control *control)
+{
+	/* a mute is read along with its level, maybe before it has a widget */
+	if (control->enum_widget == NULL) {
 		return;
 	}
-
 	for (int i = 0; i < control->e.num_mem; ++i) {
-		if (control->e.member[i].ord == dev.un.ord) {
+		if (control->e.member[i].ord == control->value->un.ord) {
 			setCDKButtonboxCurrentButton(control->enum_widget, i);
 			break;
 		}
@@ -316,199 +785,462 @@ enum_get_and_select(int fd, struct aiomixer_control *control)
 }
 
 static void
-set_get_and_select(int fd, struct aiomixer_control *control)
+select_set_button(struct aiomixer_control *control)
 {
-	mixer_ctrl_t dev = {0};
-
-	dev.dev = control->dev;
-	dev.type = AUDIO_MIXER_SET;
-
-	if (ioctl(fd, AUDIO_MIXER_READ, &dev) < 0) {
-		fprintf(stderr,
-		    "aiomixer: AUDIO_MIXER_READ %d failed: %s\n",
-		    dev.dev, strerror(errno));
+	if (control->set_widget == NULL) {
 		return;
 	}
-
 	for (int i = 0; i < control->s.num_mem; ++i) {
-		if (control->s.member[i].mask == dev.un.mask) {
+		if (control->s.member[i].mask == control->value->un.mask) {
 			setCDKButtonboxCurrentButton(control->set_widget, i);
 			break;
 		}
 	}
 }
 
+/*
+ * Whether the last known value of a control was read recently enough
+ * to be shown as it is when the focus lands on it.
+ */
+static bool
+value_fresh(struct aiomixer *x, struct aiomixer_control *control)
+{
+	return mixdev_fresh(x->md, control->dev, x->max_age);
+}
+
+/*
+ * Brings the widgets of a control gaining the focus up to date, going
+ * to the device only if its last known value is stale.
+ */
 static void
-levels_get_and_set(int fd, struct aiomixer_control *control)
+focus_value(struct aiomixer *x, struct aiomixer_control *control)
 {
-	mixer_ctrl_t dev = {0};
+	if (!value_fresh(x, control) && !read_control(x, control)) {
+		return;
+	}
+	switch (control->type) {
+	case AUDIO_MIXER_ENUM:
+		select_enum_button(control);
+		break;
+	case AUDIO_MIXER_SET:
+		select_set_button(control);
+		break;
+	case AUDIO_MIXER_VALUE:
+		set_sliders(control);
+		break;
+	}
+}
 
-	dev.dev = control->dev;
-	dev.type = AUDIO_MIXER_VALUE;
-	dev.un.value.num_channels = control->v.num_channels;
+/*
+ * Runs from the main loop while no keys come: re-reads a few of the
+ * visible controls with stale values, the focused one first, so that
+ * changes made by other programs show up without any key having to
+ * wait for the device.
+ */
+static void
+revalidate_tick(void *arg)
+{
+	struct aiomixer *x = arg;
+	struct aiomixer_class *class = &x->classes[x->class_index];
+	struct aiomixer_control *control;
+	mixer_ctrl_t dev, cached;
+	unsigned start, n = 0;
 
-	if (ioctl(fd, AUDIO_MIXER_READ, &dev) < 0) {
-		fprintf(stderr, "aiomixer: AUDIO_MIXER_READ %d failed: %s\n",
-		    dev.dev, strerror(errno));
+	if (class->ncontrols == 0 || x->devices[x->device_index].detached) {
 		return;
 	}
-	for (int chan = 0; chan < control->v.num_channels; ++chan) {
-		setCDKSliderValue(control->value_widget[chan],
-			dev.un.value.level[chan]);
+	start = class->controls[x->control_index].pos;
+	for (unsigned i = 0; i < class->ncontrols && n < REVALIDATE_MAX; ++i) {
+		control = &class->controls[class->order[(start + i) %
+		    class->ncontrols]];
+		if (!control_visible(x, control) || value_fresh(x, control)) {
+			continue;
+		}
+		n++;
+		cached = *control->value;
+		/* failures show up when the control is used */
+		if (mixdev_read(x->md, control->dev, &dev) == -1) {
+			continue;
+		}
+		if (!mixdev_same(&cached, &dev)) {
+			show_value(x, dev.dev);
+		}
 	}
 }
 
 static void
-set_enum(int fd, int dev_id, int ord)
+set_enum(struct aiomixer *x, struct aiomixer_control *control, int ord)
 {
-	mixer_ctrl_t dev = {0};
+	mixer_ctrl_t dev = {0}, before;
 
-	dev.dev = dev_id;
+	dev.dev = control->dev;
 	dev.type = AUDIO_MIXER_ENUM;
+	before = *control->value;
 	dev.un.ord = ord;
 
-	if (ioctl(fd, AUDIO_MIXER_WRITE, &dev) < 0) {
-		fprintf(stderr, "aiomixer: AUDIO_MIXER_WRITE %d failed: %s\n",
+	if (mixdev_write(x->md, &dev) < 0) {
+		show_error(x, "AUDIO_MIXER_WRITE %d failed: %s",
 		    dev.dev, strerror(errno));
+		return;
+	}
+	history_push(&x->history, &before, &dev);
+	if (control->mute_of != NULL && control_visible(x, control->mute_of)) {
+		for (int i = 0; i < control_sliders(control->mute_of); ++i) {
+			draw_marks(control->mute_of, i);
+		}
 	}
 }
 
 static void
-set_set(int fd, int dev_id, int mask)
+set_set(struct aiomixer *x, struct aiomixer_control *control, int mask)
 {
-	mixer_ctrl_t dev = {0};
+	mixer_ctrl_t dev = {0}, before;
 
-	dev.dev = dev_id;
+	dev.dev = control->dev;
 	dev.type = AUDIO_MIXER_SET;
+	before = *control->value;
 	dev.un.mask = mask;
 
-	if (ioctl(fd, AUDIO_MIXER_WRITE, &dev) < 0) {
-		fprintf(stderr, "aiomixer: AUDIO_MIXER_WRITE %d failed: %s\n",
+	if (mixdev_write(x->md, &dev) < 0) {
+		show_error(x, "AUDIO_MIXER_WRITE %d failed: %s",
 		    dev.dev, strerror(errno));
+		return;
 	}
+	history_push(&x->history, &before, &dev);
 }
 
-static void 
-add_global_binds(struct aiomixer *x, EObjectType type, void *object)
+/*
+ * Errors go to the bottom line: writing to stderr under curses would
+ * garble the screen.  Before there is a screen, as with -P, they go
+ * to stderr after all.
+ */
+static void
+show_error(struct aiomixer *x, const char *fmt, ...)
 {
-	unsigned int i;
+	WINDOW *win;
+	va_list args;
 
-	for (i = 1; i <= x->nclasses; ++i) {
-		bindCDKObject(type, object, KEY_F0 + i, key_callback_global, x);
+	va_start(args, fmt);
+	if (x->screen == NULL) {
+		fputs("aiomixer: ", stderr);
+		vfprintf(stderr, fmt, args);
+		fputc('\n', stderr);
+		va_end(args);
+		return;
 	}
-	bindCDKObject(type, object, KEY_RESIZE, key_callback_global, x);
+	win = x->screen->window;
+	wmove(win, getmaxy(win) - 1, 0);
+	wclrtoeol(win);
+	wattron(win, COLOR_PAIR(PAIR_ERROR) | A_BOLD);
+	vw_printw(win, fmt, args);
+	wattroff(win, COLOR_PAIR(PAIR_ERROR) | A_BOLD);
+	wrefresh(win);
+	va_end(args);
 }
 
 static void
-add_directional_binds(struct aiomixer *x, EObjectType type, void *object, BINDFN fn)
+clear_error(struct aiomixer *x)
 {
-	bindCDKObject(type, object, KEY_UP, fn, x);
-	bindCDKObject(type, object, KEY_DOWN, fn, x);
-	bindCDKObject(type, object, KEY_LEFT, fn, x);
-	bindCDKObject(type, object, KEY_RIGHT, fn, x);
-	bindCDKObject(type, object, 'h', fn, x);
-	bindCDKObject(type, object, 'j', fn, x);
-	bindCDKObject(type, object, 'k', fn, x);
-	bindCDKObject(type, object, 'l', fn, x);
+	WINDOW *win = x->screen->window;
+
+	wmove(win, getmaxy(win) - 1, 0);
+	wclrtoeol(win);
 }
 
+/*
+ * Like show_error(), for things that are not going wrong.
+ */
 static void
-add_slider_binds(struct aiomixer *x, void *object)
+show_note(struct aiomixer *x, const char *fmt, ...)
 {
-	add_global_binds(x, vSLIDER, object);
-	add_directional_binds(x, vSLIDER, object, key_callback_slider);
-	bindCDKObject(vSLIDER, object, 'u', key_callback_slider, x);
-	bindCDKObject(vSLIDER, object, 'm', key_callback_slider, x);
+	WINDOW *win;
+	va_list args;
+
+	va_start(args, fmt);
+	if (x->screen == NULL) {
+		vfprintf(stdout, fmt, args);
+		fputc('\n', stdout);
+		va_end(args);
+		return;
+	}
+	win = x->screen->window;
+	wmove(win, getmaxy(win) - 1, 0);
+	wclrtoeol(win);
+	vw_printw(win, fmt, args);
+	wrefresh(win);
+	va_end(args);
 }
 
+/*
+ * The matches are listed on the bottom line, below the search entry,
+ * with the one Enter would jump to highlighted.
+ */
 static void
-add_class_button_binds(struct aiomixer *x, void *object)
+show_search_hits(struct aiomixer *x)
 {
-	add_global_binds(x, vBUTTONBOX, object);
-	add_directional_binds(x, vBUTTONBOX, object, key_callback_class_buttons);
-	bindCDKObject(vBUTTONBOX, object, 0x1b /* \e */, key_callback_class_buttons, x);
+	WINDOW *win = x->screen->window;
+	int y = getmaxy(win) - 1, width = getmaxx(win);
+	const char *name;
+	unsigned i;
+
+	wmove(win, y, 0);
+	wclrtoeol(win);
+	wprintw(win, "[%u/%u] ", x->nhits ? x->hit_index + 1 : 0, x->nhits);
+	for (i = x->hit_index; i < x->nhits; ++i) {
+		name = control_name(x, aiomixer_get_control_ref(x, x->hits[i]));
+		if (getcurx(win) + (int)strlen(name) + 1 >= width) {
+			break;
+		}
+		if (i == x->hit_index) {
+			wattron(win, A_REVERSE);
+		}
+		waddstr(win, name);
+		wattroff(win, A_REVERSE);
+		waddch(win, ' ');
+	}
+	wrefresh(win);
 }
 
-static void
-add_control_button_binds(struct aiomixer *x, void *object)
+static int
+search_changed(EObjectType cdktype, void *object, void *clientData,
+	chtype key)
 {
-	add_global_binds(x, vBUTTONBOX, object);
-	add_directional_binds(x, vBUTTONBOX, object, key_callback_control_buttons);
+	struct aiomixer *x = clientData;
+	const char *query = getCDKEntryValue(object);
+
+	(void)cdktype; /* unused */
+	(void)key; /* unused */
+	/* also called after keys that only move through the matches */
+	if (strcmp(query, x->query) == 0) {
+		return true;
+	}
+	snprintf(x->query, sizeof(x->query), "%s", query);
+	x->hits = search_update(&x->search, query, &x->nhits);
+	x->hit_index = 0;
+	show_search_hits(x);
+	return true;
 }
 
-static void
-create_class_widgets(struct aiomixer *x, int y)
+static int key_callback_search(EObjectType cdktype,
+	void *object, void *clientData, chtype key)
 {
-	char label[48];
-	struct aiomixer_class *class = &x->classes[x->class_index];
+	struct aiomixer *x = clientData;
+
+	(void)cdktype; /* unused */
+	(void)object; /* unused */
+	if (x->nhits == 0) {
+		return false;
+	}
+	switch (key) {
+	case KEY_UP:
+		x->hit_index = (x->hit_index + x->nhits - 1) % x->nhits;
+		break;
+	case KEY_DOWN:
+	case '\t':
+		x->hit_index = (x->hit_index + 1) % x->nhits;
+		break;
+	}
+	show_search_hits(x);
+	return false;
+}
+
+static void
+search_controls(struct aiomixer *x)
+{
+	WINDOW *win = x->screen->window;
+	CDKENTRY *entry;
+	struct control_ref ref;
+	bool jump;
+
+	entry = newCDKEntry(x->screen, 0, getmaxy(win) - 2, NULL, "/",
+		A_NORMAL, ' ', vMIXED, getmaxx(win) - 2,
+		0, SEARCH_MAX_QUERY - 1, false, false);
+	if (entry == NULL) {
+		show_error(x, "Couldn't create search entry");
+		return;
+	}
+	setCDKEntryPostProcess(entry, search_changed, x);
+	bindCDKObject(vENTRY, entry, KEY_UP, key_callback_search, x);
+	bindCDKObject(vENTRY, entry, KEY_DOWN, key_callback_search, x);
+	bindCDKObject(vENTRY, entry, '\t', key_callback_search, x);
+	x->query[0] = '\0';
+	x->hits = search_update(&x->search, "", &x->nhits);
+	x->hit_index = 0;
+	show_search_hits(x);
+
+	set_key_timer(x, false);
+	activateCDKEntry(entry, NULL);
+	set_key_timer(x, true);
+	jump = entry->exitType == vNORMAL && x->nhits > 0;
+	if (jump) {
+		ref = x->search_refs[x->hits[x->hit_index]];
+	}
+	destroyCDKEntry(entry);
+	wmove(win, getmaxy(win) - 2, 0);
+	wclrtobot(win);
+	wrefresh(win);
+	if (jump) {
+		jump_to_control(x, ref.class_index, ref.control_index);
+	}
+}
+
+static void
+jump_to_control(struct aiomixer *x, unsigned class_index,
+    unsigned control_index)
+{
+	if (class_index != x->class_index) {
+		destroy_class_widgets(x);
+		x->class_index = class_index;
+		x->top_control = 0;
+		setCDKButtonboxCurrentButton(x->class_buttons, class_index);
+		drawCDKButtonboxButtons(x->class_buttons);
+		create_class_widgets(x, 3);
+	}
+	select_class_widget(x, x->classes[class_index].controls[control_index].pos);
+}
+
+static void 
+add_global_binds(struct aiomixer *x, EObjectType type, void *object)
+{
+	unsigned int i;
+
+	for (i = 1; i <= x->nclasses; ++i) {
+		bindCDKObject(type, object, KEY_F0 + i, key_callback_global, x);
+	}
+	bindCDKObject(type, object, KEY_RESIZE, key_callback_global, x);
+	bindCDKObject(type, object, '/', key_callback_global, x);
+	bindCDKObject(type, object, 'n', key_callback_global, x);
+	bindCDKObject(type, object, 'p', key_callback_global, x);
+	bindCDKObject(type, object, 'c', key_callback_global, x);
+	bindCDKObject(type, object, 'z', key_callback_global, x);
+	bindCDKObject(type, object, 'Z', key_callback_global, x);
+	setCDKObjectPreProcess(ObjPtr(object), device_changes, x);
+}
+
+static void
+add_directional_binds(struct aiomixer *x, EObjectType type, void *object, BINDFN fn)
+{
+	bindCDKObject(type, object, KEY_UP, fn, x);
+	bindCDKObject(type, object, KEY_DOWN, fn, x);
+	bindCDKObject(type, object, KEY_LEFT, fn, x);
+	bindCDKObject(type, object, KEY_RIGHT, fn, x);
+	bindCDKObject(type, object, 'h', fn, x);
+	bindCDKObject(type, object, 'j', fn, x);
+	bindCDKObject(type, object, 'k', fn, x);
+	bindCDKObject(type, object, 'l', fn, x);
+}
+
+static void
+add_slider_binds(struct aiomixer *x, void *object)
+{
+	add_global_binds(x, vSLIDER, object);
+	add_directional_binds(x, vSLIDER, object, key_callback_slider);
+	bindCDKObject(vSLIDER, object, 'u', key_callback_slider, x);
+	bindCDKObject(vSLIDER, object, 'm', key_callback_slider, x);
+	bindCDKObject(vSLIDER, object, '+', key_callback_group, x);
+	bindCDKObject(vSLIDER, object, '-', key_callback_group, x);
+}
+
+static void
+add_class_button_binds(struct aiomixer *x, void *object)
+{
+	add_global_binds(x, vBUTTONBOX, object);
+	add_directional_binds(x, vBUTTONBOX, object, key_callback_class_buttons);
+	bindCDKObject(vBUTTONBOX, object, 0x1b /* \e */, key_callback_class_buttons, x);
+}
+
+static void
+add_control_button_binds(struct aiomixer *x, void *object)
+{
+	add_global_binds(x, vBUTTONBOX, object);
+	add_directional_binds(x, vBUTTONBOX, object, key_callback_control_buttons);
+	bindCDKObject(vBUTTONBOX, object, '+', key_callback_group, x);
+	bindCDKObject(vBUTTONBOX, object, '-', key_callback_group, x);
+}
+
+static void
+create_class_widgets(struct aiomixer *x, int y)
+{
+	struct aiomixer_class *class = &x->classes[x->class_index];
 	struct aiomixer_control *control;
 	char **list;
 	unsigned i;
-	int width;
+	int width, col;
+	bool shown;
 	char *title[] = { "</B/56>Controls<!56>" };
 	int max_y = getmaxy(x->screen->window) - y - 3;
 
+	PROBE1(create__class__widgets__start, x->class_index);
+	clear_error(x);
+	read_class(x, class);
+	x->top_control = 0;
 	class->heading_label = newCDKLabel(x->screen, 0, y, title, 1, false, false);
 	drawCDKLabel(class->heading_label, false);
 	y += 2;
 
 	for (i = 0; i < class->ncontrols; ++i) {
-		control = &class->controls[i];
+		control = &class->controls[class->order[i]];
+		col = control_chained(class, control) ? 2 : 0;
+		shown = !control_hidden(class, control);
 		switch (control->type) {
 		case AUDIO_MIXER_ENUM:
 			if ((list = make_enum_list(&control->e)) != NULL) {
-				snprintf(label, sizeof(label), "</16>%s<!16>", control->name);
 				width = sum_str_list_lengths((const char **)list, control->e.num_mem)
 					+ control->e.num_mem + 10;
 				control->enum_widget = newCDKButtonbox(x->screen,
-					0, y, 5, width,
-					label, 1, control->e.num_mem,
+					col, y, 5, width,
+					names_get(&x->names, control->label_id),
+					1, control->e.num_mem,
 					list, control->e.num_mem,
 					COLOR_PAIR(PAIR_ENUM_SET) | A_BOLD, false, false);
 				if (control->enum_widget == NULL) {
 					quit_err(x, "Couldn't create enum control");
 				}
-				enum_get_and_select(x->fd, control);
+				select_enum_button(control);
 				add_control_button_binds(x, control->enum_widget);
-				if (y < max_y) {
-					drawCDKButtonbox(control->enum_widget, false);
+				if (shown && y < max_y) {
+					draw_buttons(control);
 				}
 			} else {
 				quit_perror(x);
 			}
 			free(list);
-			y += 3;
+			y += shown ? 3 : 0;
 			break;
 		case AUDIO_MIXER_SET:
 			if ((list = make_set_list(&control->s)) != NULL) {
-				snprintf(label, sizeof(label), "</16>%s<!16>", control->name);
 				width = sum_str_list_lengths((const char **)list, control->s.num_mem)
 					+ control->s.num_mem + 10;
 				control->set_widget = newCDKButtonbox(x->screen,
-					0, y, 5, width,
-					label, 1, control->s.num_mem,
+					col, y, 5, width,
+					names_get(&x->names, control->label_id),
+					1, control->s.num_mem,
 					list, control->s.num_mem,
 					COLOR_PAIR(PAIR_ENUM_SET) | A_BOLD, false, false);
 				if (control->set_widget == NULL) {
 					quit_err(x, "Couldn't create set control");
 				}
-				set_get_and_select(x->fd, control);
+				select_set_button(control);
 				add_control_button_binds(x, control->set_widget);
-				if (y < max_y) {
-					drawCDKButtonbox(control->set_widget, false);
+				if (shown && y < max_y) {
+					draw_buttons(control);
 				}
 			} else {
 				quit_perror(x);
 			}
 			free(list);
-			y += 3;
+			y += shown ? 3 : 0;
 			break;
 		case AUDIO_MIXER_VALUE:
-			for (int chan = 0; chan < control->v.num_channels; ++chan) {
-				snprintf(label, sizeof(label), "</16>%s (channel %d)<!16>",
-					control->name, chan);
-				control->value_widget[chan] = newCDKSlider(x->screen, 0, y,
-					label, "% ", '#' | COLOR_PAIR(PAIR_SLIDER) | A_BOLD,
+			/* too tall to ever fit is compact regardless */
+			control->compact = control->v.num_channels > 1 &&
+			    (x->compact || 3 * control->v.num_channels > max_y);
+			for (int chan = 0; chan < control_sliders(control); ++chan) {
+				control->value_widget[chan] = newCDKSlider(x->screen,
+					col, y + 3 * chan,
+					names_get(&x->names, control->label_id +
+					    (control->compact ? control->v.num_channels : chan)),
+					"% ", '#' | COLOR_PAIR(PAIR_SLIDER) | A_BOLD,
 					0, 50, 0, 255,
 					control->v.delta, control->v.delta * 2,
 					false, false);
@@ -516,19 +1248,19 @@ create_class_widgets(struct aiomixer *x, int y)
 					quit_err(x, "Couldn't create slider");
 				}
 				add_slider_binds(x, control->value_widget[chan]);
-				y += 3;
 			}
-			y -= 3 * control->v.num_channels;
-			levels_get_and_set(x->fd, control);
-			for (int chan = 0; chan < control->v.num_channels; ++chan) {
+			set_sliders(control);
+			for (int chan = 0; shown && chan < control_sliders(control);
+			    ++chan) {
 				if (y < max_y) {
-					drawCDKSlider(control->value_widget[chan], false);
+					draw_slider(control, chan);
 				}
-				y += 3;
+				y += control->compact ? control_rows(control) : 3;
 			}
 			break;
 		}
 	}
+	PROBE2(create__class__widgets__done, x->class_index, class->ncontrols);
 }
 
 static void
@@ -537,6 +1269,7 @@ destroy_class_widgets(struct aiomixer *x)
 	struct aiomixer_class *class = &x->classes[x->class_index];
 	struct aiomixer_control *control;
 
+	PROBE1(destroy__class__widgets, x->class_index);
 	destroyCDKLabel(class->heading_label);
 	class->heading_label = NULL;
 
@@ -552,7 +1285,7 @@ destroy_class_widgets(struct aiomixer *x)
 			control->set_widget = NULL;
 			break;
 		case AUDIO_MIXER_VALUE:
-			for (int j = 0; j < control->v.num_channels; ++j) {
+			for (int j = 0; j < control_sliders(control); ++j) {
 				destroyCDKSlider(control->value_widget[j]);
 				control->value_widget[j] = NULL;
 			}
@@ -562,176 +1295,626 @@ destroy_class_widgets(struct aiomixer *x)
 }
 
 static bool
-control_within_bounds(struct aiomixer *x, unsigned index)
+control_in_class(struct aiomixer_class *class, struct aiomixer_control *control)
+{
+	return control >= class->controls &&
+	    control < class->controls + class->ncontrols;
+}
+
+static bool
+control_chained(struct aiomixer_class *class, struct aiomixer_control *control)
+{
+	return &class->controls[control->group] != control;
+}
+
+static bool
+control_hidden(struct aiomixer_class *class, struct aiomixer_control *control)
+{
+	return control_chained(class, control) &&
+	    !class->controls[control->group].expanded;
+}
+
+/*
+ * The display position of the next control shown in direction dir,
+ * -1 or ncontrols past either end.
+ */
+static int
+step_control(struct aiomixer *x, int pos, int dir)
 {
 	struct aiomixer_class *class = &x->classes[x->class_index];
-	int max_y = getmaxy(x->screen->window) - 3;
-	int y = 5;
 
-	if (index < x->top_control) {
-		return false;
-	}
+	do {
+		pos += dir;
+	} while (pos >= 0 && (unsigned)pos < class->ncontrols &&
+	    control_hidden(class, &class->controls[class->order[pos]]));
+	return pos;
+}
 
-	for (unsigned i = x->top_control; i < class->ncontrols; ++i) {
-		switch (class->controls[i].type) {
-		case AUDIO_MIXER_ENUM:
-		case AUDIO_MIXER_SET:
-			y += 3;
-			break;
-		case AUDIO_MIXER_VALUE:
-			y += (3 * class->controls[i].v.num_channels);
-			break;
-		}
-		if (y >= max_y) return false;
-		if (i == index) break;
+/*
+ * Whether the control belongs to the current class and is on screen.
+ */
+static bool
+control_visible(struct aiomixer *x, struct aiomixer_control *control)
+{
+	struct aiomixer_class *class = &x->classes[x->class_index];
+
+	if (!control_in_class(class, control) ||
+	    control_hidden(class, control)) {
+		return false;
 	}
-	return true;
+	return control_within_bounds(x, control->pos);
 }
 
+/*
+ * The mute state and, for the first row of a chain's root, whether
+ * the chain is collapsed are shown at the right end of the title row.
+ */
 static void
-reposition_visible_widgets(struct aiomixer *x)
+draw_marks(struct aiomixer_control *control, int chan)
 {
-	struct aiomixer_control *control;
-	struct aiomixer_class *class = &x->classes[x->class_index];
-	unsigned max_control = class->ncontrols;
-	int y = 5;
+	char group[16];
+	WINDOW *win;
+	bool muted;
+	int col, n;
 
-	for (unsigned i = 0; i < class->ncontrols; ++i) {
-		control = &class->controls[i];
-		switch (control->type) {
-		case AUDIO_MIXER_ENUM:
-			moveCDKButtonbox(control->enum_widget, INT_MAX, INT_MAX, false, false);
-			eraseCDKButtonbox(control->enum_widget);
-			break;
-		case AUDIO_MIXER_SET:
-			moveCDKButtonbox(control->set_widget, INT_MAX, INT_MAX, false, false);
-			eraseCDKButtonbox(control->set_widget);
-			break;
-		case AUDIO_MIXER_VALUE:
-			for (int j = 0; j < control->v.num_channels; ++j) {
-				moveCDKSlider(control->value_widget[j], INT_MAX, INT_MAX, false, false);
-				eraseCDKSlider(control->value_widget[j]);
-			}
-			break;
+	if (control->type == AUDIO_MIXER_VALUE) {
+		if (control->value_widget[chan] == NULL) {
+			return;
 		}
-	}
-	for (unsigned i = x->top_control; i < class->ncontrols; ++i) {
-		control = &class->controls[i];
-		if (!control_within_bounds(x, i)) {
-			max_control = i;
-			break;
+		win = control->value_widget[chan]->win;
+		col = control->value_widget[chan]->boxWidth;
+	} else {
+		if (control->enum_widget == NULL) {
+			return;
 		}
-		switch (control->type) {
-		case AUDIO_MIXER_ENUM:
-			moveCDKButtonbox(control->enum_widget, 0, y, false, false);
-			y += 3;
-			break;
-		case AUDIO_MIXER_SET:
-			moveCDKButtonbox(control->set_widget, 0, y, false, false);
-			y += 3;
-			break;
-		case AUDIO_MIXER_VALUE:
-			for (int j = 0; j < control->v.num_channels; ++j) {
-				moveCDKSlider(control->value_widget[j], 0, y, false, false);
-				y += 3;
-			}
-			break;
+		win = control->enum_widget->win;
+		col = control->enum_widget->boxWidth;
+	}
+	if (control->mute != NULL) {
+		muted = control->mute->value->un.ord == control->mute_on;
+		col -= 7;
+		if (muted) {
+			wattron(win, COLOR_PAIR(PAIR_ERROR) | A_BOLD);
 		}
+		mvwaddstr(win, 0, col, muted ? "[muted]" : "       ");
+		wattroff(win, COLOR_PAIR(PAIR_ERROR) | A_BOLD);
 	}
-	for (unsigned i = x->top_control; i < max_control; ++i) {
-		control = &class->controls[i];
-		switch (control->type) {
-		case AUDIO_MIXER_ENUM:
-			drawCDKButtonbox(control->enum_widget, false);
-			break;
-		case AUDIO_MIXER_SET:
-			drawCDKButtonbox(control->set_widget, false);
-			break;
-		case AUDIO_MIXER_VALUE:
-			for (int j = 0; j < control->v.num_channels; ++j) {
-				drawCDKSlider(control->value_widget[j], false);
-			}
-			break;
+	if (control->nmembers > 0 && chan == 0) {
+		n = snprintf(group, sizeof(group), "[+%u] ", control->nmembers);
+		if (control->expanded) {
+			memset(group, ' ', n);
+			memcpy(group, "[-]", 3);
 		}
+		col -= n;
+		mvwaddstr(win, 0, col, group);
 	}
-	/* XXX moving any widgets seems to mess up things */
-	drawCDKLabel(x->title_label, false);
-	drawCDKLabel(class->heading_label, false);
-	drawCDKButtonbox(x->class_buttons, false);
+	wrefresh(win);
 }
 
 static void
-select_class_widget(struct aiomixer *x, int index)
+draw_buttons(struct aiomixer_control *control)
 {
-	struct aiomixer_class *class = &x->classes[x->class_index];
-	struct aiomixer_control *control;
-	bool reposition = false;
-	int result;
+	drawCDKButtonbox(control->enum_widget, false);
+	draw_marks(control, 0);
+}
 
-	if (index < 0 || class->ncontrols < 1) {
-		select_class(x);
-		return;
-	}
-	if ((unsigned)index >= class->ncontrols) {
-		select_class_widget(x, 0);
-		return;
+static void
+draw_slider(struct aiomixer_control *control, int chan)
+{
+	drawCDKSlider(control->value_widget[chan], false);
+	if (control->compact) {
+		draw_channels(control);
 	}
-	control = &class->controls[index];
-	x->control_index = index;
-	if (x->top_control > x->control_index) {
-		x->top_control = index;
-		reposition = true;
+	draw_marks(control, chan);
+}
+
+/*
+ * Compact level controls have a single slider for the focused
+ * channel, with all the channels shown as a group of bars on the rows
+ * of its title below the name.
+ */
+static int
+control_sliders(struct aiomixer_control *control)
+{
+	return control->compact ? 1 : control->v.num_channels;
+}
+
+static int
+compact_rows(struct aiomixer_control *control)
+{
+	return (control->v.num_channels + COMPACT_ROW_CHANNELS - 1) /
+	    COMPACT_ROW_CHANNELS;
+}
+
+static int
+control_rows(struct aiomixer_control *control)
+{
+	if (control->type != AUDIO_MIXER_VALUE) {
+		return 3;
 	}
-	if (x->top_control < x->control_index) {
-		while (!control_within_bounds(x, x->control_index)) {
-			x->top_control += 1;
-		}
-		reposition = true;
+	return control->compact ? 3 + compact_rows(control) :
+	    3 * control->v.num_channels;
+}
+
+static CDKSLIDER *
+channel_slider(struct aiomixer_control *control, int chan)
+{
+	return control->value_widget[control->compact ? 0 : chan];
+}
+
+static int
+title_width(struct aiomixer_control *control, int chan)
+{
+	char suffix[32];
+
+	if (control->compact) {
+		return strlen(control->name);
 	}
-	if (reposition) {
-		reposition_visible_widgets(x);
+	return strlen(control->name) +
+	    snprintf(suffix, sizeof(suffix), " (channel %d)", chan);
+}
+
+static void
+set_sliders(struct aiomixer_control *control)
+{
+	if (control->compact) {
+		setCDKSliderValue(control->value_widget[0],
+		    control->value->un.value.level[control->current_chan]);
+		return;
 	}
-	switch (control->type) {
-	case AUDIO_MIXER_ENUM:
-		enum_get_and_select(x->fd, control);
-		result = activateCDKButtonbox(control->enum_widget, false);
-		if (result == -1) {
-			select_class(x);
-		} else {
-			select_class_widget(x, index + 1);
-		}
-		break;
-	case AUDIO_MIXER_SET:
-		set_get_and_select(x->fd, control);
-		result = activateCDKButtonbox(control->set_widget, false);
-		if (result == -1) {
-			select_class(x);
-		} else {
-			select_class_widget(x, index + 1);
+	for (int chan = 0; chan < control->v.num_channels; ++chan) {
+		if (control->value_widget[chan] == NULL) {
+			break;
 		}
-		break;
-	case AUDIO_MIXER_VALUE:
-		levels_get_and_set(x->fd, control);
-		result = activateCDKSlider(control->value_widget[control->current_chan], false);
-		if (result == -1) {
-			select_class(x);
-		} else {
-			if (control->current_chan < (control->v.num_channels - 1)) {
-				control->current_chan++;
-				select_class_widget(x, index);
-			} else {
-				control->current_chan = 0;
-				select_class_widget(x, index + 1);
+		setCDKSliderValue(control->value_widget[chan],
+		    control->value->un.value.level[chan]);
+	}
+}
+
+static void
+draw_channels(struct aiomixer_control *control)
+{
+	CDKSLIDER *slider = control->value_widget[0];
+	WINDOW *win = slider->win;
+	int n = control->v.num_channels, rows = compact_rows(control);
+	int per_row = (n + rows - 1) / rows;
+	int cells = (slider->boxWidth - 1) / per_row - 4;
+	int len, width, fill;
+	chtype attr;
+	char num[12];
+
+	for (int r = 0; r < rows; ++r) {
+		wmove(win, 1 + r, 0);
+		for (int chan = r * per_row; chan < n && chan < (r + 1) * per_row;
+		    ++chan) {
+			len = snprintf(num, sizeof(num), "%d", chan);
+			width = cells - (len - 1);
+			if (width < 1) {
+				width = 1;
 			}
+			fill = (control->value->un.value.level[chan] * width +
+			    127) / 255;
+			attr = chan == control->current_chan ? A_REVERSE : A_NORMAL;
+			wattron(win, attr);
+			waddstr(win, num);
+			waddch(win, '[');
+			for (int i = 0; i < width; ++i) {
+				waddch(win, i < fill ?
+				    '#' | COLOR_PAIR(PAIR_SLIDER) | A_BOLD : ' ');
+			}
+			waddch(win, ']');
+			wattroff(win, attr);
+			waddch(win, ' ');
 		}
-		break;
 	}
+	wrefresh(win);
 }
 
+/*
+ * Meters are given by control name, which may or may not exist on the
+ * device being shown.
+ */
 static void
-select_class(struct aiomixer *x)
+link_meters(struct aiomixer *x)
 {
-	int result;
+	struct aiomixer_control *control;
+
+	for (unsigned i = 0; i < x->nmeters; ++i) {
+		control = find_control(x, x->meters[i].control);
+		if (control != NULL && control->type == AUDIO_MIXER_VALUE) {
+			control->meter = x->meters[i].meter;
+		}
+	}
+}
+
+/*
+ * Where a level goes on a meter cells wide, from -60 dBFS to full
+ * scale.
+ */
+static int
+meter_cell(float level, int cells)
+{
+	int cell;
+
+	if (level <= 0) {
+		return 0;
+	}
+	cell = (20 * log10f(level) + 60) / 60 * cells + 0.5f;
+	return cell < 0 ? 0 : cell > cells ? cells : cell;
+}
+
+/*
+ * A channel's meter goes on the title row of its slider, between the
+ * title and the marks: RMS as =, peak as - and the peak hold as |.
+ */
+static void
+draw_meter(struct aiomixer_control *control, int chan,
+    const struct meter_levels *l)
+{
+	CDKSLIDER *slider = channel_slider(control, chan);
+	WINDOW *win = slider->win;
+	int start, cells, rms = 0, peak = 0, hold = 0, c;
+	chtype ch;
+
+	start = title_width(control, chan) + 2;
+	cells = slider->boxWidth - start - 1;
+	if (control->mute != NULL) {
+		cells -= 7;
+	}
+	if (control->nmembers > 0 && slider == control->value_widget[0]) {
+		cells -= 5;
+	}
+	cells = (cells > METER_WIDTH ? METER_WIDTH : cells) - 2;
+	if (cells < 4) {
+		return;
+	}
+	if (l->channels > 0) {
+		c = chan < (int)l->channels ? chan : (int)l->channels - 1;
+		rms = meter_cell(l->rms[c], cells);
+		peak = meter_cell(l->peak[c], cells);
+		hold = meter_cell(l->hold[c], cells);
+	}
+	mvwaddch(win, 0, start, '[');
+	for (int i = 0; i < cells; ++i) {
+		ch = i < rms ? '=' : i < peak ? '-' : ' ';
+		if (i == hold - 1) {
+			ch = '|' | A_BOLD;
+		}
+		/* the top 6 dB */
+		ch |= COLOR_PAIR(i >= cells * 9 / 10 ? PAIR_ERROR : PAIR_SLIDER);
+		waddch(win, ch);
+	}
+	waddch(win, ']');
+	wrefresh(win);
+}
+
+/*
+ * Redraw the meters on screen, at most METER_FPS times a second unless
+ * forced.
+ */
+static void
+draw_meters(struct aiomixer *x, bool force)
+{
+	struct aiomixer_class *class = &x->classes[x->class_index];
+	struct aiomixer_control *control;
+	struct meter_levels levels;
+	struct timespec now;
+	long ms;
+
+	if (x->nmeters == 0 || x->screen == NULL) {
+		return;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	ms = (now.tv_sec - x->meters_drawn.tv_sec) * 1000 +
+	    (now.tv_nsec - x->meters_drawn.tv_nsec) / 1000000;
+	if (!force && ms < 1000 / METER_FPS) {
+		return;
+	}
+	x->meters_drawn = now;
+	for (unsigned i = 0; i < class->ncontrols; ++i) {
+		control = &class->controls[i];
+		if (control->meter == NULL || !control_visible(x, control)) {
+			continue;
+		}
+		meter_levels(control->meter, &levels);
+		if (control->compact) {
+			draw_meter(control, control->current_chan, &levels);
+			continue;
+		}
+		for (int chan = 0; chan < control->v.num_channels; ++chan) {
+			if (control->value_widget[chan] != NULL) {
+				draw_meter(control, chan, &levels);
+			}
+		}
+	}
+}
+
+/*
+ * Keys are waited for a tenth of a second at most, after which ERR
+ * comes in and the main loop takes over until the next one, see
+ * device_changes().  Widgets that do not run it get the keys as usual.
+ */
+static void
+set_key_timer(struct aiomixer *x, bool on)
+{
+	if (x->loop == NULL) {
+		return;
+	}
+	if (on) {
+		halfdelay(1);
+	} else {
+		nocbreak();
+		cbreak();
+	}
+}
+
+static void
+toggle_mute(struct aiomixer *x, struct aiomixer_control *control)
+{
+	struct aiomixer_control *mute = control->mute;
+
+	if (mute == NULL) {
+		return;
+	}
+	set_enum(x, mute, mute->value->un.ord == control->mute_on ?
+	    control->mute_off : control->mute_on);
+	if (mute->enum_widget == NULL) {
+		return;
+	}
+	for (int i = 0; i < mute->e.num_mem; ++i) {
+		if (mute->e.member[i].ord == mute->value->un.ord) {
+			setCDKButtonboxCurrentButton(mute->enum_widget, i);
+			break;
+		}
+	}
+	if (control_visible(x, mute)) {
+		draw_buttons(mute);
+	}
+}
+
+static bool
+control_within_bounds(struct aiomixer *x, unsigned pos)
+{
+	struct aiomixer_class *class = &x->classes[x->class_index];
+	struct aiomixer_control *control;
+	int max_y = getmaxy(x->screen->window) - 3;
+	int y = 5;
+
+	if (pos < x->top_control) {
+		return false;
+	}
+
+	for (unsigned i = x->top_control; i < class->ncontrols; ++i) {
+		control = &class->controls[class->order[i]];
+		if (control_hidden(class, control)) {
+			if (i == pos) break;
+			continue;
+		}
+		y += control_rows(control);
+		if (y >= max_y) return false;
+		if (i == pos) break;
+	}
+	return true;
+}
+
+static void
+reposition_visible_widgets(struct aiomixer *x)
+{
+	struct aiomixer_control *control;
+	struct aiomixer_class *class = &x->classes[x->class_index];
+	unsigned max_control = class->ncontrols;
+	int y = 5, col;
+
+	PROBE2(reposition__start, x->class_index, x->top_control);
+	for (unsigned i = 0; i < class->ncontrols; ++i) {
+		control = &class->controls[i];
+		switch (control->type) {
+		case AUDIO_MIXER_ENUM:
+			moveCDKButtonbox(control->enum_widget, INT_MAX, INT_MAX, false, false);
+			eraseCDKButtonbox(control->enum_widget);
+			break;
+		case AUDIO_MIXER_SET:
+			moveCDKButtonbox(control->set_widget, INT_MAX, INT_MAX, false, false);
+			eraseCDKButtonbox(control->set_widget);
+			break;
+		case AUDIO_MIXER_VALUE:
+			for (int j = 0; j < control_sliders(control); ++j) {
+				moveCDKSlider(control->value_widget[j], INT_MAX, INT_MAX, false, false);
+				eraseCDKSlider(control->value_widget[j]);
+			}
+			break;
+		}
+	}
+	for (unsigned i = x->top_control; i < class->ncontrols; ++i) {
+		control = &class->controls[class->order[i]];
+		if (!control_within_bounds(x, i)) {
+			max_control = i;
+			break;
+		}
+		if (control_hidden(class, control)) {
+			continue;
+		}
+		col = control_chained(class, control) ? 2 : 0;
+		switch (control->type) {
+		case AUDIO_MIXER_ENUM:
+			moveCDKButtonbox(control->enum_widget, col, y, false, false);
+			y += 3;
+			break;
+		case AUDIO_MIXER_SET:
+			moveCDKButtonbox(control->set_widget, col, y, false, false);
+			y += 3;
+			break;
+		case AUDIO_MIXER_VALUE:
+			for (int j = 0; j < control_sliders(control); ++j) {
+				moveCDKSlider(control->value_widget[j], col, y, false, false);
+				y += control->compact ? control_rows(control) : 3;
+			}
+			break;
+		}
+	}
+	for (unsigned i = x->top_control; i < max_control; ++i) {
+		control = &class->controls[class->order[i]];
+		if (control_hidden(class, control)) {
+			continue;
+		}
+		PROBE1(draw__control, control->dev);
+		switch (control->type) {
+		case AUDIO_MIXER_ENUM:
+		case AUDIO_MIXER_SET:
+			draw_buttons(control);
+			break;
+		case AUDIO_MIXER_VALUE:
+			for (int j = 0; j < control_sliders(control); ++j) {
+				draw_slider(control, j);
+			}
+			break;
+		}
+	}
+	/* XXX moving any widgets seems to mess up things */
+	drawCDKLabel(x->title_label, false);
+	drawCDKLabel(class->heading_label, false);
+	drawCDKButtonbox(x->class_buttons, false);
+	PROBE2(reposition__done, x->top_control, max_control);
+}
+
+/*
+ * Resizes come in bursts while a window edge is dragged: the rest of
+ * them are swallowed until none came for a tenth of a second.
+ */
+static void
+settle_resize(struct aiomixer *x)
+{
+	WINDOW *win = x->screen->window;
+	int ch;
+
+	keypad(win, true);
+	halfdelay(1);
+	while ((ch = wgetch(win)) == KEY_RESIZE) {
+		continue;
+	}
+	if (ch != ERR) {
+		ungetch(ch);
+	}
+	nocbreak();
+	cbreak();
+	set_key_timer(x, true);
+}
+
+/*
+ * Only the layout changes with the size of the screen: the widgets are
+ * moved rather than created again, nothing is read from the device and
+ * the focus stays where it was, scrolled to only if it would be off
+ * the screen.
+ */
+static void
+relayout(struct aiomixer *x)
+{
+	struct aiomixer_class *class = &x->classes[x->class_index];
+	unsigned pos;
+
+	PROBE1(relayout, x->class_index);
+	werase(x->screen->window);
+	wnoutrefresh(x->screen->window);
+	moveCDKLabel(x->title_label, RIGHT, 0, false, false);
+	if (class->ncontrols > 0) {
+		pos = class->controls[x->control_index].pos;
+		if (x->top_control > pos) {
+			x->top_control = pos;
+		}
+		while (x->top_control < pos &&
+		    !control_within_bounds(x, pos)) {
+			x->top_control += 1;
+		}
+	}
+	reposition_visible_widgets(x);
+	draw_meters(x, true);
+}
+
+/*
+ * Focus the control at display position pos.
+ */
+static void
+select_class_widget(struct aiomixer *x, int pos)
+{
+	struct aiomixer_class *class = &x->classes[x->class_index];
+	struct aiomixer_control *control;
+	unsigned top = x->top_control;
+	bool reposition = false;
+	int result;
+
+	PROBE2(select__class__widget, x->class_index, pos);
+	if (pos < 0 || class->ncontrols < 1) {
+		select_class(x);
+		return;
+	}
+	if ((unsigned)pos >= class->ncontrols) {
+		select_class_widget(x, 0);
+		return;
+	}
+	control = &class->controls[class->order[pos]];
+	if (control_hidden(class, control)) {
+		/* jumped to from a search */
+		class->controls[control->group].expanded = true;
+		reposition = true;
+	}
+	x->control_index = class->order[pos];
+	if (x->top_control > (unsigned)pos) {
+		x->top_control = pos;
+	}
+	while (x->top_control < (unsigned)pos &&
+	    !control_within_bounds(x, pos)) {
+		x->top_control += 1;
+	}
+	/* nothing moves while the focus stays on screen */
+	if (reposition || x->top_control != top) {
+		reposition_visible_widgets(x);
+	}
+	switch (control->type) {
+	case AUDIO_MIXER_ENUM:
+		focus_value(x, control);
+		result = activateCDKButtonbox(control->enum_widget, false);
+		if (result == -1) {
+			select_class(x);
+		} else {
+			select_class_widget(x, step_control(x, pos, 1));
+		}
+		break;
+	case AUDIO_MIXER_SET:
+		focus_value(x, control);
+		result = activateCDKButtonbox(control->set_widget, false);
+		if (result == -1) {
+			select_class(x);
+		} else {
+			select_class_widget(x, step_control(x, pos, 1));
+		}
+		break;
+	case AUDIO_MIXER_VALUE:
+		focus_value(x, control);
+		if (control->compact) {
+			/* the highlight follows the focused channel */
+			draw_slider(control, 0);
+		}
+		result = activateCDKSlider(channel_slider(control,
+		    control->current_chan), false);
+		if (result == -1) {
+			select_class(x);
+		} else {
+			if (control->current_chan < (control->v.num_channels - 1)) {
+				control->current_chan++;
+				select_class_widget(x, pos);
+			} else {
+				control->current_chan = 0;
+				select_class_widget(x, step_control(x, pos, 1));
+			}
+		}
+		break;
+	}
+}
+
+static void
+select_class(struct aiomixer *x)
+{
+	int result;
 
 	result = activateCDKButtonbox(x->class_buttons, false);
 	destroy_class_widgets(x);
@@ -741,214 +1924,912 @@ select_class(struct aiomixer *x)
 		}
 		x->class_index = (unsigned)result;
 	}
-	create_class_widgets(x, 3);
-	select_class_widget(x, 0);
+	create_class_widgets(x, 3);
+	select_class_widget(x, 0);
+}
+
+static void
+set_level(struct aiomixer *x, struct aiomixer_control *control, int level, int channel)
+{
+	mixer_ctrl_t dev = {0}, before;
+	int i;
+
+	PROBE3(set__level, control->dev, channel, level);
+	dev.dev = control->dev;
+	dev.type = AUDIO_MIXER_VALUE;
+	dev.un.value.num_channels = control->v.num_channels;
+
+	if (!control->chans_unlocked) {
+		before = *control->value;
+		for (i = 0; i < control->v.num_channels; ++i) {
+			dev.un.value.level[i] = level;
+		}
+	} else {
+		if (mixdev_read(x->md, control->dev, &dev) < 0) {
+			show_error(x, "AUDIO_MIXER_READ %d failed: %s",
+			    dev.dev, strerror(errno));
+			return;
+		}
+		before = dev;
+		dev.un.value.level[channel] = level;
+	}
+	/* drawn before the write goes out, and taken back if it fails */
+	mixdev_store(x->md, &dev);
+	set_sliders(control);
+	for (i = 0; i < control_sliders(control); ++i) {
+		if (control->chans_unlocked && !control->compact && i != channel) {
+			continue;
+		}
+		draw_slider(control, i);
+	}
+
+	if (mixdev_write(x->md, &dev) < 0) {
+		show_error(x, "AUDIO_MIXER_WRITE %d failed: %s",
+		    dev.dev, strerror(errno));
+		mixdev_store(x->md, &before);
+		show_value(x, control->dev);
+		return;
+	}
+	history_push(&x->history, &before, &dev);
+}
+
+/*
+ * Bring a control's widgets in line with its last known value after it
+ * changed behind their back, as by undo.
+ */
+static void
+show_value(struct aiomixer *x, int dev)
+{
+	struct aiomixer_control *control = aiomixer_get_control(x, dev);
+	bool visible;
+
+	if (control == NULL || x->screen == NULL) {
+		return;
+	}
+	visible = control_visible(x, control);
+	switch (control->type) {
+	case AUDIO_MIXER_ENUM:
+		select_enum_button(control);
+		if (control->enum_widget != NULL && visible) {
+			draw_buttons(control);
+		}
+		if (control->mute_of != NULL &&
+		    control_visible(x, control->mute_of)) {
+			for (int i = 0; i < control_sliders(control->mute_of); ++i) {
+				draw_marks(control->mute_of, i);
+			}
+		}
+		break;
+	case AUDIO_MIXER_SET:
+		select_set_button(control);
+		if (control->set_widget != NULL && visible) {
+			draw_buttons(control);
+		}
+		break;
+	case AUDIO_MIXER_VALUE:
+		set_sliders(control);
+		for (int i = 0; visible && i < control_sliders(control); ++i) {
+			if (control->value_widget[i] != NULL) {
+				draw_slider(control, i);
+			}
+		}
+		break;
+	}
+}
+
+static void
+undo(struct aiomixer *x, bool redo)
+{
+	const mixer_ctrl_t *dev;
+
+	if (redo) {
+		dev = history_redo(&x->history, x->md);
+	} else {
+		dev = history_undo(&x->history, x->md);
+	}
+	if (dev != NULL) {
+		show_value(x, dev->dev);
+	} else if (errno == ENOENT) {
+		show_note(x, redo ? "Nothing to redo" : "Nothing to undo");
+	} else {
+		show_error(x, "AUDIO_MIXER_WRITE failed: %s", strerror(errno));
+	}
+}
+
+static struct aiomixer_control *
+find_control(struct aiomixer *x, const char *name)
+{
+	return aiomixer_get_control(x, mixdev_find(x->md, name));
+}
+
+static void
+preset_applied(void *arg, const struct preset_setting *s,
+    const mixer_ctrl_t *before, const mixer_ctrl_t *after, int error)
+{
+	struct applying *a = arg;
+	struct aiomixer *x = a->x;
+	const char *path = a->preset->path;
+
+	a->reported |= error != 0;
+	if (error == 0) {
+		history_push(&x->history, before, after);
+		show_value(x, after->dev);
+	} else if (after != NULL) {
+		show_error(x, "%s:%u: couldn't set %s: %s",
+		    path, s->line, s->name, strerror(error));
+	} else if (error == ENOENT) {
+		show_error(x, "%s:%u: no control %s", path, s->line, s->name);
+	} else {
+		show_error(x, "%s:%u: bad value for %s: %s",
+		    path, s->line, s->name, s->value);
+	}
+}
+
+/*
+ * Apply a preset in one go, only writing the controls whose values
+ * differ from the last known ones (read again if stale), each change
+ * going into the history.
+ * Returns the number of controls changed, or -1 if any setting could
+ * not be applied.
+ */
+static int
+apply_preset(struct aiomixer *x, struct preset *preset)
+{
+	struct applying a = { x, preset, false };
+	int changed;
+
+	changed = mixdev_apply(x->md, preset, x->max_age, preset_applied, &a);
+	if (changed == -1 && !a.reported) {
+		show_error(x, "Couldn't apply %s: %s", preset->name,
+		    strerror(errno));
+	}
+	return changed;
+}
+
+static void
+choose_preset(struct aiomixer *x)
+{
+	WINDOW *win = x->screen->window;
+	CDKSCROLL *scroll;
+	char **list;
+	int height, width = 0, choice, changed;
+
+	if (x->presets.n == 0) {
+		show_note(x, "No presets in %s", x->presets.path != NULL ?
+		    x->presets.path : "~/" DEFAULT_PRESETS);
+		return;
+	}
+	if ((list = calloc(x->presets.n, sizeof(*list))) == NULL) {
+		show_error(x, "Couldn't list presets: %s", strerror(errno));
+		return;
+	}
+	for (unsigned i = 0; i < x->presets.n; ++i) {
+		list[i] = x->presets.list[i].name;
+		if ((int)strlen(list[i]) > width) {
+			width = strlen(list[i]);
+		}
+	}
+	height = (int)x->presets.n + 2;
+	if (height > getmaxy(win) - 4) {
+		height = getmaxy(win) - 4;
+	}
+	scroll = newCDKScroll(x->screen, CENTER, CENTER, RIGHT, height,
+	    width < 8 ? 12 : width + 4, "Presets", list, x->presets.n, false,
+	    A_REVERSE, true, false);
+	if (scroll == NULL) {
+		free(list);
+		show_error(x, "Couldn't create preset list");
+		return;
+	}
+	set_key_timer(x, false);
+	choice = activateCDKScroll(scroll, NULL);
+	set_key_timer(x, true);
+	if (scroll->exitType != vNORMAL) {
+		choice = -1;
+	}
+	destroyCDKScroll(scroll);
+	free(list);
+	refreshCDKScreen(x->screen);
+	if (choice < 0) {
+		return;
+	}
+	changed = apply_preset(x, &x->presets.list[choice]);
+	if (changed >= 0) {
+		show_note(x, "Applied %s: %d control%s changed",
+		    x->presets.list[choice].name, changed,
+		    changed == 1 ? "" : "s");
+	}
+}
+
+static int key_callback_slider(EObjectType cdktype ,
+	void *object, void *clientData, chtype key)
+{
+	struct aiomixer *x = clientData;
+	struct aiomixer_class *class = &x->classes[x->class_index];
+	struct aiomixer_control *control = &class->controls[x->control_index];
+	CDKSLIDER *widget = object;
+	int new_value;
+
+	(void)cdktype; /* unused */
+	switch (key) {
+	case 'k':
+	case KEY_UP:
+		if (control->current_chan > 0) {
+			control->current_chan--;
+			select_class_widget(x, control->pos);
+		} else {
+			control->current_chan = 0;
+			select_class_widget(x, step_control(x, control->pos, -1));
+		}
+		break;
+	case 'j':
+	case KEY_DOWN:
+		if (control->current_chan < (control->v.num_channels - 1)) {
+			control->current_chan++;
+			select_class_widget(x, control->pos);
+		} else {
+			control->current_chan = 0;
+			select_class_widget(x, step_control(x, control->pos, 1));
+		}
+		break;
+	case 'h':
+	case KEY_LEFT:
+		new_value = getCDKSliderValue(widget) - control->v.delta;
+		if (new_value < getCDKSliderLowValue(widget)) {
+			new_value = getCDKSliderLowValue(widget);
+		}
+		set_level(x, control, new_value, control->current_chan);
+		break;
+	case 'l':
+	case KEY_RIGHT:
+		new_value = getCDKSliderValue(widget) + control->v.delta;
+		if (new_value > getCDKSliderHighValue(widget)) {
+			new_value = getCDKSliderHighValue(widget);
+		}
+		set_level(x, control, new_value, control->current_chan);
+		break;
+	case 'u':
+		control->chans_unlocked = !control->chans_unlocked;
+		break;
+	case 'm':
+		toggle_mute(x, control);
+		break;
+	}
+	return false;
+}
+
+static int key_callback_class_buttons(EObjectType cdktype,
+	void *object, void *clientData, chtype key)
+{
+	struct aiomixer *x = clientData;
+
+	(void)cdktype; /* unused */
+	(void)object; /* unused */
+	switch (key) {
+	case 0x1b: /* escape */
+		quit(x);
+		break;
+	case 'k':
+	case KEY_UP:
+		return true;
+	case 'j':
+	case KEY_DOWN:
+		select_class_widget(x, 0);
+		break;
+	case 'h':
+	case KEY_LEFT:
+		destroy_class_widgets(x);
+		x->class_index = (getCDKButtonboxCurrentButton(x->class_buttons) - 1) % x->nclasses;
+		create_class_widgets(x, 3);
+		if (key != KEY_LEFT) {
+			setCDKButtonboxCurrentButton(x->class_buttons, x->class_index);
+		}
+		break;
+	case 'l':
+	case KEY_RIGHT:
+		destroy_class_widgets(x);
+		x->class_index = (getCDKButtonboxCurrentButton(x->class_buttons) + 1) % x->nclasses;
+		create_class_widgets(x, 3);
+		if (key != KEY_RIGHT) {
+			setCDKButtonboxCurrentButton(x->class_buttons, x->class_index);
+		}
+		break;
+	}
+	return false;
+}
+
+static int key_callback_control_buttons(EObjectType cdktype,
+	void *object, void *clientData, chtype key)
+{
+	struct aiomixer *x = clientData;
+	struct aiomixer_class *class = &x->classes[x->class_index];
+	struct aiomixer_control *control = &class->controls[x->control_index];
+	CDKBUTTONBOX *widget = object;
+	int current;
+
+	(void)cdktype; /* unused */
+	current = getCDKButtonboxCurrentButton(widget);
+	switch (key) {
+	case 'k':
+	case KEY_UP:
+		select_class_widget(x, step_control(x, control->pos, -1));
+		break;
+	case 'j':
+	case KEY_DOWN:
+		select_class_widget(x, step_control(x, control->pos, 1));
+		break;
+	case 'h':
+	case KEY_LEFT:
+		current = (current - 1) % getCDKButtonboxButtonCount(widget);
+		if (control->type == AUDIO_MIXER_SET) {
+			set_set(x, control, control->s.member[current].mask);
+		} else if (control->type == AUDIO_MIXER_ENUM) {
+			set_enum(x, control, control->e.member[current].ord);
+		}
+		if (key != KEY_LEFT) {
+			setCDKButtonboxCurrentButton(widget, current);
+		}
+		break;
+	case 'l':
+	case KEY_RIGHT:
+		current = (current + 1) % getCDKButtonboxButtonCount(widget);
+		if (control->type == AUDIO_MIXER_SET) {
+			set_set(x, control, control->s.member[current].mask);
+		} else if (control->type == AUDIO_MIXER_ENUM) {
+			set_enum(x, control, control->e.member[current].ord);
+		}
+		if (key != KEY_RIGHT) {
+			setCDKButtonboxCurrentButton(widget, current);
+		}
+		break;
+	}
+	return false;
+}
+
+static int key_callback_global(EObjectType cdktype,
+	void *object, void *clientData, chtype key)
+{
+	struct aiomixer *x = clientData;
+
+	(void)cdktype; /* unused */
+	(void)object; /* unused */
+	if (key > KEY_F0 && key <= (KEY_F0 + x->nclasses + 1)) {
+		key = key - KEY_F0 - 1;
+		destroy_class_widgets(x);
+		setCDKButtonboxCurrentButton(x->class_buttons, key);
+		drawCDKButtonboxButtons(x->class_buttons);
+		x->class_index = key;
+		create_class_widgets(x, 3);
+		select_class_widget(x, 0);
+		return false;
+	}
+	switch (key) {
+	case KEY_RESIZE:
+		settle_resize(x);
+		relayout(x);
+		break;
+	case '/':
+		search_controls(x);
+		break;
+	case 'n':
+		switch_device(x);
+		break;
+	case 'p':
+		choose_preset(x);
+		break;
+	case 'c':
+		x->compact = !x->compact;
+		destroy_class_widgets(x);
+		create_class_widgets(x, 3);
+		select_class_widget(x,
+		    x->classes[x->class_index].controls[x->control_index].pos);
+		break;
+	case 'z':
+	case 'Z':
+		undo(x, key == 'Z');
+		break;
+	}
+	return false;
+}
+
+/*
+ * Drop the classes and controls of the current device.
+ */
+static void
+forget_controls(struct aiomixer *x)
+{
+	struct aiomixer_control *control;
+
+	names_free(&x->names);
+	search_free(&x->search);
+	free(x->by_dev);
+	free(x->search_refs);
+	for (unsigned i = 0; i < x->nclasses; ++i) {
+		for (unsigned j = 0; j < x->classes[i].ncontrols; ++j) {
+			control = &x->classes[i].controls[j];
+			if (control->type == AUDIO_MIXER_VALUE) {
+				free(control->value_widget);
+			}
+		}
+		free(x->classes[i].controls);
+		free(x->classes[i].order);
+	}
+	free(x->classes);
+	x->classes = NULL;
+	x->nclasses = 0;
+	x->by_dev = NULL;
+	x->ndevs = 0;
+	x->search_refs = NULL;
+	x->hits = NULL;
+	x->nhits = x->hit_index = 0;
+	x->class_index = x->control_index = x->top_control = 0;
+	history_clear(&x->history);
+}
+
+static void
+create_class_buttons(struct aiomixer *x)
+{
+	char **class_names;
+	char title[64];
+
+	if ((class_names = calloc(sizeof(char *), x->nclasses)) == NULL) {
+		quit_perror(x);
+	}
+	for (unsigned i = 0; i < x->nclasses; ++i) {
+		class_names[i] = x->classes[i].name;
+	}
+	if (x->hotplug != NULL) {
+		snprintf(title, sizeof(title), "</B/56>Classes (%s)<!56>",
+		    x->devices[x->device_index].name);
+	} else {
+		snprintf(title, sizeof(title), "</B/56>Classes<!56>");
+	}
+
+	x->class_buttons = newCDKButtonbox(x->screen, 0, 0,
+		2, sum_str_list_lengths((const char **)class_names, x->nclasses) + 10 + x->nclasses,
+		title, 1, x->nclasses,
+		class_names, x->nclasses,
+		COLOR_PAIR(PAIR_CLASS_BUTTONS_HL), false, false);
+	if (x->class_buttons == NULL) {
+		quit_err(x, "Couldn't create class buttons");
+	}
+	free(class_names);
+
+	drawCDKButtonbox(x->class_buttons, false);
+	add_class_button_binds(x, x->class_buttons);
+}
+
+/*
+ * Move on to the next device, forgetting the current one if it has
+ * been detached.  Like selecting a class, this never returns.
+ */
+static void
+switch_device(struct aiomixer *x)
+{
+	unsigned from = x->device_index;
+	struct aiomixer_device *dev = &x->devices[from];
+
+	if (x->ndevices < 2) {
+		show_error(x, "No other mixer devices");
+		return;
+	}
+	destroy_class_widgets(x);
+	eraseCDKButtonbox(x->class_buttons);
+	destroyCDKButtonbox(x->class_buttons);
+	forget_controls(x);
+	x->device_index = (from + 1) % x->ndevices;
+	if (dev->detached) {
+		mixdev_close(dev->md);
+		memmove(dev, dev + 1, (x->ndevices - from - 1) * sizeof(*dev));
+		x->ndevices--;
+		if (x->device_index > from) {
+			x->device_index--;
+		}
+	}
+	dev = &x->devices[x->device_index];
+	x->md = dev->md;
+	x->mixer = mixdev_mixer(dev->md);
+	if (aiomixer_devinfo(x) == -1) {
+		quit_perror(x);
+	}
+	drawCDKLabel(x->title_label, false);
+	create_class_buttons(x);
+	create_class_widgets(x, 3);
+	select_class_widget(x, 0);
+}
+
+static void
+attach_device(struct aiomixer *x, struct hotplug_event *ev)
+{
+	struct aiomixer_device *dev = &x->devices[x->device_index];
+	struct aiomixer_class *class = &x->classes[x->class_index];
+	struct mixdev *md;
+
+	if (dev->detached && strcmp(dev->name, ev->name) == 0 &&
+	    mixer_fingerprint(mixdev_info(dev->md, 0),
+	    mixdev_count(dev->md)) == mixer_fingerprint(ev->info, ev->ninfo)) {
+		/*
+		 * The same device back: carry on with the controls shown,
+		 * reading them again as it may have been reset meanwhile.
+		 * Behind a reconnect wrapper only the device is swapped,
+		 * which also restores it with -R.
+		 */
+		if (mixer_reconnect_attach(dev->device, ev->mixer) == 0) {
+			mixdev_invalidate(dev->md);
+		} else {
+			mixdev_set_mixer(dev->md, throttle_device(x, ev->mixer));
+			x->mixer = mixdev_mixer(dev->md);
+			dev->device = ev->mixer;
+		}
+		free(ev->info);
+		dev->detached = false;
+		read_class(x, class);
+		for (unsigned i = 0; i < class->ncontrols; ++i) {
+			show_value(x, class->controls[i].dev);
+		}
+		show_note(x, "%s reattached", dev->name);
+		return;
+	}
+	if (x->ndevices == MAX_DEVICES) {
+		show_error(x, "Too many mixer devices, ignoring %s", ev->name);
+		mixer_close(ev->mixer);
+		free(ev->info);
+		return;
+	}
+	dev = &x->devices[x->ndevices];
+	dev->device = ev->mixer;
+	ev->mixer = throttle_device(x, ev->mixer);
+	if ((md = mixdev_new(ev->mixer, ev->info, ev->ninfo)) == NULL) {
+		show_error(x, "Couldn't attach %s: %s", ev->name,
+		    strerror(errno));
+		mixer_close(ev->mixer);
+		free(ev->info);
+		return;
+	}
+	x->ndevices++;
+	memcpy(dev->name, ev->name, sizeof(dev->name));
+	dev->md = md;
+	dev->detached = false;
+	show_note(x, "%s attached, n switches to it", dev->name);
+}
+
+/*
+ * Other devices are simply closed and forgotten.  The current one is
+ * closed too, but its controls stay on screen, inert, until the user
+ * moves on or it comes back.  Where it has a reconnect wrapper, only
+ * the device under it is closed: whatever is stacked on top, such as
+ * the -r recording and the -m state table, carries on.
+ */
+static void
+detach_device(struct aiomixer *x, const char *name)
+{
+	struct aiomixer_device *dev;
+	unsigned i;
+
+	for (i = 0; i < x->ndevices; ++i) {
+		dev = &x->devices[i];
+		if (!dev->detached && strcmp(dev->name, name) == 0) {
+			break;
+		}
+	}
+	if (i == x->ndevices) {
+		return;
+	}
+	if (i == x->device_index) {
+		if (mixer_reconnect_detach(dev->device) == -1) {
+			if ((x->mixer = mixer_detached()) == NULL) {
+				quit_perror(x);
+			}
+			mixdev_set_mixer(dev->md, x->mixer);
+			dev->device = NULL;
+		}
+		dev->detached = true;
+		show_error(x, "%s detached", name);
+		return;
+	}
+	mixdev_close(dev->md);
+	memmove(dev, dev + 1, (x->ndevices - i - 1) * sizeof(*dev));
+	x->ndevices--;
+	if (x->device_index > i) {
+		x->device_index--;
+	}
+	show_note(x, "%s detached", name);
+}
+
+/*
+ * A request on the control socket: "name" is answered with the value
+ * of the control as "name=value", and "name=value" sets it first, the
+ * value being written as in presets.  Failures are answered with a
+ * line starting with "error:".
+ */
+static void
+control_request(void *arg, const char *line, char *reply, size_t size)
+{
+	struct aiomixer *x = arg;
+	struct aiomixer_control *control;
+	const struct mixer_devinfo *m;
+	mixer_ctrl_t cached, before, after;
+	char name[MAX_CONTROL_LEN];
+	const char *value = strchr(line, '=');
+	size_t len = value != NULL ? (size_t)(value - line) : strlen(line);
+	int n;
+
+	if (len == 0 || len >= sizeof(name)) {
+		snprintf(reply, size, "error: bad request");
+		return;
+	}
+	memcpy(name, line, len);
+	name[len] = '\0';
+	if ((control = find_control(x, name)) == NULL) {
+		snprintf(reply, size, "error: no control %s", name);
+		return;
+	}
+	m = mixdev_info(x->md, control->dev);
+	cached = *control->value;
+	if (mixdev_read(x->md, control->dev, &before) == -1) {
+		snprintf(reply, size, "error: %s", strerror(errno));
+		return;
+	}
+	if (!mixdev_same(&cached, &before)) {
+		show_value(x, control->dev);
+	}
+	after = before;
+	if (value != NULL) {
+		if (preset_parse_value(m, value + 1, &after) == -1) {
+			snprintf(reply, size, "error: bad value for %s", name);
+			return;
+		}
+		if (!mixdev_same(&before, &after)) {
+			if (mixdev_write(x->md, &after) == -1) {
+				snprintf(reply, size, "error: %s",
+				    strerror(errno));
+				return;
+			}
+			history_push(&x->history, &before, &after);
+			show_value(x, after.dev);
+			flush_writes(x);
+		}
+	}
+	n = snprintf(reply, size, "%s=", name);
+	if (n > 0 && (size_t)n < size) {
+		preset_format_value(m, &after, reply + n, size - n);
+	}
+}
+
+static void
+hotplug_events(struct aiomixer *x)
+{
+	struct hotplug_event ev;
+
+	while (x->hotplug != NULL && hotplug_next(x->hotplug, &ev)) {
+		if (ev.change == HOTPLUG_ATTACH) {
+			attach_device(x, &ev);
+		} else {
+			detach_device(x, ev.name);
+		}
+	}
+}
+
+static void
+hotplug_ready(void *arg, int fd, short revents)
+{
+	(void)fd; /* unused */
+	(void)revents; /* unused */
+	hotplug_events(arg);
+}
+
+static void
+meter_tick(void *arg)
+{
+	draw_meters(arg, true);
+}
+
+static struct mixer *
+throttle_device(struct aiomixer *x, struct mixer *mixer)
+{
+	struct mixer *throttle;
+
+	if (x->write_rate == 0 ||
+	    (throttle = mixer_throttle(mixer, x->write_rate)) == NULL) {
+		return mixer;
+	}
+	return throttle;
 }
 
+/*
+ * Makes the writes held back by the rate limit that are due, with a
+ * timer in the main loop for as long as any are held.  A control whose
+ * held write fails had its value taken for written, so it is read again
+ * and shown as the device has it.
+ */
 static void
-set_level(int fd, struct aiomixer_control *control, int level, int channel)
+flush_writes(struct aiomixer *x)
 {
-	mixer_ctrl_t dev = {0};
-	int i;
+	struct mixdev *md;
+	unsigned held = 0;
+	int failed;
+
+	for (unsigned i = 0; i < x->ndevices; ++i) {
+		md = x->devices[i].md;
+		held += mixer_throttle_flush(mixdev_mixer(md), &failed);
+		if (failed == -1) {
+			continue;
+		}
+		show_error(x, "AUDIO_MIXER_WRITE %d failed: %s",
+		    failed, strerror(errno));
+		mixdev_forget(md, failed);
+		if (md == x->md && mixdev_read(md, failed, NULL) == 0) {
+			show_value(x, failed);
+		}
+	}
+	if (held > 0 && x->flush_timer == -1 && x->loop != NULL) {
+		x->flush_timer = loop_add_timer(x->loop,
+		    1000 / x->write_rate, flush_tick, x);
+	} else if (held == 0 && x->flush_timer != -1) {
+		loop_remove_timer(x->loop, x->flush_timer);
+		x->flush_timer = -1;
+	}
+}
 
-	dev.dev = control->dev;
-	dev.type = AUDIO_MIXER_VALUE;
-	dev.un.value.num_channels = control->v.num_channels;
+static void
+flush_tick(void *arg)
+{
+	flush_writes(arg);
+}
 
-	if (!control->chans_unlocked) {
-		for (i = 0; i < control->v.num_channels; ++i) {
-			dev.un.value.level[i] = level;
-			setCDKSliderValue(control->value_widget[i], level);
-			drawCDKSlider(control->value_widget[i], false);
-		}
+/*
+ * Applies what was edited in the watched file since it was last
+ * applied, or all of it the first time, only writing the controls whose
+ * values differ from the device's as with any preset.  Returns -1 if
+ * the file could not be read.
+ */
+static int
+apply_watched(struct aiomixer *x)
+{
+	struct presets next = {0};
+	struct preset *preset, diff;
+	int changed;
+
+	if ((preset = presets_load_conf(&next, x->watch_path)) == NULL) {
+		show_error(x, "%s: %s", x->watch_path, strerror(errno));
+		presets_free(&next);
+		return -1;
+	}
+	if (x->watched.n == 0) {
+		changed = apply_preset(x, preset);
+	} else if (preset_diff(preset, &x->watched.list[0], &diff) == -1) {
+		show_error(x, "Couldn't apply %s: %s", x->watch_path,
+		    strerror(errno));
+		presets_free(&next);
+		return -1;
 	} else {
-		if (ioctl(fd, AUDIO_MIXER_READ, &dev) < 0) {
-			fprintf(stderr, "aiomixer: AUDIO_MIXER_READ %d failed: %s\n",
-			    dev.dev, strerror(errno));
-			return;
-		}
-		dev.un.value.level[channel] = level;
-		setCDKSliderValue(control->value_widget[channel], level);
-		drawCDKSlider(control->value_widget[channel], false);
+		changed = apply_preset(x, &diff);
+		free(diff.settings);
 	}
+	/* failed settings are not retried until edited */
+	presets_free(&x->watched);
+	x->watched = next;
+	flush_writes(x);
+	if (changed > 0 && x->screen != NULL) {
+		show_note(x, "Applied %s: %d control%s changed",
+		    x->watch_path, changed, changed == 1 ? "" : "s");
+	}
+	return 0;
+}
 
-	if (ioctl(fd, AUDIO_MIXER_WRITE, &dev) < 0) {
-		fprintf(stderr, "aiomixer: AUDIO_MIXER_WRITE %d failed: %s\n",
-		    dev.dev, strerror(errno));
+/*
+ * The watched file is applied once it has stayed the same for
+ * WATCH_SETTLE, so as not to read it half written.
+ */
+static void
+watch_ready(void *arg, int fd, short revents)
+{
+	struct aiomixer *x = arg;
+
+	(void)fd; /* unused */
+	(void)revents; /* unused */
+	if (!filewatch_changed(x->watch)) {
 		return;
 	}
+	x->watch_pending = true;
+	if (x->watch_timer != -1) {
+		loop_remove_timer(x->loop, x->watch_timer);
+	}
+	x->watch_timer = loop_add_timer(x->loop, WATCH_SETTLE, watch_tick, x);
 }
 
-static int key_callback_slider(EObjectType cdktype ,
-	void *object, void *clientData, chtype key)
+static void
+watch_tick(void *arg)
 {
-	struct aiomixer *x = clientData;
-	struct aiomixer_class *class = &x->classes[x->class_index];
-	struct aiomixer_control *control = &class->controls[x->control_index];
-	CDKSLIDER *widget = object;
-	int new_value;
+	struct aiomixer *x = arg;
 
-	(void)cdktype; /* unused */
-	switch (key) {
-	case 'k':
-	case KEY_UP:
-		if (control->current_chan > 0) {
-			control->current_chan--;
-			select_class_widget(x, x->control_index);
-		} else {
-			control->current_chan = 0;
-			select_class_widget(x, x->control_index - 1);
-		}
-		break;
-	case 'j':
-	case KEY_DOWN:
-		if (control->current_chan < (control->v.num_channels - 1)) {
-			control->current_chan++;
-			select_class_widget(x, x->control_index);
-		} else {
-			control->current_chan = 0;
-			select_class_widget(x, x->control_index + 1);
-		}
-		break;
-	case 'h':
-	case KEY_LEFT:
-		new_value = getCDKSliderValue(widget) - control->v.delta;
-		if (new_value < getCDKSliderLowValue(widget)) {
-			new_value = getCDKSliderLowValue(widget);
-		}
-		set_level(x->fd, control, new_value, control->current_chan);
-		break;
-	case 'l':
-	case KEY_RIGHT:
-		new_value = getCDKSliderValue(widget) + control->v.delta;
-		if (new_value > getCDKSliderHighValue(widget)) {
-			new_value = getCDKSliderHighValue(widget);
-		}
-		set_level(x->fd, control, new_value, control->current_chan);
-		break;
-	case 'u':
-		control->chans_unlocked = !control->chans_unlocked;
-		break;
-	case 'm':
-		/* TODO: mute/unmute thing */
-		break;
+	if (filewatch_changed(x->watch)) {
+		x->watch_pending = true;
+		return;
 	}
-	return false;
+	if (!x->watch_pending) {
+		return;
+	}
+	x->watch_pending = false;
+	if (filewatch_fd(x->watch) != -1) {
+		loop_remove_timer(x->loop, x->watch_timer);
+		x->watch_timer = -1;
+	}
+	apply_watched(x);
 }
 
-static int key_callback_class_buttons(EObjectType cdktype,
-	void *object, void *clientData, chtype key)
+/*
+ * Runs before every key, picking up devices that came or went since
+ * the last one, and redrawing the meters.  ERR comes in when no key
+ * did for a while: the main loop then waits for the next one, and ERR
+ * is dropped.
+ */
+static int
+device_changes(EObjectType cdktype, void *object, void *clientData,
+    chtype key)
 {
 	struct aiomixer *x = clientData;
 
 	(void)cdktype; /* unused */
 	(void)object; /* unused */
-	switch (key) {
-	case 0x1b: /* escape */
-		quit(x);
-		break;
-	case 'k':
-	case KEY_UP:
-		return true;
-	case 'j':
-	case KEY_DOWN:
-		select_class_widget(x, 0);
-		break;
-	case 'h':
-	case KEY_LEFT:
-		destroy_class_widgets(x);
-		x->class_index = (getCDKButtonboxCurrentButton(x->class_buttons) - 1) % x->nclasses;
-		create_class_widgets(x, 3);
-		if (key != KEY_LEFT) {
-			setCDKButtonboxCurrentButton(x->class_buttons, x->class_index);
-		}
-		break;
-	case 'l':
-	case KEY_RIGHT:
-		destroy_class_widgets(x);
-		x->class_index = (getCDKButtonboxCurrentButton(x->class_buttons) + 1) % x->nclasses;
-		create_class_widgets(x, 3);
-		if (key != KEY_RIGHT) {
-			setCDKButtonboxCurrentButton(x->class_buttons, x->class_index);
+	flush_writes(x);
+	if (key == (chtype)ERR) {
+		if (x->loop != NULL && loop_wait(x->loop, STDIN_FILENO) == -1) {
+			quit_perror(x);
 		}
-		break;
+		return false;
 	}
-	return false;
+	draw_meters(x, false);
+	hotplug_events(x);
+	return true;
 }
 
-static int key_callback_control_buttons(EObjectType cdktype,
-	void *object, void *clientData, chtype key)
+static void
+close_devices(struct aiomixer *x)
 {
-	struct aiomixer *x = clientData;
-	struct aiomixer_class *class = &x->classes[x->class_index];
-	struct aiomixer_control *control = &class->controls[x->control_index];
-	CDKBUTTONBOX *widget = object;
-	int current;
-
-	(void)cdktype; /* unused */
-	current = getCDKButtonboxCurrentButton(widget);
-	switch (key) {
-	case 'k':
-	case KEY_UP:
-		select_class_widget(x, x->control_index - 1);
-		break;
-	case 'j':
-	case KEY_DOWN:
-		select_class_widget(x, x->control_index + 1);
-		break;
-	case 'h':
-	case KEY_LEFT:
-		current = (current - 1) % getCDKButtonboxButtonCount(widget);
-		if (control->type == AUDIO_MIXER_SET) {
-			set_set(x->fd, control->dev, control->s.member[current].mask);
-		} else if (control->type == AUDIO_MIXER_ENUM) {
-			set_enum(x->fd, control->dev, control->e.member[current].ord);
-		}
-		if (key != KEY_LEFT) {
-			setCDKButtonboxCurrentButton(widget, current);
-		}
-		break;
-	case 'l':
-	case KEY_RIGHT:
-		current = (current + 1) % getCDKButtonboxButtonCount(widget);
-		if (control->type == AUDIO_MIXER_SET) {
-			set_set(x->fd, control->dev, control->s.member[current].mask);
-		} else if (control->type == AUDIO_MIXER_ENUM) {
-			set_enum(x->fd, control->dev, control->e.member[current].ord);
-		}
-		if (key != KEY_RIGHT) {
-			setCDKButtonboxCurrentButton(widget, current);
-		}
-		break;
+	ctlsock_close(x->ctlsock);
+	x->ctlsock = NULL;
+	loop_free(x->loop);
+	x->loop = NULL;
+	hotplug_close(x->hotplug);
+	x->hotplug = NULL;
+	filewatch_close(x->watch);
+	x->watch = NULL;
+	presets_free(&x->watched);
+	for (unsigned i = 0; i < x->nmeters; ++i) {
+		meter_close(x->meters[i].meter);
 	}
-	return false;
+	x->nmeters = 0;
+	for (unsigned i = 0; i < x->ndevices; ++i) {
+		mixdev_close(x->devices[i].md);
+	}
+	x->ndevices = 0;
 }
 
-static int key_callback_global(EObjectType cdktype,
+/*
+ * + expands and - collapses the chain of the focused control.
+ */
+static int key_callback_group(EObjectType cdktype,
 	void *object, void *clientData, chtype key)
 {
 	struct aiomixer *x = clientData;
+	struct aiomixer_class *class = &x->classes[x->class_index];
+	struct aiomixer_control *control = &class->controls[x->control_index];
+	struct aiomixer_control *root = &class->controls[control->group];
+	bool expand = key == '+';
 
 	(void)cdktype; /* unused */
 	(void)object; /* unused */
-	if (key > KEY_F0 && key <= (KEY_F0 + x->nclasses + 1)) {
-		key = key - KEY_F0 - 1;
-		destroy_class_widgets(x);
-		setCDKButtonboxCurrentButton(x->class_buttons, key);
-		drawCDKButtonboxButtons(x->class_buttons);
-		x->class_index = key;
-		create_class_widgets(x, 3);
-		select_class_widget(x, 0);
+	if (root->nmembers == 0 || root->expanded == expand) {
 		return false;
 	}
-	switch (key) {
-	case KEY_RESIZE:
-		destroy_class_widgets(x);
-		moveCDKLabel(x->title_label, RIGHT, 0, false, true);
-		drawCDKButtonbox(x->class_buttons, false);
-		create_class_widgets(x, 3);
-		select_class_widget(x, 0);
-		break;
+	root->expanded = expand;
+	if (x->top_control > root->pos) {
+		x->top_control = root->pos;
+	}
+	reposition_visible_widgets(x);
+	if (control != root) {
+		select_class_widget(x, root->pos);
 	}
 	return false;
 }
@@ -956,7 +2837,13 @@ static int key_callback_global(EObjectType cdktype,
 static void
 usage(void)
 {
-	fputs("aiomixer [-d device]\n", stderr);
+	fputs("aiomixer [-a age] [-cD] [-d device | -p recording | -s spec] "
+	    "[-r recording]\n"
+	    "         [-R] [-S stats] [-t rate] [-w dir] [-f presets] "
+	    "[-l conf]\n"
+	    "         [-L socket] [-m state] [-P preset] "
+	    "[-v control=source ...] [-V format]\n"
+	    "         [-W conf]\n", stderr);
 	exit(1);
 }
 
@@ -970,7 +2857,7 @@ quit_err(struct aiomixer *x, const char *fmt, ...)
 	va_end(args);
 	destroyCDKScreen(x->screen);
 	endCDK();
-	close(x->fd);
+	close_devices(x);
 	exit(1);
 }
 
@@ -980,16 +2867,33 @@ quit_perror(struct aiomixer *x)
 	perror("aiomixer");
 	destroyCDKScreen(x->screen);
 	endCDK();
-	close(x->fd);
+	close_devices(x);
 	exit(1);
 }
 
+static void
+write_stats(struct aiomixer *x)
+{
+	FILE *fp;
+
+	if (x->stats_path == NULL) {
+		return;
+	}
+	if ((fp = fopen(x->stats_path, "w")) != NULL) {
+		mixer_print_stats(x->mixer, fp);
+		fclose(fp);
+	} else {
+		perror("aiomixer: stats");
+	}
+}
+
 static void
 quit(struct aiomixer *x)
 {
 	destroyCDKScreen(x->screen);
 	endCDK();
-	close(x->fd);
+	write_stats(x);
+	close_devices(x);
 	exit(0);
 }
 
@@ -998,17 +2902,98 @@ main(int argc, char *argv[])
 {
 	struct aiomixer x = {0};
 	char *title[] = { "NetBSD Audio Mixer" };
-	char **class_names;
 	char *mixer_device = DEFAULT_MIXER_DEVICE;
-	int ch;
+	char *replay_path = NULL, *record_path = NULL, *sim_spec = NULL;
+	char *watch_dir = NULL, *device_path = NULL, *base;
+	char *presets_path = NULL, *preset_name = NULL, *home;
+	char *state_path = NULL, *socket_path = NULL, *conf_path = NULL, *eq;
+	struct meter_format meter_format = { 48000, 2, 16 };
+	char default_presets[PATH_MAX];
+	struct preset *preset;
+	struct aiomixer_device *dev = &x.devices[0];
+	struct mixer *hw, *recorder, *publisher;
+	unsigned long rate, age;
+	bool restore = false, dump = false;
+	int ch, failed = 0;
 	extern char *optarg;
 	extern int optind;
 
-	while ((ch = getopt(argc, argv, "d:")) != -1) {
+	x.max_age = DEFAULT_MAX_AGE;
+	while ((ch = getopt(argc, argv, "a:cd:Df:l:L:m:p:P:r:Rs:S:t:v:V:w:W:")) != -1) {
 		switch (ch) {
+		case 'a':
+			age = strtoul(optarg, &eq, 10);
+			if (*eq != '\0' || age > MAX_AGE) {
+				usage();
+			}
+			x.max_age = age;
+			break;
+		case 'c':
+			x.compact = true;
+			break;
 		case 'd':
 			mixer_device = optarg;
 			break;
+		case 'D':
+			dump = true;
+			break;
+		case 'f':
+			presets_path = optarg;
+			break;
+		case 'l':
+			conf_path = optarg;
+			break;
+		case 'L':
+			socket_path = optarg;
+			break;
+		case 'm':
+			state_path = optarg;
+			break;
+		case 'p':
+			replay_path = optarg;
+			break;
+		case 'P':
+			preset_name = optarg;
+			break;
+		case 'r':
+			record_path = optarg;
+			break;
+		case 'R':
+			restore = true;
+			break;
+		case 's':
+			sim_spec = optarg;
+			break;
+		case 'S':
+			x.stats_path = optarg;
+			break;
+		case 't':
+			rate = strtoul(optarg, &eq, 10);
+			if (*eq != '\0' || rate < 1 || rate > MAX_WRITE_RATE) {
+				usage();
+			}
+			x.write_rate = rate;
+			break;
+		case 'v':
+			if ((eq = strchr(optarg, '=')) == NULL ||
+			    x.nmeters == MAX_METERS) {
+				usage();
+			}
+			*eq = '\0';
+			x.meters[x.nmeters].control = optarg;
+			x.meters[x.nmeters++].source = eq + 1;
+			break;
+		case 'V':
+			if (!meter_parse_format(&meter_format, optarg)) {
+				usage();
+			}
+			break;
+		case 'w':
+			watch_dir = optarg;
+			break;
+		case 'W':
+			x.watch_path = optarg;
+			break;
 		default:
 			usage();
 			break;
@@ -1017,18 +3002,172 @@ main(int argc, char *argv[])
 	argc -= optind;
 	argv += optind;
 
-	if ((x.fd = open(mixer_device, O_RDWR)) == -1) {
+	if (sim_spec != NULL) {
+		if ((x.mixer = mixer_open_sim(sim_spec)) == NULL) {
+			perror("mixer_open_sim(spec)");
+			return 1;
+		}
+	} else if (replay_path != NULL) {
+		if ((x.mixer = mixer_open_replay(replay_path)) == NULL) {
+			perror("mixer_open_replay(recording)");
+			return 1;
+		}
+	} else if ((hw = mixer_open(mixer_device)) == NULL) {
 		perror("open(mixer_device)");
 		return 1;
+	} else if ((x.mixer = mixer_reconnect(hw, mixer_open, mixer_device,
+	    restore)) == NULL) {
+		perror("mixer_reconnect");
+		mixer_close(hw);
+		return 1;
+	}
+	dev->device = x.mixer;
+	if (record_path != NULL) {
+		if ((recorder = mixer_record(x.mixer, record_path)) == NULL) {
+			perror("mixer_record(recording)");
+			mixer_close(x.mixer);
+			return 1;
+		}
+		x.mixer = recorder;
+	}
+	if (state_path != NULL) {
+		if ((publisher = mixer_publish(x.mixer, state_path)) == NULL) {
+			perror("mixer_publish(state)");
+			mixer_close(x.mixer);
+			return 1;
+		}
+		x.mixer = publisher;
+	}
+	x.mixer = throttle_device(&x, x.mixer);
+	x.flush_timer = -1;
+	x.watch_timer = -1;
+
+	/* other devices turn up next to this one */
+	if (sim_spec != NULL) {
+		snprintf(dev->name, sizeof(dev->name), "sim");
+	} else if (replay_path != NULL) {
+		snprintf(dev->name, sizeof(dev->name), "replay");
+	} else if ((device_path = realpath(mixer_device, NULL)) != NULL) {
+		base = strrchr(device_path, '/');
+		snprintf(dev->name, sizeof(dev->name), "%s", base + 1);
+		if (watch_dir == NULL) {
+			*base = '\0';
+			watch_dir = base == device_path ? "/" : device_path;
+		}
+	}
+	if ((dev->md = mixdev_open(x.mixer)) == NULL) {
+		perror("mixdev_open");
+		mixer_close(x.mixer);
+		return 1;
+	}
+	x.md = dev->md;
+	x.ndevices = 1;
+	if (watch_dir != NULL &&
+	    (x.hotplug = hotplug_open(watch_dir, dev->name, restore)) == NULL) {
+		perror("hotplug_open(dir)");
+	}
+	free(device_path);
+
+	if (aiomixer_devinfo(&x) == -1) {
+		perror("aiomixer");
+		close_devices(&x);
+		return 1;
+	}
+
+	/* a missing default file just means no presets */
+	if (presets_path == NULL && (home = getenv("HOME")) != NULL) {
+		snprintf(default_presets, sizeof(default_presets), "%s/%s",
+		    home, DEFAULT_PRESETS);
+		if (presets_load(&x.presets, default_presets) == -1 &&
+		    (errno != ENOENT || preset_name != NULL)) {
+			perror(default_presets);
+		}
+	} else if (presets_path != NULL &&
+	    presets_load(&x.presets, presets_path) == -1) {
+		perror(presets_path);
+	}
+	/* without the screen, like mixerctl(1) */
+	if (preset_name != NULL || conf_path != NULL || dump) {
+		if (preset_name != NULL) {
+			if ((preset = presets_find(&x.presets,
+			    preset_name)) == NULL) {
+				fprintf(stderr, "aiomixer: no preset %s\n",
+				    preset_name);
+				close_devices(&x);
+				return 1;
+			}
+			failed |= apply_preset(&x, preset) == -1;
+		}
+		if (conf_path != NULL) {
+			if ((preset = presets_load_conf(&x.presets,
+			    conf_path)) == NULL) {
+				perror(conf_path);
+				close_devices(&x);
+				return 1;
+			}
+			failed |= apply_preset(&x, preset) == -1;
+		}
+		if (dump && mixdev_snapshot(x.md, 0, stdout) == -1) {
+			perror("aiomixer: dump");
+			failed = 1;
+		}
+		write_stats(&x);
+		close_devices(&x);
+		return failed;
 	}
 
-	aiomixer_devinfo(&x);
+	for (unsigned i = 0; i < x.nmeters; ++i) {
+		if ((x.meters[i].meter = meter_open(x.meters[i].source,
+		    &meter_format, METER_FPS)) == NULL) {
+			perror(x.meters[i].source);
+			close_devices(&x);
+			return 1;
+		}
+	}
+	link_meters(&x);
 
-	if ((class_names = calloc(sizeof(char *), x.nclasses)) == NULL) {
-		quit_perror(&x);
+	if ((x.loop = loop_new()) == NULL) {
+		perror("loop_new");
+		close_devices(&x);
+		return 1;
+	}
+	if (x.hotplug != NULL && loop_add_fd(x.loop, hotplug_fd(x.hotplug),
+	    POLLIN, hotplug_ready, &x) == -1) {
+		perror("loop_add_fd(hotplug)");
+	}
+	if (x.nmeters > 0 &&
+	    loop_add_timer(x.loop, 1000 / METER_FPS, meter_tick, &x) == -1) {
+		perror("loop_add_timer(meters)");
 	}
-	for (unsigned i = 0; i < x.nclasses; ++i) {
-		class_names[i] = x.classes[i].name;
+	if (x.max_age > 0 &&
+	    loop_add_timer(x.loop, x.max_age, revalidate_tick, &x) == -1) {
+		perror("loop_add_timer(revalidate)");
+	}
+	if (socket_path != NULL && (x.ctlsock = ctlsock_open(x.loop,
+	    socket_path, control_request, &x)) == NULL) {
+		perror(socket_path);
+		close_devices(&x);
+		return 1;
+	}
+	if (x.watch_path != NULL) {
+		if ((x.watch = filewatch_open(x.watch_path)) == NULL) {
+			perror(x.watch_path);
+			close_devices(&x);
+			return 1;
+		}
+		if (filewatch_fd(x.watch) != -1) {
+			if (loop_add_fd(x.loop, filewatch_fd(x.watch), POLLIN,
+			    watch_ready, &x) == -1) {
+				perror("loop_add_fd(watch)");
+			}
+		} else if ((x.watch_timer = loop_add_timer(x.loop, WATCH_POLL,
+		    watch_tick, &x)) == -1) {
+			perror("loop_add_timer(watch)");
+		}
+		if (apply_watched(&x) == -1) {
+			close_devices(&x);
+			return 1;
+		}
 	}
 
 	x.screen = initCDKScreen(NULL);
@@ -1037,26 +3176,16 @@ main(int argc, char *argv[])
 	init_pair(PAIR_CLASS_BUTTONS_HL, COLOR_WHITE, COLOR_BLUE);
 	init_pair(PAIR_SLIDER, COLOR_GREEN, COLOR_BLACK);
 	init_pair(PAIR_ENUM_SET, COLOR_YELLOW, COLOR_BLACK);
+	init_pair(PAIR_ERROR, COLOR_RED, COLOR_BLACK);
 
 	x.title_label = newCDKLabel(x.screen, RIGHT, 0, title, 1, false, false);
     	if (x.title_label == NULL) {
 		quit_err(&x, "Couldn't create title");
 	}
 
-	x.class_buttons = newCDKButtonbox(x.screen, 0, 0,
-		2, sum_str_list_lengths((const char **)class_names, x.nclasses) + 10 + x.nclasses,
-		"</B/56>Classes<!56>", 1, x.nclasses,
-		class_names, x.nclasses,
-		COLOR_PAIR(PAIR_CLASS_BUTTONS_HL), false, false);
-    	if (x.class_buttons == NULL) {
-		quit_err(&x, "Couldn't create class buttons");
-	}
-	free(class_names);
-
 	drawCDKLabel(x.title_label, false);
-	drawCDKButtonbox(x.class_buttons, false);
-
-	add_class_button_binds(&x, x.class_buttons);
+	create_class_buttons(&x);
+	set_key_timer(&x, true);
 
 	create_class_widgets(&x, 3);
 	select_class_widget(&x, 0);
@@ -0,0 +1,132 @@
+/*
+ Copyright (c) 2019 Nia Alarie <nia@netbsd.org>
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions
+ are met:
+
+ 1. Redistributions of source code must retain the above copyright
+    notice, this list of conditions and the following disclaimer.
+ 2. Redistributions in binary form must reproduce the above copyright
+    notice, this list of conditions and the following disclaimer in the
+    documentation and/or other materials provided with the distribution.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef AIOMIXER_STATE_H
+#define AIOMIXER_STATE_H
+
+/*
+ * The state table aiomixer -m publishes: the controls of the mixer
+ * device and their current values, in a file other programs can map
+ * read-only and read without making any system calls or going near
+ * the device.
+ *
+ * The file is a header followed by one entry per control, indexed by
+ * the control's device index, class entries included.  Integers are
+ * in host byte order; types, ords and masks are those of audio(4).
+ * The topology is written once, before the magic number is set, and
+ * never changes afterwards.  When aiomixer exits the magic number is
+ * cleared and the file removed, so a reader holding an old mapping
+ * can tell.
+ *
+ * The value of each control is guarded by its own sequence counter,
+ * which is odd while the value is being updated: a reader takes the
+ * counter, copies the value and checks the counter again, retrying if
+ * it was odd or has moved, as aiomixer_state_read() does.  The header
+ * generation is bumped after every update, so a reader can poll it to
+ * find out whether anything changed at all.
+ *
+ * Values are those last read from or written to the device by
+ * aiomixer; valid is zero until the first.
+ */
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <string.h>
+
+#define AIOMIXER_STATE_MAGIC	0x4d4f4941u /* "AIOM" */
+#define AIOMIXER_STATE_VERSION	1
+
+#define AIOMIXER_STATE_LABEL_LEN	16
+#define AIOMIXER_STATE_MAX_MEMBERS	32
+#define AIOMIXER_STATE_MAX_CHANNELS	8
+
+struct aiomixer_state_header {
+	_Atomic uint32_t magic;
+	uint32_t version;
+	uint32_t header_size;	/* offset of the first control */
+	uint32_t control_size;	/* of each control */
+	uint32_t ncontrols;
+	int32_t pid;		/* of the publishing aiomixer */
+	_Atomic uint32_t generation;
+	uint32_t reserved;
+};
+
+struct aiomixer_state_member {
+	char label[AIOMIXER_STATE_LABEL_LEN];
+	int32_t value;		/* ord for enums, mask for sets */
+};
+
+struct aiomixer_state_value {
+	uint32_t valid;
+	int32_t ord;		/* AUDIO_MIXER_ENUM */
+	int32_t mask;		/* AUDIO_MIXER_SET */
+	uint8_t level[AIOMIXER_STATE_MAX_CHANNELS]; /* AUDIO_MIXER_VALUE */
+};
+
+struct aiomixer_state_control {
+	int32_t index;
+	int32_t type;
+	int32_t mixer_class;
+	int32_t next, prev;
+	char label[AIOMIXER_STATE_LABEL_LEN];
+	char units[AIOMIXER_STATE_LABEL_LEN]; /* AUDIO_MIXER_VALUE */
+	int32_t nchannels;	/* AUDIO_MIXER_VALUE, may exceed level[] */
+	int32_t delta;		/* AUDIO_MIXER_VALUE */
+	int32_t nmembers;	/* AUDIO_MIXER_ENUM and SET */
+	struct aiomixer_state_member members[AIOMIXER_STATE_MAX_MEMBERS];
+
+	_Atomic uint32_t seq;
+	struct aiomixer_state_value value;
+};
+
+static inline const struct aiomixer_state_control *
+aiomixer_state_control(const struct aiomixer_state_header *h, unsigned i)
+{
+	return (const struct aiomixer_state_control *)
+	    ((const char *)h + h->header_size + (size_t)i * h->control_size);
+}
+
+static inline void
+aiomixer_state_read(const struct aiomixer_state_control *c,
+    struct aiomixer_state_value *v)
+{
+	uint32_t seq;
+
+	for (;;) {
+		seq = atomic_load_explicit(&c->seq, memory_order_acquire);
+		if (seq & 1) {
+			continue;
+		}
+		memcpy(v, &c->value, sizeof(*v));
+		atomic_thread_fence(memory_order_acquire);
+		if (atomic_load_explicit(&c->seq, memory_order_relaxed) == seq) {
+			return;
+		}
+	}
+}
+
+#endif /* !AIOMIXER_STATE_H */
@@ -0,0 +1,102 @@
+/*
+ Copyright (c) 2019 Nia Alarie <nia@netbsd.org>
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions
+ are met:
+
+ 1. Redistributions of source code must retain the above copyright
+    notice, this list of conditions and the following disclaimer.
+ 2. Redistributions in binary form must reproduce the above copyright
+    notice, this list of conditions and the following disclaimer in the
+    documentation and/or other materials provided with the distribution.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef AIOMIXER_AUDIOIO_COMPAT_H
+#define AIOMIXER_AUDIOIO_COMPAT_H
+
+/*
+ * The subset of NetBSD's <sys/audioio.h> mixer interface used by
+ * aiomixer, for building on systems without it.  Only the recorded
+ * and simulated backends are usable there.
+ */
+
+#define MAX_AUDIO_DEV_LEN	16
+
+typedef struct audio_mixer_name {
+	char name[MAX_AUDIO_DEV_LEN];
+	int msg_id;
+} audio_mixer_name_t;
+
+/*
+ * NetBSD's kernel passes at most 8 levels; the recorded and simulated
+ * backends have no such limit and are allowed more.
+ */
+typedef struct mixer_level {
+	int num_channels;
+	unsigned char level[64];
+} mixer_level_t;
+
+#define AUDIO_MIN_GAIN		0
+#define AUDIO_MAX_GAIN		255
+
+typedef struct mixer_ctrl {
+	int dev;
+	int type;
+	union {
+		int ord;
+		int mask;
+		mixer_level_t value;
+	} un;
+} mixer_ctrl_t;
+
+#define AUDIO_MIXER_CLASS	0
+#define AUDIO_MIXER_ENUM	1
+#define AUDIO_MIXER_SET		2
+#define AUDIO_MIXER_VALUE	3
+
+#define AUDIO_MIXER_LAST	-1
+
+typedef struct mixer_devinfo {
+	int index;
+	audio_mixer_name_t label;
+	int type;
+	int mixer_class;
+	int next, prev;
+	union {
+		struct audio_mixer_enum {
+			int num_mem;
+			struct {
+				audio_mixer_name_t label;
+				int ord;
+			} member[32];
+		} e;
+		struct audio_mixer_set {
+			int num_mem;
+			struct {
+				audio_mixer_name_t label;
+				int mask;
+			} member[32];
+		} s;
+		struct audio_mixer_value {
+			audio_mixer_name_t units;
+			int num_channels;
+			int delta;
+		} v;
+	} un;
+} mixer_devinfo_t;
+
+#endif /* !AIOMIXER_AUDIOIO_COMPAT_H */
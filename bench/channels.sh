@@ -0,0 +1,45 @@
+#!/bin/sh
+#
+# Run aiomixer against simulated mixers with growing channel counts and
+# print one tab-separated row per count: the cost of a keypress on a
+# level control should not grow with its channels.
+#
+#	bench/channels.sh > channels.tsv
+#	gnuplot -e "set logscale x; plot 'channels.tsv' using 1:2 with lines"
+#
+# Extra aiomixer options can be given in FLAGS, e.g. FLAGS=-c for the
+# compact form throughout.
+#
+
+counts=${COUNTS:-"1 2 4 8 16 32 64"}
+bench=$(dirname "$0")/ptybench
+aiomixer=${AIOMIXER:-./aiomixer}
+script=$(mktemp /tmp/channels.XXXXXX)
+out=$(mktemp /tmp/channels.XXXXXX)
+trap 'rm -f "$script" "$out"' EXIT
+
+cat > "$script" <<'END'
+phase locked
+key right 16
+key left 16
+phase unlocked
+key u
+key right 16
+key left 16
+quit
+END
+
+get() {
+	sed -n "s/^$1=//p" "$out"
+}
+
+printf 'channels\tlocked_usec\tunlocked_usec\tlocked_bytes\twrites\n'
+for n in $counts; do
+	"$bench" -s "$script" -o "$out" -- \
+	    "$aiomixer" $FLAGS -s "classes=1,controls=24,channels=$n" || exit 1
+	printf '%s\t%s\t%s\t%s\t%s\n' "$n" \
+	    "$(get phase.locked.output_done.usec.mean)" \
+	    "$(get phase.unlocked.output_done.usec.mean)" \
+	    "$(get phase.locked.tty.bytes)" \
+	    "$(get mixer.write.count)"
+done
@@ -0,0 +1,194 @@
+/*
+ Copyright (c) 2019 Nia Alarie <nia@netbsd.org>
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions
+ are met:
+
+ 1. Redistributions of source code must retain the above copyright
+    notice, this list of conditions and the following disclaimer.
+ 2. Redistributions in binary form must reproduce the above copyright
+    notice, this list of conditions and the following disclaimer in the
+    documentation and/or other materials provided with the distribution.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * corebench: time the device layer on its own, linked against
+ * libaiomixer without any terminal, on a simulated mixer, and report
+ * the cost of each operation as name=value lines.
+ *
+ *	corebench [-n rounds] [spec]
+ *
+ * The spec is as for aiomixer -s.  Each round enumerates the device,
+ * reads every control, looks every control up by name, takes a
+ * snapshot and applies it back with every level changed.  Times are
+ * microseconds per round, followed by the mixer request counts of the
+ * last round.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "mixdev.h"
+
+#define DEFAULT_SPEC	"classes=8,controls=64"
+#define MAX_AGE		(60000) /* milliseconds, for applying */
+
+static unsigned long long
+usec_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/*
+ * A preset setting every control to its value in the snapshot, with
+ * levels one step down so that applying it writes them.
+ */
+static int
+load_snapshot(FILE *fp, struct presets *presets, struct preset **preset)
+{
+	char path[] = "/tmp/corebench.XXXXXX";
+	char line[512], *eq, *end;
+	FILE *out;
+	long level;
+	int fd;
+
+	if ((fd = mkstemp(path)) == -1 || (out = fdopen(fd, "w")) == NULL) {
+		return -1;
+	}
+	rewind(fp);
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		if ((eq = strchr(line, '=')) != NULL &&
+		    (level = strtol(eq + 1, &end, 10)) > 0 && end != eq + 1) {
+			fprintf(out, "%.*s=%ld\n", (int)(eq - line), line,
+			    level - 1);
+		} else {
+			fputs(line, out);
+		}
+	}
+	fclose(out);
+	*preset = presets_load_conf(presets, path);
+	unlink(path);
+	return *preset != NULL ? 0 : -1;
+}
+
+int
+main(int argc, char *argv[])
+{
+	unsigned long long t, open_us = 0, read_us = 0, find_us = 0;
+	unsigned long long snap_us = 0, apply_us = 0;
+	const char *spec = DEFAULT_SPEC;
+	struct presets presets;
+	struct preset *preset;
+	struct mixer *mixer;
+	struct mixdev *md;
+	unsigned rounds = 10, n = 0;
+	FILE *snap;
+	int ch;
+
+	while ((ch = getopt(argc, argv, "n:")) != -1) {
+		switch (ch) {
+		case 'n':
+			rounds = strtoul(optarg, NULL, 10);
+			break;
+		default:
+			fputs("corebench [-n rounds] [spec]\n", stderr);
+			return 1;
+		}
+	}
+	if (optind < argc) {
+		spec = argv[optind];
+	}
+	if (rounds == 0) {
+		rounds = 1;
+	}
+	for (unsigned r = 0; r < rounds; ++r) {
+		if ((mixer = mixer_open_sim(spec)) == NULL) {
+			perror(spec);
+			return 1;
+		}
+		t = usec_now();
+		if ((md = mixdev_open(mixer)) == NULL) {
+			perror("mixdev_open");
+			mixer_close(mixer);
+			return 1;
+		}
+		open_us += usec_now() - t;
+
+		t = usec_now();
+		if (mixdev_read_all(md, 0) == -1) {
+			perror("mixdev_read_all");
+		}
+		read_us += usec_now() - t;
+
+		t = usec_now();
+		for (unsigned i = 0; i < mixdev_count(md); ++i) {
+			if (mixdev_name(md, i) != NULL &&
+			    mixdev_find(md, mixdev_name(md, i)) == (int)i) {
+				n++;
+			}
+		}
+		find_us += usec_now() - t;
+
+		if ((snap = tmpfile()) == NULL) {
+			perror("tmpfile");
+			return 1;
+		}
+		t = usec_now();
+		if (mixdev_snapshot(md, 0, snap) == -1) {
+			perror("mixdev_snapshot");
+		}
+		snap_us += usec_now() - t;
+
+		memset(&presets, 0, sizeof(presets));
+		if (load_snapshot(snap, &presets, &preset) == -1) {
+			perror("snapshot");
+			return 1;
+		}
+		fclose(snap);
+		/* the last round's requests are reported */
+		if (r == rounds - 1) {
+			memset(&mixdev_mixer(md)->stats, 0,
+			    sizeof(mixdev_mixer(md)->stats));
+		}
+		t = usec_now();
+		/* diffed against the values the snapshot has just read */
+		if (mixdev_apply(md, preset, MAX_AGE, NULL, NULL) == -1) {
+			perror("mixdev_apply");
+		}
+		apply_us += usec_now() - t;
+		presets_free(&presets);
+
+		if (r == rounds - 1) {
+			printf("controls=%u\n", mixdev_count(md));
+			printf("found=%u\n", n / rounds);
+			printf("open_usec=%llu\n", open_us / rounds);
+			printf("read_all_usec=%llu\n", read_us / rounds);
+			printf("find_all_usec=%llu\n", find_us / rounds);
+			printf("snapshot_usec=%llu\n", snap_us / rounds);
+			printf("apply_usec=%llu\n", apply_us / rounds);
+			mixer_print_stats(mixdev_mixer(md), stdout);
+		}
+		mixdev_close(md);
+	}
+	return 0;
+}
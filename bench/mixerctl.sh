@@ -0,0 +1,41 @@
+#!/bin/sh
+#
+# Time applying a mixerctl.conf(5)-style file the way it is done at
+# boot, one process per line as with mixerctl -w, against applying it
+# in one go with aiomixer -l, on a simulated device:
+#
+#	bench/mixerctl.sh [spec]
+#
+# The file is made with aiomixer -D, with every level and mute changed
+# so that each line needs a write.
+#
+
+spec=${1:-classes=8,controls=512,latency=100}
+aiomixer=${AIOMIXER:-./aiomixer}
+conf=$(mktemp /tmp/mixerctl.XXXXXX)
+stats=$(mktemp /tmp/mixerctl.XXXXXX)
+trap 'rm -f "$conf" "$conf.line" "$stats"' EXIT
+
+"$aiomixer" -s "$spec" -D |
+    sed -e 's/=\([0-9][0-9]*\)\(,[0-9][0-9]*\)*$/=200/' \
+	-e 's/\.mute=off$/.mute=on/' > "$conf" || exit 1
+export aiomixer spec conf
+
+printf 'lines\t%s\n' "$(wc -l < "$conf" | tr -d ' ')"
+printf 'per-line\n'
+time sh -c '
+	while IFS= read -r line; do
+		printf "%s\n" "$line" > "$conf.line"
+		"$aiomixer" -s "$spec" -l "$conf.line" || exit 1
+	done < "$conf"'
+printf 'aiomixer -l\n'
+time "$aiomixer" -s "$spec" -S "$stats" -l "$conf" || exit 1
+
+get() {
+	sed -n "s/^$1=//p" "$stats"
+}
+
+printf 'devinfo\t%s\nreads\t%s\nwrites\t%s\n' \
+    "$(get mixer.devinfo.count)" \
+    "$(get mixer.read.count)" \
+    "$(get mixer.write.count)"
@@ -0,0 +1,501 @@
+/*
+ Copyright (c) 2019 Nia Alarie <nia@netbsd.org>
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions
+ are met:
+
+ 1. Redistributions of source code must retain the above copyright
+    notice, this list of conditions and the following disclaimer.
+ 2. Redistributions in binary form must reproduce the above copyright
+    notice, this list of conditions and the following disclaimer in the
+    documentation and/or other materials provided with the distribution.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * ptybench: drive aiomixer on a pseudo-terminal with a scripted key
+ * sequence and report keypress-to-output latency, terminal output
+ * volume, mixer request counts and peak RSS as name=value lines.
+ *
+ *	ptybench [-o summary] [-s script] [-q quiet-ms] -- aiomixer -p rec
+ *
+ * Script lines are one of
+ *
+ *	phase <name>			start a new reporting phase
+ *	key <key> [count]		send keys, waiting for each repaint
+ *	hold <key> <count> <ms>		send keys every <ms> without waiting
+ *	resize <rows> <cols>		resize the terminal
+ *	sleep <ms>
+ *	quit				leave aiomixer (reported as phase "quit")
+ *
+ * A key is a single character or one of up, down, left, right, esc,
+ * enter, f1-f10.  Output is considered complete once the terminal has
+ * been quiet for the quiet period (20ms by default).
+ */
+
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <pty.h>
+#else
+#include <util.h>
+#endif
+
+#define MAX_PHASES	(32)
+#define MAX_ARGS	(64)
+
+struct phase {
+	char name[32];
+	unsigned long keys;
+	unsigned long bytes;
+	unsigned long long wall_usec;
+	unsigned long long *first, *done;
+	size_t n, cap;
+};
+
+struct bench {
+	int master;
+	pid_t pid;
+	unsigned quiet_ms;
+	unsigned long total_bytes;
+	struct phase phases[MAX_PHASES];
+	unsigned nphases;
+};
+
+static const char default_script[] =
+	"phase class-switch\n"
+	"key up\n"
+	"key right 8\n"
+	"phase scroll\n"
+	"key down 64\n"
+	"phase adjust\n"
+	"key right 16\n"
+	"hold left 32 30\n"
+	"phase resize\n"
+	"resize 30 100\n"
+	"resize 50 140\n"
+	"resize 24 80\n"
+	"quit\n";
+
+static unsigned long long
+usec_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static struct phase *
+current_phase(struct bench *b)
+{
+	return &b->phases[b->nphases - 1];
+}
+
+static void
+new_phase(struct bench *b, const char *name)
+{
+	struct phase *p;
+
+	if (b->nphases == MAX_PHASES) {
+		fputs("ptybench: too many phases\n", stderr);
+		exit(1);
+	}
+	p = &b->phases[b->nphases++];
+	memset(p, 0, sizeof(*p));
+	snprintf(p->name, sizeof(p->name), "%.*s", (int)sizeof(p->name) - 1,
+	    name);
+}
+
+static void
+add_sample(struct phase *p, unsigned long long first,
+    unsigned long long done)
+{
+	if (p->n == p->cap) {
+		p->cap = p->cap ? p->cap * 2 : 64;
+		p->first = realloc(p->first, p->cap * sizeof(*p->first));
+		p->done = realloc(p->done, p->cap * sizeof(*p->done));
+		if (p->first == NULL || p->done == NULL) {
+			perror("ptybench");
+			exit(1);
+		}
+	}
+	p->first[p->n] = first;
+	p->done[p->n] = done;
+	p->n++;
+}
+
+/*
+ * Read terminal output until it has been quiet for the quiet period.
+ * Returns the time of the first and last byte relative to since, or
+ * false if nothing was written before timeout_ms.
+ */
+static bool
+drain(struct bench *b, unsigned long long since, unsigned timeout_ms,
+    unsigned long long *first, unsigned long long *last)
+{
+	struct pollfd pfd = { .fd = b->master, .events = POLLIN };
+	char buf[4096];
+	bool seen = false;
+	ssize_t n;
+	int wait = timeout_ms;
+
+	for (;;) {
+		if (poll(&pfd, 1, wait) <= 0) {
+			return seen;
+		}
+		if ((n = read(b->master, buf, sizeof(buf))) <= 0) {
+			return seen;
+		}
+		*last = usec_now() - since;
+		if (!seen) {
+			*first = *last;
+			seen = true;
+		}
+		b->total_bytes += n;
+		current_phase(b)->bytes += n;
+		wait = b->quiet_ms;
+	}
+}
+
+static const char *
+key_sequence(const char *name)
+{
+	static const struct {
+		const char *name, *seq;
+	} keys[] = {
+		{ "up", "\033OA" }, { "down", "\033OB" },
+		{ "right", "\033OC" }, { "left", "\033OD" },
+		{ "esc", "\033" }, { "enter", "\r" },
+		{ "f1", "\033OP" }, { "f2", "\033OQ" },
+		{ "f3", "\033OR" }, { "f4", "\033OS" },
+		{ "f5", "\033[15~" }, { "f6", "\033[17~" },
+		{ "f7", "\033[18~" }, { "f8", "\033[19~" },
+		{ "f9", "\033[20~" }, { "f10", "\033[21~" },
+	};
+
+	for (size_t i = 0; i < sizeof(keys) / sizeof(keys[0]); ++i) {
+		if (strcmp(keys[i].name, name) == 0) {
+			return keys[i].seq;
+		}
+	}
+	return strlen(name) == 1 ? name : NULL;
+}
+
+static void
+send_key(struct bench *b, const char *seq)
+{
+	if (write(b->master, seq, strlen(seq)) == -1) {
+		perror("ptybench: write");
+		exit(1);
+	}
+	current_phase(b)->keys++;
+}
+
+static void
+run_key(struct bench *b, const char *seq, unsigned count)
+{
+	unsigned long long start, first, last;
+
+	while (count-- > 0) {
+		start = usec_now();
+		send_key(b, seq);
+		if (drain(b, start, 1000, &first, &last)) {
+			add_sample(current_phase(b), first, last);
+		}
+		current_phase(b)->wall_usec += usec_now() - start;
+	}
+}
+
+static void
+run_hold(struct bench *b, const char *seq, unsigned count, unsigned ms)
+{
+	unsigned long long start, first, last;
+
+	start = usec_now();
+	while (count-- > 0) {
+		send_key(b, seq);
+		drain(b, usec_now(), ms, &first, &last);
+	}
+	if (drain(b, start, 1000, &first, &last)) {
+		add_sample(current_phase(b), first, usec_now() - start);
+	}
+	current_phase(b)->wall_usec += usec_now() - start;
+}
+
+static void
+run_resize(struct bench *b, unsigned rows, unsigned cols)
+{
+	struct winsize ws = { .ws_row = rows, .ws_col = cols };
+	unsigned long long start, first, last;
+
+	start = usec_now();
+	if (ioctl(b->master, TIOCSWINSZ, &ws) == -1) {
+		perror("ptybench: TIOCSWINSZ");
+		exit(1);
+	}
+	if (drain(b, start, 1000, &first, &last)) {
+		add_sample(current_phase(b), first, last);
+	}
+	current_phase(b)->wall_usec += usec_now() - start;
+}
+
+static void
+run_script(struct bench *b, const char *script)
+{
+	char line[256], arg[64];
+	const char *seq, *p = script;
+	unsigned n, m;
+	size_t len;
+
+	while (*p != '\0') {
+		len = strcspn(p, "\n");
+		if (len >= sizeof(line)) {
+			fprintf(stderr, "ptybench: script line too long\n");
+			exit(1);
+		}
+		snprintf(line, sizeof(line), "%.*s", (int)len, p);
+		p += len + (p[len] == '\n');
+		n = 1;
+		if (line[0] == '\0' || line[0] == '#') {
+			continue;
+		} else if (sscanf(line, "phase %31s", arg) == 1) {
+			new_phase(b, arg);
+		} else if (sscanf(line, "key %63s %u", arg, &n) >= 1) {
+			if ((seq = key_sequence(arg)) == NULL) {
+				fprintf(stderr, "ptybench: unknown key %s\n", arg);
+				exit(1);
+			}
+			run_key(b, seq, n);
+		} else if (sscanf(line, "hold %63s %u %u", arg, &n, &m) == 3) {
+			if ((seq = key_sequence(arg)) == NULL) {
+				fprintf(stderr, "ptybench: unknown key %s\n", arg);
+				exit(1);
+			}
+			run_hold(b, seq, n, m);
+		} else if (sscanf(line, "resize %u %u", &n, &m) == 2) {
+			run_resize(b, n, m);
+		} else if (sscanf(line, "sleep %u", &n) == 1) {
+			usleep(n * 1000);
+		} else if (strcmp(line, "quit") == 0) {
+			/*
+			 * back to the class buttons, then out; in a phase
+			 * of its own so the exit is not charged to the last
+			 * measured one
+			 */
+			new_phase(b, "quit");
+			run_key(b, "\033", 1);
+			run_key(b, "\033", 1);
+		} else {
+			fprintf(stderr, "ptybench: bad script line: %s\n", line);
+			exit(1);
+		}
+	}
+}
+
+static int
+cmp_ull(const void *a, const void *b)
+{
+	unsigned long long x = *(const unsigned long long *)a;
+	unsigned long long y = *(const unsigned long long *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static void
+print_dist(FILE *fp, const char *prefix, const char *what,
+    unsigned long long *v, size_t n)
+{
+	unsigned long long sum = 0;
+
+	if (n == 0) {
+		return;
+	}
+	qsort(v, n, sizeof(*v), cmp_ull);
+	for (size_t i = 0; i < n; ++i) {
+		sum += v[i];
+	}
+	fprintf(fp, "%s.%s.usec.mean=%llu\n", prefix, what, sum / n);
+	fprintf(fp, "%s.%s.usec.p50=%llu\n", prefix, what, v[n / 2]);
+	fprintf(fp, "%s.%s.usec.p99=%llu\n", prefix, what, v[n * 99 / 100]);
+	fprintf(fp, "%s.%s.usec.max=%llu\n", prefix, what, v[n - 1]);
+}
+
+static void
+report(struct bench *b, FILE *fp, const char *stats_path,
+    const struct rusage *ru)
+{
+	char prefix[64], line[256];
+	struct phase *p;
+	FILE *sp;
+
+	for (unsigned i = 0; i < b->nphases; ++i) {
+		p = &b->phases[i];
+		snprintf(prefix, sizeof(prefix), "phase.%s", p->name);
+		fprintf(fp, "%s.keys=%lu\n", prefix, p->keys);
+		fprintf(fp, "%s.tty.bytes=%lu\n", prefix, p->bytes);
+		fprintf(fp, "%s.wall.usec=%llu\n", prefix, p->wall_usec);
+		print_dist(fp, prefix, "first_output", p->first, p->n);
+		print_dist(fp, prefix, "output_done", p->done, p->n);
+	}
+	fprintf(fp, "tty.bytes=%lu\n", b->total_bytes);
+	/* ru_maxrss is in kilobytes on the BSDs and Linux */
+	fprintf(fp, "rss.peak_kb=%ld\n", ru->ru_maxrss);
+	fprintf(fp, "cpu.user.usec=%lld\n", (long long)ru->ru_utime.tv_sec *
+	    1000000 + ru->ru_utime.tv_usec);
+	fprintf(fp, "cpu.sys.usec=%lld\n", (long long)ru->ru_stime.tv_sec *
+	    1000000 + ru->ru_stime.tv_usec);
+	if ((sp = fopen(stats_path, "r")) != NULL) {
+		while (fgets(line, sizeof(line), sp) != NULL) {
+			fputs(line, fp);
+		}
+		fclose(sp);
+	}
+}
+
+static char *
+read_file(const char *path)
+{
+	FILE *fp;
+	char *buf;
+	long len;
+
+	if ((fp = fopen(path, "r")) == NULL ||
+	    fseek(fp, 0, SEEK_END) == -1 || (len = ftell(fp)) < 0 ||
+	    fseek(fp, 0, SEEK_SET) == -1 ||
+	    (buf = calloc(1, len + 1)) == NULL ||
+	    fread(buf, 1, len, fp) != (size_t)len) {
+		perror(path);
+		exit(1);
+	}
+	fclose(fp);
+	return buf;
+}
+
+static void
+usage(void)
+{
+	fputs("ptybench [-o summary] [-s script] [-q quiet-ms] "
+	    "[-r rows] [-c cols] -- aiomixer [args]\n", stderr);
+	exit(1);
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct bench b = { .quiet_ms = 20 };
+	struct winsize ws = { .ws_row = 24, .ws_col = 80 };
+	char stats_path[] = "/tmp/ptybench.XXXXXX";
+	char *child_argv[MAX_ARGS];
+	const char *script = default_script;
+	struct rusage ru;
+	unsigned long long start, first, last;
+	FILE *out = stdout;
+	int ch, status, fd, i;
+
+	while ((ch = getopt(argc, argv, "c:o:q:r:s:")) != -1) {
+		switch (ch) {
+		case 'c':
+			ws.ws_col = atoi(optarg);
+			break;
+		case 'o':
+			if ((out = fopen(optarg, "w")) == NULL) {
+				perror(optarg);
+				return 1;
+			}
+			break;
+		case 'q':
+			b.quiet_ms = atoi(optarg);
+			break;
+		case 'r':
+			ws.ws_row = atoi(optarg);
+			break;
+		case 's':
+			script = read_file(optarg);
+			break;
+		default:
+			usage();
+		}
+	}
+	argc -= optind;
+	argv += optind;
+	if (argc < 1 || argc + 3 > MAX_ARGS) {
+		usage();
+	}
+
+	/* aiomixer reports its mixer request counters through -S */
+	if ((fd = mkstemp(stats_path)) == -1) {
+		perror("mkstemp");
+		return 1;
+	}
+	close(fd);
+	child_argv[0] = argv[0];
+	child_argv[1] = "-S";
+	child_argv[2] = stats_path;
+	for (i = 1; i < argc; ++i) {
+		child_argv[i + 2] = argv[i];
+	}
+	child_argv[i + 2] = NULL;
+
+	new_phase(&b, "startup");
+	start = usec_now();
+	if ((b.pid = forkpty(&b.master, NULL, NULL, &ws)) == -1) {
+		perror("forkpty");
+		return 1;
+	}
+	if (b.pid == 0) {
+		setenv("TERM", "xterm", 1);
+		setenv("ESCDELAY", "25", 1);
+		execvp(child_argv[0], child_argv);
+		perror(child_argv[0]);
+		_exit(127);
+	}
+	if (drain(&b, start, 5000, &first, &last)) {
+		add_sample(current_phase(&b), first, last);
+	}
+	current_phase(&b)->wall_usec = usec_now() - start;
+
+	run_script(&b, script);
+
+	for (i = 0; i < 200; ++i) {
+		if (wait4(b.pid, &status, WNOHANG, &ru) == b.pid) {
+			break;
+		}
+		drain(&b, usec_now(), 10, &first, &last);
+	}
+	if (i == 200) {
+		fputs("ptybench: aiomixer did not exit, killing it\n", stderr);
+		kill(b.pid, SIGTERM);
+		wait4(b.pid, &status, 0, &ru);
+	}
+	report(&b, out, stats_path, &ru);
+	unlink(stats_path);
+	return WIFEXITED(status) && WEXITSTATUS(status) == 0 ? 0 : 1;
+}
@@ -0,0 +1,42 @@
+#!/bin/sh
+#
+# Run aiomixer against simulated mixers of growing size and print one
+# tab-separated row per size, ready for plotting, e.g. with gnuplot:
+#
+#	bench/scaling.sh > scaling.tsv
+#	gnuplot -e "set logscale x; plot 'scaling.tsv' using 1:2 with lines"
+#
+# Extra simulation parameters can be given as the first argument,
+# e.g. bench/scaling.sh channels=8,chain=4
+#
+
+extra=${1:+,$1}
+sizes=${SIZES:-"16 32 64 128 256 512 1024 2048 4096"}
+bench=$(dirname "$0")/ptybench
+aiomixer=${AIOMIXER:-./aiomixer}
+script=$(mktemp /tmp/scaling.XXXXXX)
+out=$(mktemp /tmp/scaling.XXXXXX)
+trap 'rm -f "$script" "$out"' EXIT
+
+cat > "$script" <<'END'
+phase class-switch
+key up
+key right 8
+quit
+END
+
+get() {
+	sed -n "s/^$1=//p" "$out"
+}
+
+printf 'controls\tstartup_usec\tclass_switch_usec\trss_kb\tdevinfo\treads\n'
+for n in $sizes; do
+	"$bench" -s "$script" -o "$out" -- \
+	    "$aiomixer" -s "classes=8,controls=$n$extra" || exit 1
+	printf '%s\t%s\t%s\t%s\t%s\t%s\n' "$n" \
+	    "$(get phase.startup.output_done.usec.max)" \
+	    "$(get phase.class-switch.output_done.usec.mean)" \
+	    "$(get rss.peak_kb)" \
+	    "$(get mixer.devinfo.count)" \
+	    "$(get mixer.read.count)"
+done
@@ -0,0 +1,246 @@
+/*
+ Copyright (c) 2019 Nia Alarie <nia@netbsd.org>
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions
+ are met:
+
+ 1. Redistributions of source code must retain the above copyright
+    notice, this list of conditions and the following disclaimer.
+ 2. Redistributions in binary form must reproduce the above copyright
+    notice, this list of conditions and the following disclaimer in the
+    documentation and/or other materials provided with the distribution.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "ctlsock.h"
+
+#define CTLSOCK_MAX_CLIENTS	(8)
+#define CTLSOCK_LINE		(256)
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL		(0)
+#endif
+
+struct ctlsock_client {
+	struct ctlsock *sock;
+	int fd; /* -1 when unused */
+	char buf[CTLSOCK_LINE];
+	size_t len;
+};
+
+struct ctlsock {
+	struct loop *loop;
+	char *path;
+	int fd;
+	bool bound;
+	ctlsock_fn fn;
+	void *arg;
+	struct ctlsock_client clients[CTLSOCK_MAX_CLIENTS];
+};
+
+static void
+ctlsock_drop(struct ctlsock_client *c)
+{
+	loop_remove_fd(c->sock->loop, c->fd);
+	close(c->fd);
+	c->fd = -1;
+	c->len = 0;
+}
+
+static bool
+ctlsock_reply(struct ctlsock_client *c, const char *line)
+{
+	char reply[CTLSOCK_LINE];
+	size_t len;
+
+	reply[0] = '\0';
+	c->sock->fn(c->sock->arg, line, reply, sizeof(reply) - 1);
+	len = strnlen(reply, sizeof(reply) - 1);
+	reply[len++] = '\n';
+	/* a client not reading its answers is not waited for */
+	return send(c->fd, reply, len, MSG_NOSIGNAL) == (ssize_t)len;
+}
+
+static void
+ctlsock_read(void *arg, int fd, short revents)
+{
+	struct ctlsock_client *c = arg;
+	char *line, *nl;
+	ssize_t n;
+
+	(void)revents; /* unused */
+	n = read(fd, c->buf + c->len, sizeof(c->buf) - 1 - c->len);
+	if (n == -1 && (errno == EAGAIN || errno == EINTR)) {
+		return;
+	}
+	if (n <= 0) {
+		ctlsock_drop(c);
+		return;
+	}
+	c->len += n;
+	c->buf[c->len] = '\0';
+	for (line = c->buf; (nl = strchr(line, '\n')) != NULL; line = nl + 1) {
+		*nl = '\0';
+		if (nl > line && nl[-1] == '\r') {
+			nl[-1] = '\0';
+		}
+		if (!ctlsock_reply(c, line)) {
+			ctlsock_drop(c);
+			return;
+		}
+	}
+	c->len -= line - c->buf;
+	memmove(c->buf, line, c->len);
+	/* no request is that long */
+	if (c->len == sizeof(c->buf) - 1) {
+		ctlsock_drop(c);
+	}
+}
+
+static void
+ctlsock_accept(void *arg, int fd, short revents)
+{
+	struct ctlsock *s = arg;
+	struct ctlsock_client *c = NULL;
+	int client;
+
+	(void)revents; /* unused */
+	if ((client = accept(fd, NULL, NULL)) == -1) {
+		return;
+	}
+	for (int i = 0; i < CTLSOCK_MAX_CLIENTS; ++i) {
+		if (s->clients[i].fd == -1) {
+			c = &s->clients[i];
+			break;
+		}
+	}
+	if (c == NULL || fcntl(client, F_SETFL, O_NONBLOCK) == -1 ||
+	    loop_add_fd(s->loop, client, POLLIN, ctlsock_read, c) == -1) {
+		close(client);
+		return;
+	}
+	c->fd = client;
+	c->len = 0;
+}
+
+/*
+ * Whether anyone is still listening on a socket found in the way.
+ */
+static bool
+ctlsock_live(const struct sockaddr_un *addr)
+{
+	int fd;
+	bool live;
+
+	if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) == -1) {
+		return true;
+	}
+	live = connect(fd, (const struct sockaddr *)addr, sizeof(*addr)) == 0 ||
+	    errno != ECONNREFUSED;
+	close(fd);
+	return live;
+}
+
+struct ctlsock *
+ctlsock_open(struct loop *loop, const char *path, ctlsock_fn fn, void *arg)
+{
+	struct sockaddr_un addr;
+	struct ctlsock *s;
+	int saved;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		errno = ENAMETOOLONG;
+		return NULL;
+	}
+	memcpy(addr.sun_path, path, strlen(path));
+	if ((s = calloc(1, sizeof(*s))) == NULL) {
+		return NULL;
+	}
+	s->loop = loop;
+	s->fd = -1;
+	s->fn = fn;
+	s->arg = arg;
+	for (int i = 0; i < CTLSOCK_MAX_CLIENTS; ++i) {
+		s->clients[i].sock = s;
+		s->clients[i].fd = -1;
+	}
+	if ((s->path = strdup(path)) == NULL ||
+	    (s->fd = socket(AF_UNIX, SOCK_STREAM, 0)) == -1) {
+		goto fail;
+	}
+	if (bind(s->fd, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+		/* left behind by an aiomixer that is gone */
+		if (errno != EADDRINUSE || ctlsock_live(&addr)) {
+			errno = EADDRINUSE;
+			goto fail;
+		}
+		if (unlink(path) == -1 ||
+		    bind(s->fd, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+			goto fail;
+		}
+	}
+	s->bound = true;
+	if (listen(s->fd, CTLSOCK_MAX_CLIENTS) == -1 ||
+	    fcntl(s->fd, F_SETFL, O_NONBLOCK) == -1 ||
+	    loop_add_fd(loop, s->fd, POLLIN, ctlsock_accept, s) == -1) {
+		goto fail;
+	}
+	return s;
+fail:
+	saved = errno;
+	if (s->bound) {
+		unlink(path);
+	}
+	if (s->fd != -1) {
+		close(s->fd);
+	}
+	free(s->path);
+	free(s);
+	errno = saved;
+	return NULL;
+}
+
+void
+ctlsock_close(struct ctlsock *s)
+{
+	if (s == NULL) {
+		return;
+	}
+	for (int i = 0; i < CTLSOCK_MAX_CLIENTS; ++i) {
+		if (s->clients[i].fd != -1) {
+			ctlsock_drop(&s->clients[i]);
+		}
+	}
+	loop_remove_fd(s->loop, s->fd);
+	close(s->fd);
+	unlink(s->path);
+	free(s->path);
+	free(s);
+}
@@ -0,0 +1,248 @@
+/*
+ Copyright (c) 2019 Nia Alarie <nia@netbsd.org>
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions
+ are met:
+
+ 1. Redistributions of source code must retain the above copyright
+    notice, this list of conditions and the following disclaimer.
+ 2. Redistributions in binary form must reproduce the above copyright
+    notice, this list of conditions and the following disclaimer in the
+    documentation and/or other materials provided with the distribution.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+/*
+ * File change detection.  The directory is watched rather than the
+ * file, so that a file replaced or created anew is noticed, and
+ * whatever it reports is only taken as a hint: a change is the file's
+ * identity, size or modification time differing from when it was
+ * last looked at.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#if defined(__linux__)
+#include <sys/inotify.h>
+#define FILEWATCH_INOTIFY
+#elif defined(__NetBSD__) || defined(__FreeBSD__) || \
+    defined(__OpenBSD__) || defined(__DragonFly__) || defined(__APPLE__)
+#include <sys/event.h>
+#define FILEWATCH_KQUEUE
+#endif
+
+#include "filewatch.h"
+
+struct filewatch {
+	char path[PATH_MAX];
+	int watch;	/* inotify or kqueue descriptor, or -1 */
+	int dirfd;	/* the directory, for kqueue */
+	int filefd;	/* the file, for kqueue */
+	struct stat st;	/* as last looked at, zeroed while missing */
+};
+
+static void
+filewatch_dir(const char *path, char *dir, size_t size)
+{
+	const char *slash = strrchr(path, '/');
+
+	if (slash == NULL) {
+		snprintf(dir, size, ".");
+	} else if (slash == path) {
+		snprintf(dir, size, "/");
+	} else {
+		snprintf(dir, size, "%.*s", (int)(slash - path), path);
+	}
+}
+
+#if defined(FILEWATCH_KQUEUE)
+/*
+ * A kqueue only watches what is open, so the file itself is watched
+ * for writes in place, and reopened whenever it is replaced.
+ */
+static void
+filewatch_kqueue_file(struct filewatch *w)
+{
+	struct kevent ev;
+
+	if (w->filefd != -1) {
+		/* closing removes the event */
+		close(w->filefd);
+	}
+	if ((w->filefd = open(w->path, O_RDONLY | O_CLOEXEC)) == -1) {
+		return;
+	}
+	EV_SET(&ev, w->filefd, EVFILT_VNODE, EV_ADD | EV_CLEAR,
+	    NOTE_WRITE | NOTE_EXTEND | NOTE_ATTRIB | NOTE_DELETE |
+	    NOTE_RENAME, 0, 0);
+	if (kevent(w->watch, &ev, 1, NULL, 0, NULL) == -1) {
+		close(w->filefd);
+		w->filefd = -1;
+	}
+}
+#endif
+
+static void
+filewatch_watch(struct filewatch *w)
+{
+	char dir[PATH_MAX];
+
+	filewatch_dir(w->path, dir, sizeof(dir));
+#if defined(FILEWATCH_INOTIFY)
+	if ((w->watch = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) == -1) {
+		return;
+	}
+	if (inotify_add_watch(w->watch, dir, IN_CLOSE_WRITE | IN_MOVED_TO |
+	    IN_CREATE | IN_DELETE | IN_ATTRIB) == -1) {
+		close(w->watch);
+		w->watch = -1;
+	}
+#elif defined(FILEWATCH_KQUEUE)
+	struct kevent ev;
+
+	if ((w->dirfd = open(dir, O_RDONLY | O_CLOEXEC)) == -1) {
+		return;
+	}
+	if ((w->watch = kqueue()) != -1) {
+		EV_SET(&ev, w->dirfd, EVFILT_VNODE, EV_ADD | EV_CLEAR,
+		    NOTE_WRITE, 0, 0);
+		if (kevent(w->watch, &ev, 1, NULL, 0, NULL) != -1) {
+			filewatch_kqueue_file(w);
+			return;
+		}
+		close(w->watch);
+		w->watch = -1;
+	}
+	close(w->dirfd);
+	w->dirfd = -1;
+#else
+	(void)dir;
+#endif
+}
+
+static void
+filewatch_drain(struct filewatch *w)
+{
+#if defined(FILEWATCH_INOTIFY)
+	char buf[4096];
+
+	while (read(w->watch, buf, sizeof(buf)) > 0) {
+		continue;
+	}
+#elif defined(FILEWATCH_KQUEUE)
+	struct timespec ts = { 0, 0 };
+	struct kevent ev;
+
+	while (kevent(w->watch, NULL, 0, &ev, 1, &ts) > 0) {
+		continue;
+	}
+#else
+	(void)w;
+#endif
+}
+
+static bool
+filewatch_same(const struct stat *a, const struct stat *b)
+{
+	return a->st_dev == b->st_dev && a->st_ino == b->st_ino &&
+	    a->st_size == b->st_size &&
+	    a->st_mtim.tv_sec == b->st_mtim.tv_sec &&
+	    a->st_mtim.tv_nsec == b->st_mtim.tv_nsec;
+}
+
+/*
+ * Watch path, which need not exist yet.  Its current contents do not
+ * count as a change.
+ */
+struct filewatch *
+filewatch_open(const char *path)
+{
+	struct filewatch *w;
+
+	if (strlen(path) >= PATH_MAX) {
+		errno = ENAMETOOLONG;
+		return NULL;
+	}
+	if ((w = calloc(1, sizeof(*w))) == NULL) {
+		return NULL;
+	}
+	w->watch = w->dirfd = w->filefd = -1;
+	memcpy(w->path, path, strlen(path) + 1);
+	filewatch_watch(w);
+	if (stat(w->path, &w->st) == -1) {
+		memset(&w->st, 0, sizeof(w->st));
+	}
+	return w;
+}
+
+int
+filewatch_fd(struct filewatch *w)
+{
+	return w->watch;
+}
+
+/*
+ * Whether the file changed since the last call.  A missing file is
+ * taken to be on its way to being replaced, and so not a change.
+ */
+bool
+filewatch_changed(struct filewatch *w)
+{
+	struct stat st;
+
+	if (w->watch != -1) {
+		filewatch_drain(w);
+	}
+	if (stat(w->path, &st) == -1 || filewatch_same(&st, &w->st)) {
+		return false;
+	}
+#if defined(FILEWATCH_KQUEUE)
+	if (w->watch != -1 &&
+	    (st.st_dev != w->st.st_dev || st.st_ino != w->st.st_ino)) {
+		filewatch_kqueue_file(w);
+	}
+#endif
+	w->st = st;
+	return true;
+}
+
+void
+filewatch_close(struct filewatch *w)
+{
+	if (w == NULL) {
+		return;
+	}
+	if (w->watch != -1) {
+		close(w->watch);
+	}
+	if (w->dirfd != -1) {
+		close(w->dirfd);
+	}
+	if (w->filefd != -1) {
+		close(w->filefd);
+	}
+	free(w);
+}
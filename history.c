@@ -0,0 +1,115 @@
+/*
+ Copyright (c) 2019 Nia Alarie <nia@netbsd.org>
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions
+ are met:
+
+ 1. Redistributions of source code must retain the above copyright
+    notice, this list of conditions and the following disclaimer.
+ 2. Redistributions in binary form must reproduce the above copyright
+    notice, this list of conditions and the following disclaimer in the
+    documentation and/or other materials provided with the distribution.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <errno.h>
+#include <string.h>
+
+#include "history.h"
+
+static struct history_entry *
+history_at(struct history *h, unsigned i)
+{
+	return &h->ring[(h->first + i) % HISTORY_MAX];
+}
+
+/*
+ * Record that a control was changed from before to after.  Anything
+ * undone is forgotten.
+ */
+void
+history_push(struct history *h, const mixer_ctrl_t *before,
+    const mixer_ctrl_t *after)
+{
+	struct history_entry *e;
+
+	h->count = h->cursor;
+	if (!h->sealed && h->count > 0 &&
+	    (e = history_at(h, h->count - 1))->after.dev == after->dev) {
+		e->after = *after;
+		return;
+	}
+	if (h->count == HISTORY_MAX) {
+		h->first = (h->first + 1) % HISTORY_MAX;
+		h->count--;
+	}
+	e = history_at(h, h->count++);
+	e->before = *before;
+	e->after = *after;
+	h->cursor = h->count;
+	h->sealed = false;
+}
+
+/*
+ * Write back the value from before the last change not undone yet,
+ * which becomes the control's last known value.  Returns what was
+ * written, or NULL with errno set, to ENOENT if there is nothing to
+ * undo.
+ */
+const mixer_ctrl_t *
+history_undo(struct history *h, struct mixdev *md)
+{
+	struct history_entry *e;
+
+	if (h->cursor == 0) {
+		errno = ENOENT;
+		return NULL;
+	}
+	e = history_at(h, h->cursor - 1);
+	if (mixdev_write(md, &e->before) == -1) {
+		return NULL;
+	}
+	h->cursor--;
+	h->sealed = true;
+	return &e->before;
+}
+
+/*
+ * Write again the value after the last change undone.
+ */
+const mixer_ctrl_t *
+history_redo(struct history *h, struct mixdev *md)
+{
+	struct history_entry *e;
+
+	if (h->cursor == h->count) {
+		errno = ENOENT;
+		return NULL;
+	}
+	e = history_at(h, h->cursor);
+	if (mixdev_write(md, &e->after) == -1) {
+		return NULL;
+	}
+	h->cursor++;
+	h->sealed = true;
+	return &e->after;
+}
+
+void
+history_clear(struct history *h)
+{
+	memset(h, 0, sizeof(*h));
+}
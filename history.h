@@ -0,0 +1,61 @@
+/*
+ Copyright (c) 2019 Nia Alarie <nia@netbsd.org>
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions
+ are met:
+
+ 1. Redistributions of source code must retain the above copyright
+    notice, this list of conditions and the following disclaimer.
+ 2. Redistributions in binary form must reproduce the above copyright
+    notice, this list of conditions and the following disclaimer in the
+    documentation and/or other materials provided with the distribution.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef AIOMIXER_HISTORY_H
+#define AIOMIXER_HISTORY_H
+
+#include <stdbool.h>
+
+#include "mixdev.h"
+
+#define HISTORY_MAX	(128)
+
+/*
+ * Undo history of control changes, in a ring that forgets the oldest
+ * entry once full.  Consecutive changes to the same control coalesce
+ * into one entry, holding the value before the first and after the
+ * last, so undoing them takes a single write.
+ */
+struct history_entry {
+	mixer_ctrl_t before;
+	mixer_ctrl_t after;
+};
+
+struct history {
+	struct history_entry ring[HISTORY_MAX];
+	unsigned first;		/* the oldest entry */
+	unsigned count;		/* entries kept */
+	unsigned cursor;	/* of which not undone */
+	bool sealed;		/* the newest entry takes no more changes */
+};
+
+void history_push(struct history *, const mixer_ctrl_t *, const mixer_ctrl_t *);
+const mixer_ctrl_t *history_undo(struct history *, struct mixdev *);
+const mixer_ctrl_t *history_redo(struct history *, struct mixdev *);
+void history_clear(struct history *);
+
+#endif /* !AIOMIXER_HISTORY_H */
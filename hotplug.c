@@ -0,0 +1,433 @@
+/*
+ Copyright (c) 2019 Nia Alarie <nia@netbsd.org>
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions
+ are met:
+
+ 1. Redistributions of source code must retain the above copyright
+    notice, this list of conditions and the following disclaimer.
+ 2. Redistributions in binary form must reproduce the above copyright
+    notice, this list of conditions and the following disclaimer in the
+    documentation and/or other materials provided with the distribution.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Device hot-plug detection.  Device nodes come and go with the
+ * hardware on some systems, while on others (NetBSD among them) they
+ * are always there and only fail to open without a device behind
+ * them.  So the directory is rescanned, and each mixerN entry opened
+ * to see whether it is live, both when the directory changes (where
+ * inotify or kqueue can tell) and every HOTPLUG_RESCAN milliseconds.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#if defined(__linux__)
+#include <sys/inotify.h>
+#define HOTPLUG_INOTIFY
+#elif defined(__NetBSD__) || defined(__FreeBSD__) || \
+    defined(__OpenBSD__) || defined(__DragonFly__) || defined(__APPLE__)
+#include <sys/event.h>
+#define HOTPLUG_KQUEUE
+#endif
+
+#include "hotplug.h"
+
+#define HOTPLUG_RESCAN	(1000)
+#define HOTPLUG_MAX	(16)	/* devices tracked at once */
+#define HOTPLUG_QUEUE	(32)
+#define HOTPLUG_SPEC	(256)
+
+struct hotplug {
+	char dir[PATH_MAX];
+	int watch;	/* inotify or kqueue descriptor, or -1 */
+	int dirfd;	/* the directory, for kqueue */
+	int wake[2];	/* written to when events are queued */
+	int stop[2];	/* written to when closing */
+	pthread_t thread;
+	pthread_mutex_t lock;
+	bool running;
+	bool restore;
+
+	/* under lock */
+	struct hotplug_event queue[HOTPLUG_QUEUE];
+	unsigned head, count;
+
+	/* the thread's own */
+	char known[HOTPLUG_MAX][HOTPLUG_NAME_MAX];
+	unsigned nknown;
+};
+
+static bool
+hotplug_match(const char *name)
+{
+	if (strncmp(name, "mixer", 5) != 0 || name[5] == '\0' ||
+	    strlen(name) >= HOTPLUG_NAME_MAX) {
+		return false;
+	}
+	for (name += 5; *name != '\0'; ++name) {
+		if (!isdigit((unsigned char)*name)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static bool
+hotplug_present(const char *path)
+{
+	struct stat st;
+	int fd;
+
+	if (stat(path, &st) == -1) {
+		return false;
+	}
+	if (S_ISREG(st.st_mode)) {
+		/* still being written */
+		return st.st_size > 0;
+	}
+	if (!S_ISCHR(st.st_mode) || (fd = open(path, O_RDWR)) == -1) {
+		return false;
+	}
+	close(fd);
+	return true;
+}
+
+static struct mixer *
+hotplug_open_device(struct hotplug *h, const char *path)
+{
+	char spec[HOTPLUG_SPEC];
+	struct mixer *hw, *mixer;
+	struct stat st;
+	FILE *fp;
+
+	if (stat(path, &st) == -1) {
+		return NULL;
+	}
+	if (!S_ISREG(st.st_mode)) {
+		if ((hw = mixer_open(path)) == NULL) {
+			return NULL;
+		}
+		if ((mixer = mixer_reconnect(hw, mixer_open, path,
+		    h->restore)) == NULL) {
+			mixer_close(hw);
+		}
+		return mixer;
+	}
+	if ((fp = fopen(path, "r")) == NULL) {
+		return NULL;
+	}
+	if (fgets(spec, sizeof(spec), fp) == NULL) {
+		spec[0] = '\0';
+	}
+	fclose(fp);
+	spec[strcspn(spec, "\n")] = '\0';
+	return mixer_open_sim(spec);
+}
+
+/*
+ * Wake the other end of a pipe.  A full pipe already wakes it, so only
+ * interrupted writes are tried again.
+ */
+static void
+hotplug_wake(int fd)
+{
+	while (write(fd, "", 1) == -1 && errno == EINTR) {
+		continue;
+	}
+}
+
+static bool
+hotplug_post(struct hotplug *h, struct hotplug_event *ev)
+{
+	bool queued;
+
+	pthread_mutex_lock(&h->lock);
+	if ((queued = h->count < HOTPLUG_QUEUE)) {
+		h->queue[(h->head + h->count++) % HOTPLUG_QUEUE] = *ev;
+	}
+	pthread_mutex_unlock(&h->lock);
+	if (queued) {
+		hotplug_wake(h->wake[1]);
+	}
+	return queued;
+}
+
+static bool
+hotplug_attach(struct hotplug *h, const char *name, const char *path)
+{
+	struct hotplug_event ev = {0};
+
+	ev.change = HOTPLUG_ATTACH;
+	memcpy(ev.name, name, strlen(name) + 1);
+	if ((ev.mixer = hotplug_open_device(h, path)) == NULL) {
+		return false;
+	}
+	if (mixer_enumerate(ev.mixer, &ev.info, &ev.ninfo) == -1 ||
+	    ev.ninfo == 0 || !hotplug_post(h, &ev)) {
+		/* retried on the next scan */
+		mixer_close(ev.mixer);
+		free(ev.info);
+		return false;
+	}
+	return true;
+}
+
+static void
+hotplug_scan(struct hotplug *h)
+{
+	struct hotplug_event ev = {0};
+	bool seen[HOTPLUG_MAX] = {0};
+	char path[PATH_MAX];
+	struct dirent *de;
+	unsigned i;
+	DIR *dir;
+
+	if ((dir = opendir(h->dir)) == NULL) {
+		return;
+	}
+	while ((de = readdir(dir)) != NULL) {
+		if (!hotplug_match(de->d_name)) {
+			continue;
+		}
+		if (snprintf(path, sizeof(path), "%s/%s", h->dir,
+		    de->d_name) >= (int)sizeof(path)) {
+			continue;
+		}
+		for (i = 0; i < h->nknown; ++i) {
+			if (strcmp(h->known[i], de->d_name) == 0) {
+				break;
+			}
+		}
+		if (!hotplug_present(path)) {
+			continue;
+		}
+		if (i < h->nknown) {
+			seen[i] = true;
+		} else if (h->nknown < HOTPLUG_MAX &&
+		    hotplug_attach(h, de->d_name, path)) {
+			/* hotplug_match() checked the length */
+			memcpy(h->known[h->nknown], de->d_name,
+			    strlen(de->d_name) + 1);
+			seen[h->nknown++] = true;
+		}
+	}
+	closedir(dir);
+
+	ev.change = HOTPLUG_DETACH;
+	for (i = h->nknown; i-- > 0;) {
+		if (seen[i]) {
+			continue;
+		}
+		snprintf(ev.name, sizeof(ev.name), "%s", h->known[i]);
+		if (hotplug_post(h, &ev)) {
+			h->nknown--;
+			memcpy(h->known[i], h->known[h->nknown], HOTPLUG_NAME_MAX);
+			seen[i] = seen[h->nknown];
+		}
+	}
+}
+
+static void
+hotplug_watch(struct hotplug *h)
+{
+#if defined(HOTPLUG_INOTIFY)
+	if ((h->watch = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) == -1) {
+		return;
+	}
+	if (inotify_add_watch(h->watch, h->dir, IN_CREATE | IN_DELETE |
+	    IN_MOVED_FROM | IN_MOVED_TO | IN_CLOSE_WRITE | IN_ATTRIB) == -1) {
+		close(h->watch);
+		h->watch = -1;
+	}
+#elif defined(HOTPLUG_KQUEUE)
+	struct kevent ev;
+
+	if ((h->dirfd = open(h->dir, O_RDONLY | O_CLOEXEC)) == -1) {
+		return;
+	}
+	if ((h->watch = kqueue()) != -1) {
+		EV_SET(&ev, h->dirfd, EVFILT_VNODE, EV_ADD | EV_CLEAR,
+		    NOTE_WRITE | NOTE_ATTRIB, 0, 0);
+		if (kevent(h->watch, &ev, 1, NULL, 0, NULL) != -1) {
+			return;
+		}
+		close(h->watch);
+		h->watch = -1;
+	}
+	close(h->dirfd);
+	h->dirfd = -1;
+#else
+	(void)h;
+#endif
+}
+
+static void
+hotplug_drain(struct hotplug *h)
+{
+#if defined(HOTPLUG_INOTIFY)
+	char buf[4096];
+
+	while (read(h->watch, buf, sizeof(buf)) > 0) {
+		continue;
+	}
+#elif defined(HOTPLUG_KQUEUE)
+	struct timespec ts = { 0, 0 };
+	struct kevent ev;
+
+	while (kevent(h->watch, NULL, 0, &ev, 1, &ts) > 0) {
+		continue;
+	}
+#else
+	(void)h;
+#endif
+}
+
+static void *
+hotplug_run(void *arg)
+{
+	struct hotplug *h = arg;
+	struct pollfd pfd[2];
+
+	for (;;) {
+		hotplug_scan(h);
+		pfd[0].fd = h->stop[0];
+		pfd[0].events = POLLIN;
+		pfd[1].fd = h->watch; /* ignored if -1 */
+		pfd[1].events = POLLIN;
+		if (poll(pfd, 2, HOTPLUG_RESCAN) == -1 && errno != EINTR) {
+			break;
+		}
+		if (pfd[0].revents != 0) {
+			break;
+		}
+		if (pfd[1].revents != 0) {
+			hotplug_drain(h);
+		}
+	}
+	return NULL;
+}
+
+static void
+hotplug_free(struct hotplug *h)
+{
+	int *fds[] = { &h->watch, &h->dirfd, &h->wake[0], &h->wake[1],
+	    &h->stop[0], &h->stop[1] };
+
+	for (size_t i = 0; i < sizeof(fds) / sizeof(fds[0]); ++i) {
+		if (*fds[i] != -1) {
+			close(*fds[i]);
+		}
+	}
+	for (unsigned i = 0; i < h->count; ++i) {
+		mixer_close(h->queue[(h->head + i) % HOTPLUG_QUEUE].mixer);
+		free(h->queue[(h->head + i) % HOTPLUG_QUEUE].info);
+	}
+	pthread_mutex_destroy(&h->lock);
+	free(h);
+}
+
+/*
+ * Watch dir.  The device called current is already open, and only
+ * reported when it goes away.
+ */
+struct hotplug *
+hotplug_open(const char *dir, const char *current, bool restore)
+{
+	struct hotplug *h;
+	int error;
+
+	if ((h = calloc(1, sizeof(*h))) == NULL) {
+		return NULL;
+	}
+	h->watch = h->dirfd = -1;
+	h->wake[0] = h->wake[1] = h->stop[0] = h->stop[1] = -1;
+	pthread_mutex_init(&h->lock, NULL);
+	h->restore = restore;
+	snprintf(h->dir, sizeof(h->dir), "%s", dir);
+	if (current != NULL && hotplug_match(current)) {
+		snprintf(h->known[0], HOTPLUG_NAME_MAX, "%s", current);
+		h->nknown = 1;
+	}
+	if (pipe(h->wake) == -1 || pipe(h->stop) == -1 ||
+	    fcntl(h->wake[0], F_SETFL, O_NONBLOCK) == -1 ||
+	    fcntl(h->wake[1], F_SETFL, O_NONBLOCK) == -1) {
+		error = errno;
+		hotplug_free(h);
+		errno = error;
+		return NULL;
+	}
+	hotplug_watch(h);
+	if ((error = pthread_create(&h->thread, NULL, hotplug_run, h)) != 0) {
+		hotplug_free(h);
+		errno = error;
+		return NULL;
+	}
+	h->running = true;
+	return h;
+}
+
+int
+hotplug_fd(struct hotplug *h)
+{
+	return h->wake[0];
+}
+
+bool
+hotplug_next(struct hotplug *h, struct hotplug_event *ev)
+{
+	char buf[64];
+	bool found;
+
+	while (read(h->wake[0], buf, sizeof(buf)) > 0) {
+		continue;
+	}
+	pthread_mutex_lock(&h->lock);
+	if ((found = h->count > 0)) {
+		*ev = h->queue[h->head];
+		h->head = (h->head + 1) % HOTPLUG_QUEUE;
+		h->count--;
+	}
+	pthread_mutex_unlock(&h->lock);
+	return found;
+}
+
+void
+hotplug_close(struct hotplug *h)
+{
+	if (h == NULL) {
+		return;
+	}
+	if (h->running) {
+		hotplug_wake(h->stop[1]);
+		pthread_join(h->thread, NULL);
+	}
+	hotplug_free(h);
+}
@@ -0,0 +1,68 @@
+/*
+ Copyright (c) 2019 Nia Alarie <nia@netbsd.org>
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions
+ are met:
+
+ 1. Redistributions of source code must retain the above copyright
+    notice, this list of conditions and the following disclaimer.
+ 2. Redistributions in binary form must reproduce the above copyright
+    notice, this list of conditions and the following disclaimer in the
+    documentation and/or other materials provided with the distribution.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef AIOMIXER_HOTPLUG_H
+#define AIOMIXER_HOTPLUG_H
+
+#include <stdbool.h>
+
+#include "mixer.h"
+
+#define HOTPLUG_NAME_MAX	(16)
+
+/*
+ * Watches a directory for mixerN devices coming and going.  A thread
+ * opens and enumerates new devices, so that the caller only has to
+ * pick up the results: hotplug_fd() becomes readable whenever
+ * hotplug_next() has events to hand out.
+ *
+ * Device nodes are opened with mixer_reconnect(), restoring values
+ * if asked to.  Regular files are taken as simulated devices, their
+ * contents being a spec as for mixer_open_sim().
+ */
+enum hotplug_change {
+	HOTPLUG_ATTACH,
+	HOTPLUG_DETACH
+};
+
+struct hotplug_event {
+	enum hotplug_change change;
+	char name[HOTPLUG_NAME_MAX];
+	/* attach only, owned by the caller from then on */
+	struct mixer *mixer;
+	struct mixer_devinfo *info;
+	unsigned ninfo;
+};
+
+struct hotplug;
+
+struct hotplug *hotplug_open(const char *, const char *, bool);
+int hotplug_fd(struct hotplug *);
+bool hotplug_next(struct hotplug *, struct hotplug_event *);
+void hotplug_close(struct hotplug *);
+
+#endif /* !AIOMIXER_HOTPLUG_H */
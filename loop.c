@@ -0,0 +1,238 @@
+/*
+ Copyright (c) 2019 Nia Alarie <nia@netbsd.org>
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions
+ are met:
+
+ 1. Redistributions of source code must retain the above copyright
+    notice, this list of conditions and the following disclaimer.
+ 2. Redistributions in binary form must reproduce the above copyright
+    notice, this list of conditions and the following disclaimer in the
+    documentation and/or other materials provided with the distribution.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <errno.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "loop.h"
+
+#define LOOP_MAX_FDS	(32)
+#define LOOP_MAX_TIMERS	(8)
+
+struct loop_fd {
+	int fd; /* -1 once removed */
+	short events;
+	loop_fd_fn fn;
+	void *arg;
+};
+
+struct loop_timer {
+	unsigned period; /* milliseconds, 0 once removed */
+	struct timespec due;
+	loop_timer_fn fn;
+	void *arg;
+};
+
+struct loop {
+	struct loop_fd fds[LOOP_MAX_FDS];
+	unsigned nfds;
+	struct loop_timer timers[LOOP_MAX_TIMERS];
+};
+
+static long
+loop_ms_until(const struct timespec *due, const struct timespec *now)
+{
+	return (due->tv_sec - now->tv_sec) * 1000 +
+	    (due->tv_nsec - now->tv_nsec) / 1000000;
+}
+
+static void
+loop_add_ms(struct timespec *ts, unsigned ms)
+{
+	ts->tv_sec += ms / 1000;
+	ts->tv_nsec += (long)(ms % 1000) * 1000000;
+	if (ts->tv_nsec >= 1000000000) {
+		ts->tv_sec++;
+		ts->tv_nsec -= 1000000000;
+	}
+}
+
+struct loop *
+loop_new(void)
+{
+	return calloc(1, sizeof(struct loop));
+}
+
+int
+loop_add_fd(struct loop *l, int fd, short events, loop_fd_fn fn, void *arg)
+{
+	unsigned i;
+
+	for (i = 0; i < l->nfds && l->fds[i].fd != -1; ++i) {
+		continue;
+	}
+	if (i == LOOP_MAX_FDS) {
+		errno = ENOSPC;
+		return -1;
+	}
+	l->fds[i].fd = fd;
+	l->fds[i].events = events;
+	l->fds[i].fn = fn;
+	l->fds[i].arg = arg;
+	if (i == l->nfds) {
+		l->nfds++;
+	}
+	return 0;
+}
+
+void
+loop_remove_fd(struct loop *l, int fd)
+{
+	for (unsigned i = 0; i < l->nfds; ++i) {
+		if (l->fds[i].fd == fd) {
+			l->fds[i].fd = -1;
+		}
+	}
+}
+
+/*
+ * Runs fn every period milliseconds from now on, returning an id for
+ * loop_remove_timer().
+ */
+int
+loop_add_timer(struct loop *l, unsigned period, loop_timer_fn fn, void *arg)
+{
+	struct loop_timer *t;
+
+	for (int i = 0; i < LOOP_MAX_TIMERS; ++i) {
+		t = &l->timers[i];
+		if (t->period != 0) {
+			continue;
+		}
+		t->period = period > 0 ? period : 1;
+		t->fn = fn;
+		t->arg = arg;
+		clock_gettime(CLOCK_MONOTONIC, &t->due);
+		loop_add_ms(&t->due, t->period);
+		return i;
+	}
+	errno = ENOSPC;
+	return -1;
+}
+
+void
+loop_remove_timer(struct loop *l, int id)
+{
+	if (id >= 0 && id < LOOP_MAX_TIMERS) {
+		l->timers[id].period = 0;
+	}
+}
+
+static int
+loop_timeout(struct loop *l)
+{
+	struct timespec now;
+	long ms, timeout = -1;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	for (int i = 0; i < LOOP_MAX_TIMERS; ++i) {
+		if (l->timers[i].period == 0) {
+			continue;
+		}
+		ms = loop_ms_until(&l->timers[i].due, &now);
+		if (ms < 0) {
+			ms = 0;
+		}
+		if (timeout == -1 || ms < timeout) {
+			timeout = ms;
+		}
+	}
+	return timeout;
+}
+
+static void
+loop_run_timers(struct loop *l)
+{
+	struct loop_timer *t;
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	for (int i = 0; i < LOOP_MAX_TIMERS; ++i) {
+		t = &l->timers[i];
+		if (t->period == 0 || loop_ms_until(&t->due, &now) > 0) {
+			continue;
+		}
+		/* late ones are not made up for */
+		loop_add_ms(&t->due, t->period);
+		if (loop_ms_until(&t->due, &now) <= 0) {
+			t->due = now;
+			loop_add_ms(&t->due, t->period);
+		}
+		t->fn(t->arg);
+	}
+}
+
+/*
+ * Waits for fd to become readable, running callbacks meanwhile.
+ * Returns 1 when it is, 0 when interrupted by a signal (a resize, say)
+ * and -1 on error.
+ */
+int
+loop_wait(struct loop *l, int fd)
+{
+	struct pollfd pfd[1 + LOOP_MAX_FDS];
+	unsigned slot[1 + LOOP_MAX_FDS];
+	struct loop_fd *f;
+	nfds_t n;
+
+	for (;;) {
+		pfd[0].fd = fd;
+		pfd[0].events = POLLIN;
+		n = 1;
+		for (unsigned i = 0; i < l->nfds; ++i) {
+			if (l->fds[i].fd == -1) {
+				continue;
+			}
+			pfd[n].fd = l->fds[i].fd;
+			pfd[n].events = l->fds[i].events;
+			slot[n++] = i;
+		}
+		if (poll(pfd, n, loop_timeout(l)) == -1) {
+			return errno == EINTR ? 0 : -1;
+		}
+		loop_run_timers(l);
+		for (nfds_t j = 1; j < n; ++j) {
+			f = &l->fds[slot[j]];
+			/* not if removed, or replaced, by an earlier callback */
+			if (pfd[j].revents != 0 && f->fd == pfd[j].fd) {
+				f->fn(f->arg, f->fd, pfd[j].revents);
+			}
+		}
+		if (pfd[0].revents != 0) {
+			return 1;
+		}
+	}
+}
+
+void
+loop_free(struct loop *l)
+{
+	free(l);
+}
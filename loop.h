@@ -0,0 +1,56 @@
+/*
+ Copyright (c) 2019 Nia Alarie <nia@netbsd.org>
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions
+ are met:
+
+ 1. Redistributions of source code must retain the above copyright
+    notice, this list of conditions and the following disclaimer.
+ 2. Redistributions in binary form must reproduce the above copyright
+    notice, this list of conditions and the following disclaimer in the
+    documentation and/or other materials provided with the distribution.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef AIOMIXER_LOOP_H
+#define AIOMIXER_LOOP_H
+
+/*
+ * The main loop.  CDK widgets read their own keys, so instead of
+ * owning the terminal the loop is entered whenever no key came for a
+ * while, and blocks in poll(2) on the terminal together with every
+ * other descriptor registered, and until the next timer is due.  It
+ * runs their callbacks as they become ready, and returns once there
+ * is a key to read.
+ *
+ * Timers are poll(2) timeouts rather than timer descriptors, which
+ * not every system has.  Callbacks may add and remove descriptors and
+ * timers, their own included.
+ */
+typedef void (*loop_fd_fn)(void *, int, short);
+typedef void (*loop_timer_fn)(void *);
+
+struct loop;
+
+struct loop *loop_new(void);
+int loop_add_fd(struct loop *, int, short, loop_fd_fn, void *);
+void loop_remove_fd(struct loop *, int);
+int loop_add_timer(struct loop *, unsigned, loop_timer_fn, void *);
+void loop_remove_timer(struct loop *, int);
+int loop_wait(struct loop *, int);
+void loop_free(struct loop *);
+
+#endif /* !AIOMIXER_LOOP_H */
@@ -0,0 +1,450 @@
+/*
+ Copyright (c) 2019 Nia Alarie <nia@netbsd.org>
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions
+ are met:
+
+ 1. Redistributions of source code must retain the above copyright
+    notice, this list of conditions and the following disclaimer.
+ 2. Redistributions in binary form must reproduce the above copyright
+    notice, this list of conditions and the following disclaimer in the
+    documentation and/or other materials provided with the distribution.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Level meters, see meter.h.
+ *
+ * Samples are first converted to floats a period at a time and then
+ * measured by a kernel that keeps METER_LANES independent running
+ * peaks and sums of squares, sample i going to lane i % METER_LANES.
+ * With the number of channels dividing METER_LANES, each lane only
+ * ever sees one channel, so the lanes are folded into channels once
+ * at the end, and the inner loop has no dependencies between its
+ * iterations for the compiler to trip over when vectorising it.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef __NetBSD__
+#include <sys/audioio.h>
+#include <sys/ioctl.h>
+#endif
+
+#include "meter.h"
+
+/* a multiple of 1, 2, 3, 4, 6 and 8 channels */
+#define METER_LANES	(48)
+
+/* 20 dB a second once held for a second */
+#define METER_DECAY_DB	(20.0f)
+
+struct meter {
+	int fd;
+	bool paced; /* a regular file, read at the sample rate */
+	struct meter_format fmt;
+	unsigned fps;
+	size_t period_frames, period_bytes, fill;
+	uint8_t *buf;
+	float *samples;
+	float decay;
+	unsigned held[METER_CHANNELS];
+	struct meter_levels work;
+
+	pthread_t thread;
+	pthread_mutex_t lock;
+	bool running;
+	int stop[2];
+	struct meter_levels levels; /* under lock */
+};
+
+bool
+meter_parse_format(struct meter_format *f, const char *spec)
+{
+	static const struct {
+		const char *name;
+		size_t offset;
+		unsigned min, max;
+	} keys[] = {
+		{ "rate", offsetof(struct meter_format, rate), 1000, 384000 },
+		{ "channels", offsetof(struct meter_format, channels),
+		    1, METER_CHANNELS },
+		{ "bits", offsetof(struct meter_format, bits), 16, 32 },
+	};
+	char *copy, *tok, *last, *eq, *end;
+	unsigned long v;
+	size_t i;
+	bool ok = true;
+
+	if ((copy = strdup(spec)) == NULL) {
+		return false;
+	}
+	for (tok = strtok_r(copy, ",", &last); tok != NULL && ok;
+	    tok = strtok_r(NULL, ",", &last)) {
+		ok = false;
+		if ((eq = strchr(tok, '=')) == NULL) {
+			break;
+		}
+		*eq++ = '\0';
+		v = strtoul(eq, &end, 10);
+		if (*eq == '\0' || *end != '\0') {
+			break;
+		}
+		for (i = 0; i < sizeof(keys) / sizeof(keys[0]); ++i) {
+			if (strcmp(tok, keys[i].name) == 0 &&
+			    v >= keys[i].min && v <= keys[i].max) {
+				*(unsigned *)((char *)f + keys[i].offset) = v;
+				ok = true;
+			}
+		}
+	}
+	free(copy);
+	if (ok && f->bits != 16 && f->bits != 24 && f->bits != 32) {
+		ok = false;
+	}
+	if (!ok) {
+		errno = EINVAL;
+	}
+	return ok;
+}
+
+static void
+meter_decode(unsigned bits, const uint8_t *restrict src, float *restrict dst,
+    size_t n)
+{
+	size_t i;
+
+	switch (bits) {
+	case 16:
+		for (i = 0; i < n; ++i) {
+			dst[i] = (int16_t)(src[2 * i] | src[2 * i + 1] << 8) *
+			    (1.0f / 32768.0f);
+		}
+		break;
+	case 24:
+		for (i = 0; i < n; ++i) {
+			dst[i] = (int32_t)((uint32_t)src[3 * i] << 8 |
+			    (uint32_t)src[3 * i + 1] << 16 |
+			    (uint32_t)src[3 * i + 2] << 24) *
+			    (1.0f / 2147483648.0f);
+		}
+		break;
+	case 32:
+		for (i = 0; i < n; ++i) {
+			dst[i] = (int32_t)((uint32_t)src[4 * i] |
+			    (uint32_t)src[4 * i + 1] << 8 |
+			    (uint32_t)src[4 * i + 2] << 16 |
+			    (uint32_t)src[4 * i + 3] << 24) *
+			    (1.0f / 2147483648.0f);
+		}
+		break;
+	}
+}
+
+static void
+meter_accumulate(const float *restrict s, size_t n, unsigned channels,
+    float *restrict peak, float *restrict sum)
+{
+	float lane_peak[METER_LANES] = {0}, lane_sum[METER_LANES] = {0};
+	size_t i = 0;
+	unsigned c;
+	float a;
+
+	for (c = 0; c < channels; ++c) {
+		peak[c] = sum[c] = 0;
+	}
+	if (METER_LANES % channels == 0) {
+		for (; i + METER_LANES <= n; i += METER_LANES) {
+			for (unsigned j = 0; j < METER_LANES; ++j) {
+				a = fabsf(s[i + j]);
+				lane_peak[j] = a > lane_peak[j] ? a : lane_peak[j];
+				lane_sum[j] += s[i + j] * s[i + j];
+			}
+		}
+		for (unsigned j = 0; j < METER_LANES; ++j) {
+			c = j % channels;
+			peak[c] = lane_peak[j] > peak[c] ? lane_peak[j] : peak[c];
+			sum[c] += lane_sum[j];
+		}
+	}
+	/* the rest, or everything for odd channel counts */
+	for (; i < n; ++i) {
+		c = i % channels;
+		a = fabsf(s[i]);
+		peak[c] = a > peak[c] ? a : peak[c];
+		sum[c] += s[i] * s[i];
+	}
+}
+
+static void
+meter_measure(struct meter *m)
+{
+	struct meter_levels *l = &m->work;
+	float sum[METER_CHANNELS];
+
+	meter_decode(m->fmt.bits, m->buf, m->samples,
+	    m->period_frames * m->fmt.channels);
+	meter_accumulate(m->samples, m->period_frames * m->fmt.channels,
+	    m->fmt.channels, l->peak, sum);
+	l->channels = m->fmt.channels;
+	for (unsigned c = 0; c < m->fmt.channels; ++c) {
+		l->rms[c] = sqrtf(sum[c] / m->period_frames);
+		if (l->peak[c] >= l->hold[c]) {
+			l->hold[c] = l->peak[c];
+			m->held[c] = m->fps;
+		} else if (m->held[c] > 0) {
+			m->held[c]--;
+		} else {
+			l->hold[c] *= m->decay;
+		}
+	}
+	pthread_mutex_lock(&m->lock);
+	m->levels = *l;
+	pthread_mutex_unlock(&m->lock);
+}
+
+static void
+meter_quiet(struct meter *m)
+{
+	memset(&m->work, 0, sizeof(m->work));
+	pthread_mutex_lock(&m->lock);
+	m->levels = m->work;
+	pthread_mutex_unlock(&m->lock);
+}
+
+static int
+meter_timeout(const struct timespec *next)
+{
+	struct timespec now;
+	long ms;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	ms = (next->tv_sec - now.tv_sec) * 1000 +
+	    (next->tv_nsec - now.tv_nsec + 999999) / 1000000;
+	return ms > 0 ? ms : 0;
+}
+
+static void
+meter_advance(struct timespec *next, long ns)
+{
+	next->tv_nsec += ns;
+	if (next->tv_nsec >= 1000000000L) {
+		next->tv_sec++;
+		next->tv_nsec -= 1000000000L;
+	}
+}
+
+static void *
+meter_run(void *arg)
+{
+	struct meter *m = arg;
+	struct pollfd pfd[2];
+	struct timespec next;
+	long period_ns = 1000000000L / m->fps;
+	bool idle = false;
+	ssize_t n;
+
+	clock_gettime(CLOCK_MONOTONIC, &next);
+	for (;;) {
+		pfd[0].fd = m->stop[0];
+		pfd[0].events = POLLIN;
+		/* pipes without a writer poll as hung up, so wait instead */
+		pfd[1].fd = m->paced || idle ? -1 : m->fd;
+		pfd[1].events = POLLIN;
+		if (poll(pfd, 2, m->paced || idle ? meter_timeout(&next) : -1)
+		    == -1 && errno != EINTR) {
+			break;
+		}
+		if (pfd[0].revents != 0) {
+			break;
+		}
+		if (m->paced || idle) {
+			if (meter_timeout(&next) > 0) {
+				continue;
+			}
+			meter_advance(&next, period_ns);
+			idle = false;
+		}
+		n = read(m->fd, m->buf + m->fill, m->period_bytes - m->fill);
+		if (n == -1 && (errno == EAGAIN || errno == EINTR)) {
+			continue;
+		}
+		if (n == -1) {
+			break;
+		}
+		if (n == 0) {
+			if (m->paced) {
+				lseek(m->fd, 0, SEEK_SET);
+				continue;
+			}
+			meter_quiet(m);
+			m->fill = 0;
+			clock_gettime(CLOCK_MONOTONIC, &next);
+			meter_advance(&next, period_ns);
+			idle = true;
+			continue;
+		}
+		if ((m->fill += n) < m->period_bytes) {
+			continue;
+		}
+		meter_measure(m);
+		m->fill = 0;
+	}
+	meter_quiet(m);
+	return NULL;
+}
+
+#ifdef __NetBSD__
+/*
+ * Ask the device for the format and take whatever it answers with, as
+ * long as it can be measured.
+ */
+static bool
+meter_setup_device(int fd, struct meter_format *f)
+{
+	struct audio_info info;
+
+	AUDIO_INITINFO(&info);
+	info.mode = AUMODE_RECORD;
+	info.record.sample_rate = f->rate;
+	info.record.channels = f->channels;
+	info.record.precision = f->bits;
+	info.record.encoding = AUDIO_ENCODING_SLINEAR_LE;
+	(void)ioctl(fd, AUDIO_SETINFO, &info);
+	if (ioctl(fd, AUDIO_GETINFO, &info) == -1) {
+		return false;
+	}
+	if (info.record.encoding != AUDIO_ENCODING_SLINEAR_LE ||
+	    (info.record.precision != 16 && info.record.precision != 32) ||
+	    info.record.channels < 1 ||
+	    info.record.channels > METER_CHANNELS) {
+		errno = EINVAL;
+		return false;
+	}
+	f->rate = info.record.sample_rate;
+	f->channels = info.record.channels;
+	f->bits = info.record.precision;
+	return true;
+}
+#endif
+
+static void
+meter_free(struct meter *m)
+{
+	int *fds[] = { &m->fd, &m->stop[0], &m->stop[1] };
+
+	for (size_t i = 0; i < sizeof(fds) / sizeof(fds[0]); ++i) {
+		if (*fds[i] != -1) {
+			close(*fds[i]);
+		}
+	}
+	pthread_mutex_destroy(&m->lock);
+	free(m->buf);
+	free(m->samples);
+	free(m);
+}
+
+struct meter *
+meter_open(const char *path, const struct meter_format *fmt, unsigned fps)
+{
+	struct meter *m;
+	struct stat st;
+	int error;
+
+	if ((m = calloc(1, sizeof(*m))) == NULL) {
+		return NULL;
+	}
+	m->fd = m->stop[0] = m->stop[1] = -1;
+	pthread_mutex_init(&m->lock, NULL);
+	m->fmt = *fmt;
+	m->fps = fps;
+	m->decay = powf(10.0f, -METER_DECAY_DB / 20.0f / fps);
+	if ((m->fd = open(path, O_RDONLY | O_NONBLOCK)) == -1 ||
+	    fstat(m->fd, &st) == -1) {
+		goto fail;
+	}
+	m->paced = S_ISREG(st.st_mode);
+#ifdef __NetBSD__
+	if (S_ISCHR(st.st_mode) && !meter_setup_device(m->fd, &m->fmt)) {
+		goto fail;
+	}
+#endif
+	m->period_frames = m->fmt.rate / fps;
+	m->period_bytes = m->period_frames * m->fmt.channels *
+	    (m->fmt.bits / 8);
+	m->buf = malloc(m->period_bytes);
+	m->samples = malloc(m->period_frames * m->fmt.channels *
+	    sizeof(*m->samples));
+	if (m->buf == NULL || m->samples == NULL || pipe(m->stop) == -1) {
+		goto fail;
+	}
+	if ((errno = pthread_create(&m->thread, NULL, meter_run, m)) != 0) {
+		goto fail;
+	}
+	m->running = true;
+	return m;
+fail:
+	error = errno;
+	meter_free(m);
+	errno = error;
+	return NULL;
+}
+
+void
+meter_levels(struct meter *m, struct meter_levels *l)
+{
+	pthread_mutex_lock(&m->lock);
+	*l = m->levels;
+	pthread_mutex_unlock(&m->lock);
+}
+
+/*
+ * Wake the metering thread to stop it.  Only interrupted writes are
+ * tried again: the pipe is never full, having nothing else written.
+ */
+static void
+meter_wake(int fd)
+{
+	while (write(fd, "", 1) == -1 && errno == EINTR) {
+		continue;
+	}
+}
+
+void
+meter_close(struct meter *m)
+{
+	if (m == NULL) {
+		return;
+	}
+	if (m->running) {
+		meter_wake(m->stop[1]);
+		pthread_join(m->thread, NULL);
+	}
+	meter_free(m);
+}
@@ -0,0 +1,68 @@
+/*
+ Copyright (c) 2019 Nia Alarie <nia@netbsd.org>
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions
+ are met:
+
+ 1. Redistributions of source code must retain the above copyright
+    notice, this list of conditions and the following disclaimer.
+ 2. Redistributions in binary form must reproduce the above copyright
+    notice, this list of conditions and the following disclaimer in the
+    documentation and/or other materials provided with the distribution.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef AIOMIXER_METER_H
+#define AIOMIXER_METER_H
+
+#include <stdbool.h>
+
+#define METER_CHANNELS	(8)
+
+/*
+ * Level meters.  A thread captures signed linear PCM from an audio
+ * device, or from a file or pipe standing in for one, and works out
+ * the peak and RMS level of each channel fps times a second, with a
+ * peak hold that decays after a second.  The caller takes snapshots
+ * of the latest levels with meter_levels() whenever it redraws.
+ *
+ * Files and pipes hold interleaved little-endian samples in the format
+ * given; devices are asked for it and may answer with another.
+ * Regular files are played at the sample rate and start over at the
+ * end.
+ */
+struct meter_format {
+	unsigned rate;
+	unsigned channels;
+	unsigned bits; /* 16, 24 (packed) or 32 */
+};
+
+struct meter_levels {
+	unsigned channels; /* 0 until the first samples */
+	/* linear, 1.0 being full scale */
+	float peak[METER_CHANNELS];
+	float rms[METER_CHANNELS];
+	float hold[METER_CHANNELS];
+};
+
+struct meter;
+
+bool meter_parse_format(struct meter_format *, const char *);
+struct meter *meter_open(const char *, const struct meter_format *, unsigned);
+void meter_levels(struct meter *, struct meter_levels *);
+void meter_close(struct meter *);
+
+#endif /* !AIOMIXER_METER_H */
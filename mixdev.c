@@ -0,0 +1,654 @@
+/*
+ Copyright (c) 2019 Nia Alarie <nia@netbsd.org>
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions
+ are met:
+
+ 1. Redistributions of source code must retain the above copyright
+    notice, this list of conditions and the following disclaimer.
+ 2. Redistributions in binary form must reproduce the above copyright
+    notice, this list of conditions and the following disclaimer in the
+    documentation and/or other materials provided with the distribution.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+/*
+ * The device layer: enumeration, naming and lookup of controls, and
+ * their values as last read or written.  See mixdev.h.
+ */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "mixdev.h"
+#include "names.h"
+
+#define MIXDEV_NAME_MAX	(3 * MAX_AUDIO_DEV_LEN + 3)
+#define MIXDEV_VALUE_MAX	(512)
+
+struct mixdev_control {
+	unsigned name_id; /* NAME_NONE for classes */
+	uint64_t read_ms; /* when value was last known, 0 if never */
+	mixer_ctrl_t value;
+};
+
+struct mixdev {
+	struct mixer *mixer;
+	struct mixer_devinfo *info; /* by index */
+	unsigned ninfo;
+	struct mixdev_control *controls; /* by index */
+	int *by_name; /* control by name id */
+	struct names names;
+};
+
+static uint64_t
+msec_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static bool
+valid_control(const struct mixdev *md, int dev)
+{
+	const struct mixer_devinfo *m;
+
+	if (dev < 0 || (unsigned)dev >= md->ninfo) {
+		return false;
+	}
+	m = &md->info[dev];
+	switch (m->type) {
+	case AUDIO_MIXER_ENUM:
+	case AUDIO_MIXER_SET:
+		return true;
+	case AUDIO_MIXER_VALUE:
+		return m->un.v.num_channels >= 1 &&
+		    m->un.v.num_channels <= MIXER_MAX_CHANNELS;
+	}
+	return false;
+}
+
+static const struct mixer_devinfo *
+class_of(const struct mixdev *md, const struct mixer_devinfo *m)
+{
+	if (m->mixer_class < 0 || (unsigned)m->mixer_class >= md->ninfo ||
+	    md->info[m->mixer_class].type != AUDIO_MIXER_CLASS) {
+		return NULL;
+	}
+	return &md->info[m->mixer_class];
+}
+
+/*
+ * The control a chain through prev starts from, bounded in case a
+ * driver gets prev wrong.
+ */
+static const struct mixer_devinfo *
+root_of(const struct mixdev *md, const struct mixer_devinfo *m)
+{
+	const struct mixer_devinfo *root = NULL;
+	int prev = m->prev;
+
+	for (unsigned steps = 0; valid_control(md, prev) && steps < md->ninfo;
+	    ++steps) {
+		root = &md->info[prev];
+		prev = root->prev;
+	}
+	return root;
+}
+
+/*
+ * Names are built once, as mixerctl(1) prints them.  Controls outside
+ * any class have none, and cannot be looked up.
+ */
+static bool
+name_controls(struct mixdev *md)
+{
+	char name[MIXDEV_NAME_MAX];
+	const struct mixer_devinfo *m, *class, *root;
+	unsigned id;
+
+	for (unsigned i = 0; i < md->ninfo; ++i) {
+		md->by_name[i] = -1;
+		md->controls[i].name_id = NAME_NONE;
+	}
+	for (unsigned i = 0; i < md->ninfo; ++i) {
+		m = &md->info[i];
+		if (!valid_control(md, i) || (class = class_of(md, m)) == NULL) {
+			continue;
+		}
+		if ((root = root_of(md, m)) != NULL) {
+			snprintf(name, sizeof(name), "%.*s.%.*s.%.*s",
+			    MAX_AUDIO_DEV_LEN, class->label.name,
+			    MAX_AUDIO_DEV_LEN, root->label.name,
+			    MAX_AUDIO_DEV_LEN, m->label.name);
+		} else {
+			snprintf(name, sizeof(name), "%.*s.%.*s",
+			    MAX_AUDIO_DEV_LEN, class->label.name,
+			    MAX_AUDIO_DEV_LEN, m->label.name);
+		}
+		if ((id = names_intern(&md->names, name)) == NAME_NONE) {
+			return false;
+		}
+		md->controls[i].name_id = id;
+		/* the first of several controls of the same name is found */
+		if (md->by_name[id] == -1) {
+			md->by_name[id] = i;
+		}
+	}
+	return true;
+}
+
+/*
+ * Take over mixer and info, its enumerated controls.  Returns NULL with
+ * errno set, and neither taken over, if out of memory.
+ */
+struct mixdev *
+mixdev_new(struct mixer *mixer, struct mixer_devinfo *info, unsigned ninfo)
+{
+	struct mixdev *md;
+
+	if ((md = calloc(1, sizeof(*md))) == NULL) {
+		return NULL;
+	}
+	md->info = info;
+	md->ninfo = ninfo;
+	md->controls = calloc(ninfo + 1, sizeof(*md->controls));
+	md->by_name = calloc(ninfo + 1, sizeof(*md->by_name));
+	if (md->controls == NULL || md->by_name == NULL ||
+	    !name_controls(md)) {
+		names_free(&md->names);
+		free(md->controls);
+		free(md->by_name);
+		free(md);
+		errno = ENOMEM;
+		return NULL;
+	}
+	for (unsigned i = 0; i < ninfo; ++i) {
+		md->controls[i].value.dev = i;
+		md->controls[i].value.type = info[i].type;
+		if (valid_control(md, i) && info[i].type == AUDIO_MIXER_VALUE) {
+			md->controls[i].value.un.value.num_channels =
+			    info[i].un.v.num_channels;
+		}
+	}
+	md->mixer = mixer;
+	return md;
+}
+
+/*
+ * Enumerate mixer and take it over.  Returns NULL with errno set, and
+ * mixer left to the caller, on failure.
+ */
+struct mixdev *
+mixdev_open(struct mixer *mixer)
+{
+	struct mixer_devinfo *info;
+	struct mixdev *md;
+	unsigned ninfo;
+	int error;
+
+	if (mixer_enumerate(mixer, &info, &ninfo) == -1) {
+		return NULL;
+	}
+	if ((md = mixdev_new(mixer, info, ninfo)) == NULL) {
+		error = errno;
+		free(info);
+		errno = error;
+	}
+	return md;
+}
+
+void
+mixdev_close(struct mixdev *md)
+{
+	if (md == NULL) {
+		return;
+	}
+	mixer_close(md->mixer);
+	names_free(&md->names);
+	free(md->controls);
+	free(md->by_name);
+	free(md->info);
+	free(md);
+}
+
+struct mixer *
+mixdev_mixer(const struct mixdev *md)
+{
+	return md->mixer;
+}
+
+/*
+ * Carry on with the same controls through another mixer, as when a
+ * device comes back or is wrapped anew, closing the old one.  Nothing
+ * read through the old one is trusted any more.
+ */
+void
+mixdev_set_mixer(struct mixdev *md, struct mixer *mixer)
+{
+	if (mixer != md->mixer) {
+		mixer_close(md->mixer);
+		md->mixer = mixer;
+	}
+	mixdev_invalidate(md);
+}
+
+/*
+ * Controls are indexed from 0 up to this, classes included.
+ */
+unsigned
+mixdev_count(const struct mixdev *md)
+{
+	return md->ninfo;
+}
+
+const struct mixer_devinfo *
+mixdev_info(const struct mixdev *md, int dev)
+{
+	if (dev < 0 || (unsigned)dev >= md->ninfo) {
+		return NULL;
+	}
+	return &md->info[dev];
+}
+
+/*
+ * The name of a control, or NULL for classes and controls without one.
+ */
+const char *
+mixdev_name(const struct mixdev *md, int dev)
+{
+	if (dev < 0 || (unsigned)dev >= md->ninfo ||
+	    md->controls[dev].name_id == NAME_NONE) {
+		return NULL;
+	}
+	return names_get(&md->names, md->controls[dev].name_id);
+}
+
+/*
+ * The index of the control called name, or -1 with errno set to ENOENT.
+ */
+int
+mixdev_find(const struct mixdev *md, const char *name)
+{
+	unsigned id = names_lookup(&md->names, name);
+
+	if (id == NAME_NONE) {
+		errno = ENOENT;
+		return -1;
+	}
+	return md->by_name[id];
+}
+
+/*
+ * Whether a control is the on/off mute of a chain, such as
+ * outputs.master.mute.
+ */
+bool
+mixdev_is_mute(const struct mixdev *md, int dev)
+{
+	return valid_control(md, dev) &&
+	    md->info[dev].type == AUDIO_MIXER_ENUM &&
+	    strncmp(md->info[dev].label.name, "mute", MAX_AUDIO_DEV_LEN) == 0;
+}
+
+/*
+ * Whether the last known value of a control was read or written less
+ * than max_age milliseconds ago.
+ */
+bool
+mixdev_fresh(const struct mixdev *md, int dev, unsigned max_age)
+{
+	return valid_control(md, dev) && md->controls[dev].read_ms != 0 &&
+	    msec_now() - md->controls[dev].read_ms < max_age;
+}
+
+/*
+ * The last known value of a control, however old, or NULL if there is
+ * no such control.  It stays where it is until mixdev_close(), and
+ * holds zero until first read.
+ */
+const mixer_ctrl_t *
+mixdev_value(const struct mixdev *md, int dev)
+{
+	if (!valid_control(md, dev)) {
+		return NULL;
+	}
+	return &md->controls[dev].value;
+}
+
+/*
+ * Read a control from the device into its last known value, and into
+ * ctrl unless NULL.
+ */
+int
+mixdev_read(struct mixdev *md, int dev, mixer_ctrl_t *ctrl)
+{
+	struct mixdev_control *c;
+	mixer_ctrl_t value = {0};
+
+	if (!valid_control(md, dev)) {
+		errno = EINVAL;
+		return -1;
+	}
+	c = &md->controls[dev];
+	value.dev = dev;
+	value.type = md->info[dev].type;
+	if (value.type == AUDIO_MIXER_VALUE) {
+		value.un.value.num_channels = md->info[dev].un.v.num_channels;
+	}
+	if (mixer_read(md->mixer, &value) == -1) {
+		return -1;
+	}
+	c->value = value;
+	c->read_ms = msec_now();
+	if (ctrl != NULL) {
+		*ctrl = value;
+	}
+	return 0;
+}
+
+/*
+ * The value of a control, from the device only if the last known one
+ * is older than max_age milliseconds.
+ */
+int
+mixdev_get(struct mixdev *md, int dev, unsigned max_age, mixer_ctrl_t *ctrl)
+{
+	if (mixdev_fresh(md, dev, max_age)) {
+		*ctrl = md->controls[dev].value;
+		return 0;
+	}
+	return mixdev_read(md, dev, ctrl);
+}
+
+/*
+ * Read every control whose last known value is older than max_age
+ * milliseconds, back to back.  Returns the number read, or -1 with
+ * errno set as for the last failure if any failed, the others being
+ * read all the same.
+ */
+int
+mixdev_read_all(struct mixdev *md, unsigned max_age)
+{
+	int n = 0, error = 0;
+
+	for (unsigned i = 0; i < md->ninfo; ++i) {
+		if (!valid_control(md, i) || mixdev_fresh(md, i, max_age)) {
+			continue;
+		}
+		if (mixdev_read(md, i, NULL) == -1) {
+			error = errno;
+			continue;
+		}
+		n++;
+	}
+	if (error != 0) {
+		errno = error;
+		return -1;
+	}
+	return n;
+}
+
+/*
+ * Write a control, which then becomes its last known value.
+ */
+int
+mixdev_write(struct mixdev *md, const mixer_ctrl_t *ctrl)
+{
+	mixer_ctrl_t value = *ctrl;
+
+	if (!valid_control(md, ctrl->dev) ||
+	    ctrl->type != md->info[ctrl->dev].type) {
+		errno = EINVAL;
+		return -1;
+	}
+	if (mixer_write(md->mixer, &value) == -1) {
+		return -1;
+	}
+	mixdev_store(md, ctrl);
+	return 0;
+}
+
+/*
+ * Take a value written to the device some other way as a control's last
+ * known one.
+ */
+void
+mixdev_store(struct mixdev *md, const mixer_ctrl_t *ctrl)
+{
+	if (!valid_control(md, ctrl->dev) ||
+	    ctrl->type != md->info[ctrl->dev].type) {
+		return;
+	}
+	md->controls[ctrl->dev].value = *ctrl;
+	md->controls[ctrl->dev].read_ms = msec_now();
+}
+
+/*
+ * Forget the last known value of a control, as when a write that had
+ * been taken for made turns out to have failed.
+ */
+void
+mixdev_forget(struct mixdev *md, int dev)
+{
+	if (dev >= 0 && (unsigned)dev < md->ninfo) {
+		md->controls[dev].read_ms = 0;
+	}
+}
+
+/*
+ * Forget every last known value, as when the device may have been
+ * changed behind our back.
+ */
+void
+mixdev_invalidate(struct mixdev *md)
+{
+	for (unsigned i = 0; i < md->ninfo; ++i) {
+		md->controls[i].read_ms = 0;
+	}
+}
+
+bool
+mixdev_same(const mixer_ctrl_t *a, const mixer_ctrl_t *b)
+{
+	if (a->type != b->type) {
+		return false;
+	}
+	switch (a->type) {
+	case AUDIO_MIXER_ENUM:
+		return a->un.ord == b->un.ord;
+	case AUDIO_MIXER_SET:
+		return a->un.mask == b->un.mask;
+	case AUDIO_MIXER_VALUE:
+		return a->un.value.num_channels == b->un.value.num_channels &&
+		    a->un.value.num_channels >= 0 &&
+		    a->un.value.num_channels <= MIXER_MAX_CHANNELS &&
+		    memcmp(a->un.value.level, b->un.value.level,
+		    a->un.value.num_channels * sizeof(a->un.value.level[0])) == 0;
+	}
+	return false;
+}
+
+/*
+ * The value of a control as mixerctl(1) prints it, read as by
+ * mixdev_get().  Returns the length written as snprintf(3) would.
+ */
+int
+mixdev_format(struct mixdev *md, int dev, unsigned max_age, char *buf,
+    size_t size)
+{
+	mixer_ctrl_t value;
+
+	if (mixdev_get(md, dev, max_age, &value) == -1) {
+		return -1;
+	}
+	return preset_format_value(&md->info[dev], &value, buf, size);
+}
+
+/*
+ * Print every named control as name=value, in index order, as
+ * mixerctl -a does and presets_load_conf() reads back.  Values are read
+ * as by mixdev_get().  Controls that cannot be read are left out, and
+ * -1 returned with errno set in the end.
+ */
+int
+mixdev_snapshot(struct mixdev *md, unsigned max_age, FILE *fp)
+{
+	char buf[MIXDEV_VALUE_MAX];
+	const char *name;
+	int error = 0;
+
+	for (unsigned i = 0; i < md->ninfo; ++i) {
+		if ((name = mixdev_name(md, i)) == NULL) {
+			continue;
+		}
+		if (mixdev_format(md, i, max_age, buf, sizeof(buf)) == -1) {
+			error = errno;
+			continue;
+		}
+		fprintf(fp, "%s=%s\n", name, buf);
+	}
+	if (error != 0) {
+		errno = error;
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Where a change goes in the order mixdev_apply() writes them in, so
+ * that nothing gets loud on the way: muting first, then lowering
+ * levels, then selectors, then raising levels, and unmuting last.
+ */
+static int
+apply_phase(const struct mixdev *md, const mixer_ctrl_t *before,
+    const mixer_ctrl_t *after)
+{
+	const struct mixer_devinfo *m = &md->info[after->dev];
+	int delta = 0;
+
+	if (mixdev_is_mute(md, after->dev)) {
+		for (int i = 0; i < m->un.e.num_mem; ++i) {
+			if (m->un.e.member[i].ord == after->un.ord) {
+				return strncmp(m->un.e.member[i].label.name,
+				    "on", MAX_AUDIO_DEV_LEN) == 0 ? 0 : 4;
+			}
+		}
+		return 4;
+	}
+	if (m->type != AUDIO_MIXER_VALUE) {
+		return 2;
+	}
+	for (int i = 0; i < after->un.value.num_channels; ++i) {
+		delta += after->un.value.level[i] - before->un.value.level[i];
+	}
+	return delta < 0 ? 1 : 3;
+}
+
+/*
+ * Apply a preset in one go, only writing the controls whose values
+ * differ from their last known ones, which are read from the device
+ * only if older than max_age milliseconds, as by mixdev_get().  fn,
+ * unless NULL, is told about every change and failure.  Returns the
+ * number of controls changed, or -1 with errno set if any setting could
+ * not be applied, the others being applied all the same.
+ */
+int
+mixdev_apply(struct mixdev *md, const struct preset *preset,
+    unsigned max_age, mixdev_apply_fn fn, void *arg)
+{
+	const struct preset_setting *s;
+	struct {
+		const struct preset_setting *setting;
+		mixer_ctrl_t before, after;
+		int phase;
+	} *changes;
+	mixer_ctrl_t value;
+	unsigned i, n = 0, changed = 0;
+	int dev, error = 0;
+
+	if ((changes = calloc(preset->nsettings + 1, sizeof(*changes))) == NULL) {
+		return -1;
+	}
+	for (i = 0; i < preset->nsettings; ++i) {
+		s = &preset->settings[i];
+		if ((dev = mixdev_find(md, s->name)) == -1 ||
+		    preset_parse_value(&md->info[dev], s->value, &value) == -1) {
+			error = errno;
+			if (fn != NULL) {
+				fn(arg, s, NULL, NULL, error);
+			}
+			continue;
+		}
+		/* a later setting of the same control wins */
+		for (unsigned j = 0; j < n; ++j) {
+			if (changes[j].after.dev == dev) {
+				memmove(&changes[j], &changes[j + 1],
+				    (n - j - 1) * sizeof(*changes));
+				n--;
+				break;
+			}
+		}
+		if (mixdev_get(md, dev, max_age, &changes[n].before) == -1) {
+			error = errno;
+			if (fn != NULL) {
+				fn(arg, s, NULL, &value, error);
+			}
+			continue;
+		}
+		if (!mixdev_same(&changes[n].before, &value)) {
+			changes[n].setting = s;
+			changes[n].after = value;
+			changes[n].phase = apply_phase(md, &changes[n].before,
+			    &value);
+			n++;
+		}
+	}
+	for (int phase = 0; phase <= 4; ++phase) {
+		for (i = 0; i < n; ++i) {
+			if (changes[i].phase != phase) {
+				continue;
+			}
+			if (mixdev_write(md, &changes[i].after) == -1) {
+				error = errno;
+				if (fn != NULL) {
+					fn(arg, changes[i].setting, NULL,
+					    &changes[i].after, error);
+				}
+				continue;
+			}
+			if (fn != NULL) {
+				fn(arg, changes[i].setting, &changes[i].before,
+				    &changes[i].after, 0);
+			}
+			changed++;
+		}
+	}
+	free(changes);
+	if (error != 0) {
+		errno = error;
+		return -1;
+	}
+	return changed;
+}
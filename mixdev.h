@@ -0,0 +1,96 @@
+/*
+ Copyright (c) 2019 Nia Alarie <nia@netbsd.org>
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions
+ are met:
+
+ 1. Redistributions of source code must retain the above copyright
+    notice, this list of conditions and the following disclaimer.
+ 2. Redistributions in binary form must reproduce the above copyright
+    notice, this list of conditions and the following disclaimer in the
+    documentation and/or other materials provided with the distribution.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef AIOMIXER_MIXDEV_H
+#define AIOMIXER_MIXDEV_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "mixer.h"
+#include "preset.h"
+
+/*
+ * The device layer of libaiomixer, which aiomixer's interface is built
+ * on and which other programs can link instead of enumerating devices
+ * themselves.  It has no terminal or curses dependency.
+ *
+ * A mixdev is an enumerated mixer device: the description of each
+ * control, its name as mixerctl(1) prints it (class.label, or
+ * class.root.label for controls chained to a root), and its last known
+ * value with when that was read.  Controls are addressed by their
+ * index in the device, as in mixer_devinfo and mixer_ctrl_t.
+ *
+ * Functions returning int answer 0 (or a count) on success and -1 with
+ * errno set on failure, as the mixer backends do.  The version goes up
+ * with every incompatible change to these declarations.
+ */
+#define MIXDEV_API_VERSION	(2)
+
+struct mixdev;
+
+/*
+ * Told about each setting as mixdev_apply() goes.  error is 0 for a
+ * control changed from before to after.  Otherwise the setting failed:
+ * ENOENT if no control has its name, EINVAL if its value does not fit
+ * the control, both with before and after NULL, or the error from the
+ * device with after the value that could not be written.
+ */
+typedef void (*mixdev_apply_fn)(void *, const struct preset_setting *,
+    const mixer_ctrl_t *, const mixer_ctrl_t *, int);
+
+struct mixdev *mixdev_open(struct mixer *);
+struct mixdev *mixdev_new(struct mixer *, struct mixer_devinfo *, unsigned);
+void mixdev_close(struct mixdev *);
+struct mixer *mixdev_mixer(const struct mixdev *);
+void mixdev_set_mixer(struct mixdev *, struct mixer *);
+
+unsigned mixdev_count(const struct mixdev *);
+const struct mixer_devinfo *mixdev_info(const struct mixdev *, int);
+const char *mixdev_name(const struct mixdev *, int);
+int mixdev_find(const struct mixdev *, const char *);
+bool mixdev_is_mute(const struct mixdev *, int);
+
+bool mixdev_fresh(const struct mixdev *, int, unsigned);
+const mixer_ctrl_t *mixdev_value(const struct mixdev *, int);
+int mixdev_get(struct mixdev *, int, unsigned, mixer_ctrl_t *);
+int mixdev_read(struct mixdev *, int, mixer_ctrl_t *);
+int mixdev_read_all(struct mixdev *, unsigned);
+int mixdev_write(struct mixdev *, const mixer_ctrl_t *);
+void mixdev_store(struct mixdev *, const mixer_ctrl_t *);
+void mixdev_forget(struct mixdev *, int);
+void mixdev_invalidate(struct mixdev *);
+bool mixdev_same(const mixer_ctrl_t *, const mixer_ctrl_t *);
+
+int mixdev_format(struct mixdev *, int, unsigned, char *, size_t);
+int mixdev_snapshot(struct mixdev *, unsigned, FILE *);
+int mixdev_apply(struct mixdev *, const struct preset *, unsigned,
+    mixdev_apply_fn, void *);
+
+#endif /* !AIOMIXER_MIXDEV_H */
@@ -0,0 +1,382 @@
+/*
+ Copyright (c) 2019 Nia Alarie <nia@netbsd.org>
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions
+ are met:
+
+ 1. Redistributions of source code must retain the above copyright
+    notice, this list of conditions and the following disclaimer.
+ 2. Redistributions in binary form must reproduce the above copyright
+    notice, this list of conditions and the following disclaimer in the
+    documentation and/or other materials provided with the distribution.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/ioctl.h>
+
+#include "mixer.h"
+#include "probes.h"
+
+/*
+ * USB devices in particular fail the odd request with EIO and then
+ * carry on; retry those a few times before reporting the error.
+ */
+#define MIXER_RETRIES	(3)
+
+struct mixer *
+mixer_new(const struct mixer_ops *ops, void *cookie)
+{
+	struct mixer *mixer;
+
+	if ((mixer = calloc(1, sizeof(*mixer))) == NULL) {
+		return NULL;
+	}
+	mixer->ops = ops;
+	mixer->cookie = cookie;
+	return mixer;
+}
+
+void
+mixer_close(struct mixer *mixer)
+{
+	if (mixer == NULL) {
+		return;
+	}
+	mixer->ops->close(mixer->cookie);
+	free(mixer);
+}
+
+/*
+ * The hardware backend: the cookie is simply the file descriptor.
+ */
+#ifdef __NetBSD__
+static int
+hw_devinfo(void *cookie, struct mixer_devinfo *m)
+{
+	return ioctl(*(int *)cookie, AUDIO_MIXER_DEVINFO, m);
+}
+
+static int
+hw_read(void *cookie, mixer_ctrl_t *dev)
+{
+	return ioctl(*(int *)cookie, AUDIO_MIXER_READ, dev);
+}
+
+static int
+hw_write(void *cookie, mixer_ctrl_t *dev)
+{
+	return ioctl(*(int *)cookie, AUDIO_MIXER_WRITE, dev);
+}
+
+static void
+hw_close(void *cookie)
+{
+	close(*(int *)cookie);
+	free(cookie);
+}
+
+static const struct mixer_ops hw_ops = {
+	.devinfo = hw_devinfo,
+	.read = hw_read,
+	.write = hw_write,
+	.close = hw_close,
+};
+
+struct mixer *
+mixer_open(const char *path)
+{
+	struct mixer *mixer;
+	int fd, *fdp;
+
+	if ((fdp = malloc(sizeof(*fdp))) == NULL) {
+		return NULL;
+	}
+	if ((fd = open(path, O_RDWR)) == -1) {
+		free(fdp);
+		return NULL;
+	}
+	*fdp = fd;
+	if ((mixer = mixer_new(&hw_ops, fdp)) == NULL) {
+		close(fd);
+		free(fdp);
+	}
+	return mixer;
+}
+#else
+struct mixer *
+mixer_open(const char *path)
+{
+	(void)path;
+	errno = ENOTSUP;
+	return NULL;
+}
+#endif
+
+/*
+ * What a device is replaced with once it has gone away: every request
+ * fails with ENXIO.
+ */
+static int
+detached_devinfo(void *cookie, struct mixer_devinfo *m)
+{
+	(void)cookie; /* unused */
+	(void)m; /* unused */
+	errno = ENXIO;
+	return -1;
+}
+
+static int
+detached_ctrl(void *cookie, mixer_ctrl_t *dev)
+{
+	(void)cookie; /* unused */
+	(void)dev; /* unused */
+	errno = ENXIO;
+	return -1;
+}
+
+static void
+detached_close(void *cookie)
+{
+	(void)cookie; /* unused */
+}
+
+static const struct mixer_ops detached_ops = {
+	.devinfo = detached_devinfo,
+	.read = detached_ctrl,
+	.write = detached_ctrl,
+	.close = detached_close,
+};
+
+struct mixer *
+mixer_detached(void)
+{
+	return mixer_new(&detached_ops, NULL);
+}
+
+static unsigned long long
+usec_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void
+account(struct mixer *mixer, enum mixer_request req, int ret,
+    unsigned long long start)
+{
+	mixer->stats.count[req]++;
+	mixer->stats.usec[req] += usec_now() - start;
+	if (ret == -1) {
+		mixer->stats.errors[req]++;
+	}
+}
+
+static bool
+transient(struct mixer *mixer, int ret, int *tries)
+{
+	if (ret != -1 || (errno != EIO && errno != EAGAIN) ||
+	    mixer->inner != NULL || ++*tries == MIXER_RETRIES) {
+		return false;
+	}
+	mixer->stats.retries++;
+	return true;
+}
+
+int
+mixer_get_devinfo(struct mixer *mixer, struct mixer_devinfo *m)
+{
+	unsigned long long start = usec_now();
+	int ret, tries = 0;
+
+	PROBE1(mixer__devinfo__start, m->index);
+	do {
+		ret = mixer->ops->devinfo(mixer->cookie, m);
+	} while (transient(mixer, ret, &tries));
+	PROBE2(mixer__devinfo__done, m->index, ret);
+	account(mixer, MIXER_DEVINFO, ret, start);
+	return ret;
+}
+
+int
+mixer_read(struct mixer *mixer, mixer_ctrl_t *dev)
+{
+	unsigned long long start = usec_now();
+	int ret, tries = 0;
+
+	PROBE2(mixer__read__start, dev->dev, dev->type);
+	do {
+		ret = mixer->ops->read(mixer->cookie, dev);
+	} while (transient(mixer, ret, &tries));
+	PROBE2(mixer__read__done, dev->dev, ret);
+	account(mixer, MIXER_READ, ret, start);
+	return ret;
+}
+
+int
+mixer_write(struct mixer *mixer, mixer_ctrl_t *dev)
+{
+	unsigned long long start = usec_now();
+	int ret, tries = 0;
+
+	PROBE2(mixer__write__start, dev->dev, dev->type);
+	do {
+		ret = mixer->ops->write(mixer->cookie, dev);
+	} while (transient(mixer, ret, &tries));
+	PROBE2(mixer__write__done, dev->dev, ret);
+	account(mixer, MIXER_WRITE, ret, start);
+	return ret;
+}
+
+/*
+ * Fetch the description of every control, in index order, into a
+ * malloc'd array.  The end of the list is the first index answered
+ * with ENXIO or EINVAL; any other failure fails the whole enumeration
+ * rather than returning part of it.
+ */
+int
+mixer_enumerate(struct mixer *mixer, struct mixer_devinfo **info,
+    unsigned *ninfo)
+{
+	struct mixer_devinfo *m = NULL, *grown;
+	unsigned n = 0, size = 0;
+	int error;
+
+	for (;;) {
+		if (n == size) {
+			size = size ? size * 2 : 32;
+			if ((grown = realloc(m, size * sizeof(*m))) == NULL) {
+				free(m);
+				return -1;
+			}
+			m = grown;
+		}
+		memset(&m[n], 0, sizeof(m[n]));
+		m[n].index = n;
+		if (mixer_get_devinfo(mixer, &m[n]) == -1) {
+			if (errno == ENXIO || errno == EINVAL) {
+				break;
+			}
+			error = errno;
+			free(m);
+			errno = error;
+			return -1;
+		}
+		n++;
+	}
+	*info = m;
+	*ninfo = n;
+	return 0;
+}
+
+static uint64_t
+fnv(uint64_t h, const void *p, size_t len)
+{
+	const unsigned char *c = p;
+
+	while (len-- > 0) {
+		h = (h ^ *c++) * 0x100000001b3ULL;
+	}
+	return h;
+}
+
+static uint64_t
+fnv_int(uint64_t h, int v)
+{
+	return fnv(h, &v, sizeof(v));
+}
+
+static uint64_t
+fnv_name(uint64_t h, const audio_mixer_name_t *name)
+{
+	return fnv(h, name->name, strnlen(name->name, MAX_AUDIO_DEV_LEN) + 1);
+}
+
+/*
+ * A hash of everything a device says about its controls, to tell
+ * whether a device that reappeared is still the same.
+ */
+uint64_t
+mixer_fingerprint(const struct mixer_devinfo *info, unsigned ninfo)
+{
+	const struct mixer_devinfo *m;
+	uint64_t h = 0xcbf29ce484222325ULL;
+
+	h = fnv_int(h, ninfo);
+	for (unsigned i = 0; i < ninfo; ++i) {
+		m = &info[i];
+		h = fnv_int(h, m->index);
+		h = fnv_int(h, m->type);
+		h = fnv_int(h, m->mixer_class);
+		h = fnv_int(h, m->next);
+		h = fnv_int(h, m->prev);
+		h = fnv_name(h, &m->label);
+		switch (m->type) {
+		case AUDIO_MIXER_ENUM:
+			for (int j = 0; j < m->un.e.num_mem; ++j) {
+				h = fnv_name(h, &m->un.e.member[j].label);
+				h = fnv_int(h, m->un.e.member[j].ord);
+			}
+			break;
+		case AUDIO_MIXER_SET:
+			for (int j = 0; j < m->un.s.num_mem; ++j) {
+				h = fnv_name(h, &m->un.s.member[j].label);
+				h = fnv_int(h, m->un.s.member[j].mask);
+			}
+			break;
+		case AUDIO_MIXER_VALUE:
+			h = fnv_name(h, &m->un.v.units);
+			h = fnv_int(h, m->un.v.num_channels);
+			h = fnv_int(h, m->un.v.delta);
+			break;
+		}
+	}
+	return h;
+}
+
+/*
+ * Request counters as name=value lines, for benchmarks to pick up.
+ */
+void
+mixer_print_stats(struct mixer *mixer, FILE *fp)
+{
+	static const char *names[MIXER_NREQUESTS] = {
+		"devinfo", "read", "write"
+	};
+
+	/* what reached the device */
+	while (mixer->inner != NULL) {
+		mixer = mixer->inner;
+	}
+	for (int i = 0; i < MIXER_NREQUESTS; ++i) {
+		fprintf(fp, "mixer.%s.count=%lu\n", names[i],
+		    mixer->stats.count[i]);
+		fprintf(fp, "mixer.%s.errors=%lu\n", names[i],
+		    mixer->stats.errors[i]);
+		fprintf(fp, "mixer.%s.usec=%llu\n", names[i],
+		    mixer->stats.usec[i]);
+	}
+	fprintf(fp, "mixer.retries=%lu\n", mixer->stats.retries);
+}
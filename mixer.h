@@ -0,0 +1,105 @@
+/*
+ Copyright (c) 2019 Nia Alarie <nia@netbsd.org>
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions
+ are met:
+
+ 1. Redistributions of source code must retain the above copyright
+    notice, this list of conditions and the following disclaimer.
+ 2. Redistributions in binary form must reproduce the above copyright
+    notice, this list of conditions and the following disclaimer in the
+    documentation and/or other materials provided with the distribution.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef AIOMIXER_MIXER_H
+#define AIOMIXER_MIXER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#ifdef __NetBSD__
+#include <sys/audioio.h>
+#else
+#include "audioio_compat.h"
+#endif
+
+/* the most levels a mixer_ctrl_t carries */
+#define MIXER_MAX_CHANNELS \
+	((int)(sizeof(((mixer_ctrl_t *)0)->un.value.level) / \
+	    sizeof(((mixer_ctrl_t *)0)->un.value.level[0])))
+
+/*
+ * A mixer device.  Every backend answers the three mixer ioctls with
+ * ioctl(2) semantics: 0 on success, -1 with errno set on failure.
+ */
+struct mixer_ops {
+	int (*devinfo)(void *, struct mixer_devinfo *);
+	int (*read)(void *, mixer_ctrl_t *);
+	int (*write)(void *, mixer_ctrl_t *);
+	void (*close)(void *);
+};
+
+enum mixer_request {
+	MIXER_DEVINFO,
+	MIXER_READ,
+	MIXER_WRITE,
+	MIXER_NREQUESTS
+};
+
+struct mixer_stats {
+	unsigned long count[MIXER_NREQUESTS];
+	unsigned long errors[MIXER_NREQUESTS];
+	unsigned long long usec[MIXER_NREQUESTS];
+	unsigned long retries;
+};
+
+struct mixer {
+	const struct mixer_ops *ops;
+	void *cookie;
+	struct mixer_stats stats;
+	/*
+	 * For wrappers that pass their requests on with mixer_read() and
+	 * mixer_write(): the mixer wrapped, which retries them and whose
+	 * stats are the ones printed.
+	 */
+	struct mixer *inner;
+};
+
+struct mixer *mixer_new(const struct mixer_ops *, void *);
+struct mixer *mixer_open(const char *);
+struct mixer *mixer_open_replay(const char *);
+struct mixer *mixer_open_sim(const char *);
+struct mixer *mixer_record(struct mixer *, const char *);
+struct mixer *mixer_reconnect(struct mixer *, struct mixer *(*)(const char *),
+    const char *, bool);
+int mixer_reconnect_detach(struct mixer *);
+int mixer_reconnect_attach(struct mixer *, struct mixer *);
+struct mixer *mixer_detached(void);
+struct mixer *mixer_publish(struct mixer *, const char *);
+struct mixer *mixer_throttle(struct mixer *, unsigned);
+int mixer_throttle_flush(struct mixer *, int *);
+void mixer_close(struct mixer *);
+
+int mixer_get_devinfo(struct mixer *, struct mixer_devinfo *);
+int mixer_enumerate(struct mixer *, struct mixer_devinfo **, unsigned *);
+uint64_t mixer_fingerprint(const struct mixer_devinfo *, unsigned);
+int mixer_read(struct mixer *, mixer_ctrl_t *);
+int mixer_write(struct mixer *, mixer_ctrl_t *);
+void mixer_print_stats(struct mixer *, FILE *);
+
+#endif /* !AIOMIXER_MIXER_H */
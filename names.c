@@ -0,0 +1,159 @@
+/*
+ Copyright (c) 2019 Nia Alarie <nia@netbsd.org>
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions
+ are met:
+
+ 1. Redistributions of source code must retain the above copyright
+    notice, this list of conditions and the following disclaimer.
+ 2. Redistributions in binary form must reproduce the above copyright
+    notice, this list of conditions and the following disclaimer in the
+    documentation and/or other materials provided with the distribution.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "names.h"
+
+/* FNV-1a */
+static uint32_t
+names_hash(const char *s)
+{
+	uint32_t h = 2166136261u;
+
+	while (*s != '\0') {
+		h ^= (unsigned char)*s++;
+		h *= 16777619u;
+	}
+	return h;
+}
+
+/*
+ * Open addressing with linear probing; slots hold id + 1, 0 is empty.
+ */
+static unsigned *
+names_slot(const struct names *t, const char *s)
+{
+	unsigned i, *slot;
+
+	if (t->hcap == 0) {
+		return NULL;
+	}
+	for (i = names_hash(s) & (t->hcap - 1);; i = (i + 1) & (t->hcap - 1)) {
+		slot = &t->hash[i];
+		if (*slot == 0 || strcmp(t->buf + t->offs[*slot - 1], s) == 0) {
+			return slot;
+		}
+	}
+}
+
+static bool
+names_rehash(struct names *t)
+{
+	unsigned *old = t->hash, oldcap = t->hcap, i, *slot;
+
+	t->hcap = oldcap ? oldcap * 2 : 64;
+	if ((t->hash = calloc(t->hcap, sizeof(*t->hash))) == NULL) {
+		t->hash = old;
+		t->hcap = oldcap;
+		return false;
+	}
+	for (i = 0; i < oldcap; ++i) {
+		if (old[i] != 0) {
+			slot = names_slot(t, t->buf + t->offs[old[i] - 1]);
+			*slot = old[i];
+		}
+	}
+	free(old);
+	return true;
+}
+
+unsigned
+names_add(struct names *t, const char *s)
+{
+	size_t len = strlen(s) + 1, cap, *offs;
+	unsigned ncap;
+	char *buf;
+
+	if (t->n == t->ncap) {
+		ncap = t->ncap ? t->ncap * 2 : 64;
+		if ((offs = realloc(t->offs, ncap * sizeof(*offs))) == NULL) {
+			return NAME_NONE;
+		}
+		t->offs = offs;
+		t->ncap = ncap;
+	}
+	if (t->len + len > t->cap) {
+		for (cap = t->cap; t->len + len > cap;) {
+			cap = cap ? cap * 2 : 1024;
+		}
+		if ((buf = realloc(t->buf, cap)) == NULL) {
+			return NAME_NONE;
+		}
+		t->buf = buf;
+		t->cap = cap;
+	}
+	memcpy(t->buf + t->len, s, len);
+	t->offs[t->n] = t->len;
+	t->len += len;
+	return t->n++;
+}
+
+unsigned
+names_intern(struct names *t, const char *s)
+{
+	unsigned *slot, id;
+
+	if ((t->nhashed + 1) * 2 > t->hcap && !names_rehash(t)) {
+		return NAME_NONE;
+	}
+	slot = names_slot(t, s);
+	if (*slot != 0) {
+		return *slot - 1;
+	}
+	if ((id = names_add(t, s)) != NAME_NONE) {
+		*slot = id + 1;
+		t->nhashed++;
+	}
+	return id;
+}
+
+unsigned
+names_lookup(const struct names *t, const char *s)
+{
+	unsigned *slot = names_slot(t, s);
+
+	return (slot == NULL || *slot == 0) ? NAME_NONE : *slot - 1;
+}
+
+const char *
+names_get(const struct names *t, unsigned id)
+{
+	return id < t->n ? t->buf + t->offs[id] : "";
+}
+
+void
+names_free(struct names *t)
+{
+	free(t->buf);
+	free(t->offs);
+	free(t->hash);
+	memset(t, 0, sizeof(*t));
+}
@@ -0,0 +1,56 @@
+/*
+ Copyright (c) 2019 Nia Alarie <nia@netbsd.org>
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions
+ are met:
+
+ 1. Redistributions of source code must retain the above copyright
+    notice, this list of conditions and the following disclaimer.
+ 2. Redistributions in binary form must reproduce the above copyright
+    notice, this list of conditions and the following disclaimer in the
+    documentation and/or other materials provided with the distribution.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef AIOMIXER_NAMES_H
+#define AIOMIXER_NAMES_H
+
+#include <stddef.h>
+
+#define NAME_NONE	((unsigned)-1)
+
+/*
+ * A table of strings built once at enumeration, addressed by small
+ * stable ids.  Interned strings are unique and can be looked up;
+ * added strings are not, but get consecutive ids.  Pointers returned
+ * by names_get() are only valid until the next string is added.
+ */
+struct names {
+	char *buf;
+	size_t len, cap;
+	size_t *offs;
+	unsigned n, ncap;
+	unsigned *hash;
+	unsigned hcap, nhashed;
+};
+
+unsigned names_add(struct names *, const char *);
+unsigned names_intern(struct names *, const char *);
+unsigned names_lookup(const struct names *, const char *);
+const char *names_get(const struct names *, unsigned);
+void names_free(struct names *);
+
+#endif /* !AIOMIXER_NAMES_H */
@@ -0,0 +1,426 @@
+/*
+ Copyright (c) 2019 Nia Alarie <nia@netbsd.org>
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions
+ are met:
+
+ 1. Redistributions of source code must retain the above copyright
+    notice, this list of conditions and the following disclaimer.
+ 2. Redistributions in binary form must reproduce the above copyright
+    notice, this list of conditions and the following disclaimer in the
+    documentation and/or other materials provided with the distribution.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <ctype.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "preset.h"
+
+#define PRESET_LINE_MAX	(512)
+
+static void *
+grow(void *p, unsigned *cap, unsigned want, size_t size)
+{
+	unsigned n = *cap ? *cap : 8;
+
+	if (want <= *cap) {
+		return p;
+	}
+	while (n < want) {
+		n *= 2;
+	}
+	if ((p = realloc(p, n * size)) != NULL) {
+		*cap = n;
+	}
+	return p;
+}
+
+static char *
+trim(char *s)
+{
+	char *end;
+
+	while (isspace((unsigned char)*s)) {
+		s++;
+	}
+	end = s + strlen(s);
+	while (end > s && isspace((unsigned char)end[-1])) {
+		end--;
+	}
+	*end = '\0';
+	return s;
+}
+
+static struct preset *
+preset_add(struct presets *p, const char *name)
+{
+	struct preset *list, *preset;
+
+	if ((list = grow(p->list, &p->cap, p->n + 1, sizeof(*list))) == NULL) {
+		return NULL;
+	}
+	p->list = list;
+	preset = &p->list[p->n];
+	memset(preset, 0, sizeof(*preset));
+	if ((preset->name = strdup(name)) == NULL) {
+		return NULL;
+	}
+	p->n++;
+	return preset;
+}
+
+static bool
+setting_add(struct preset *preset, const char *name, const char *value,
+    unsigned line)
+{
+	struct preset_setting *settings, *s;
+
+	settings = grow(preset->settings, &preset->cap, preset->nsettings + 1,
+	    sizeof(*settings));
+	if (settings == NULL) {
+		return false;
+	}
+	preset->settings = settings;
+	s = &preset->settings[preset->nsettings];
+	s->line = line;
+	s->name = strdup(name);
+	s->value = strdup(value);
+	if (s->name == NULL || s->value == NULL) {
+		free(s->name);
+		free(s->value);
+		return false;
+	}
+	preset->nsettings++;
+	return true;
+}
+
+/*
+ * Read name=value lines from path into p, complaining about lines that
+ * make no sense on stderr.  Without sections, they all go to flat.
+ */
+static int
+presets_read(struct presets *p, const char *path, struct preset *flat)
+{
+	char buf[PRESET_LINE_MAX], *line, *eq, *end;
+	struct preset *preset = flat;
+	unsigned lineno = 0;
+	FILE *fp;
+
+	if ((fp = fopen(path, "r")) == NULL) {
+		return -1;
+	}
+	while (fgets(buf, sizeof(buf), fp) != NULL) {
+		lineno++;
+		line = trim(buf);
+		if (*line == '\0' || *line == '#') {
+			continue;
+		}
+		if (*line == '[' && flat == NULL) {
+			if ((end = strchr(line, ']')) == NULL || end[1] != '\0') {
+				fprintf(stderr, "%s:%u: unterminated preset name\n",
+				    path, lineno);
+				preset = NULL;
+				continue;
+			}
+			*end = '\0';
+			if ((preset = presets_find(p, trim(line + 1))) == NULL &&
+			    (preset = preset_add(p, trim(line + 1))) == NULL) {
+				goto fail;
+			}
+			preset->path = path;
+			continue;
+		}
+		if ((eq = strchr(line, '=')) == NULL) {
+			fprintf(stderr, "%s:%u: expected name=value\n",
+			    path, lineno);
+			continue;
+		}
+		if (preset == NULL) {
+			fprintf(stderr, "%s:%u: setting outside a preset\n",
+			    path, lineno);
+			continue;
+		}
+		*eq = '\0';
+		if (!setting_add(preset, trim(line), trim(eq + 1), lineno)) {
+			goto fail;
+		}
+	}
+	fclose(fp);
+	return 0;
+fail:
+	fclose(fp);
+	return -1;
+}
+
+/*
+ * Read the presets in path.  Returns -1 with errno set if the file
+ * cannot be read at all.
+ */
+int
+presets_load(struct presets *p, const char *path)
+{
+	p->path = path;
+	return presets_read(p, path, NULL);
+}
+
+/*
+ * Read a file of name=value lines without sections, as written by
+ * mixerctl -a and read from mixerctl.conf(5), as a single preset named
+ * after the file.  Returns NULL with errno set if the file cannot be
+ * read at all.
+ */
+struct preset *
+presets_load_conf(struct presets *p, const char *path)
+{
+	struct preset *preset;
+
+	if ((preset = preset_add(p, path)) == NULL) {
+		return NULL;
+	}
+	preset->path = path;
+	if (presets_read(p, path, preset) == -1) {
+		return NULL;
+	}
+	return preset;
+}
+
+/*
+ * The setting of name that takes effect in preset, which is the last.
+ */
+static const struct preset_setting *
+preset_effective(const struct preset *preset, const char *name,
+    unsigned hint)
+{
+	/* files mostly change in place, so try the same line first */
+	if (hint < preset->nsettings &&
+	    strcmp(preset->settings[hint].name, name) == 0) {
+		for (unsigned i = hint + 1; i < preset->nsettings; ++i) {
+			if (strcmp(preset->settings[i].name, name) == 0) {
+				hint = i;
+			}
+		}
+		return &preset->settings[hint];
+	}
+	for (unsigned i = preset->nsettings; i-- > 0;) {
+		if (strcmp(preset->settings[i].name, name) == 0) {
+			return &preset->settings[i];
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Fill diff with what changed from old to preset: the settings that
+ * old did not have with the same value, leaving out those that a later
+ * one overrides.  Controls only set in old are left alone.  The
+ * settings share their strings with preset, so only diff->settings is
+ * to be freed.  Returns -1 with errno set if out of memory.
+ */
+int
+preset_diff(const struct preset *preset, const struct preset *old,
+    struct preset *diff)
+{
+	const struct preset_setting *s, *was;
+
+	memset(diff, 0, sizeof(*diff));
+	diff->name = preset->name;
+	diff->path = preset->path;
+	if ((diff->settings = calloc(preset->nsettings + 1,
+	    sizeof(*diff->settings))) == NULL) {
+		return -1;
+	}
+	diff->cap = preset->nsettings + 1;
+	for (unsigned i = 0; i < preset->nsettings; ++i) {
+		s = &preset->settings[i];
+		if (preset_effective(preset, s->name, i) != s) {
+			continue;
+		}
+		was = preset_effective(old, s->name, i);
+		if (was == NULL || strcmp(was->value, s->value) != 0) {
+			diff->settings[diff->nsettings++] = *s;
+		}
+	}
+	return 0;
+}
+
+struct preset *
+presets_find(struct presets *p, const char *name)
+{
+	for (unsigned i = 0; i < p->n; ++i) {
+		if (strcmp(p->list[i].name, name) == 0) {
+			return &p->list[i];
+		}
+	}
+	return NULL;
+}
+
+void
+presets_free(struct presets *p)
+{
+	struct preset *preset;
+
+	for (unsigned i = 0; i < p->n; ++i) {
+		preset = &p->list[i];
+		for (unsigned j = 0; j < preset->nsettings; ++j) {
+			free(preset->settings[j].name);
+			free(preset->settings[j].value);
+		}
+		free(preset->settings);
+		free(preset->name);
+	}
+	free(p->list);
+	memset(p, 0, sizeof(*p));
+}
+
+static bool
+parse_member(const char *text, size_t len, const audio_mixer_name_t *label)
+{
+	return strnlen(label->name, MAX_AUDIO_DEV_LEN) == len &&
+	    strncmp(label->name, text, len) == 0;
+}
+
+/*
+ * Turn a value as written by mixerctl(1) into a request for the
+ * control described by m: a member name for enums, a comma-separated
+ * list of them for sets, and levels for values, one for all channels
+ * or one per channel.
+ */
+int
+preset_parse_value(const struct mixer_devinfo *m, const char *text,
+    mixer_ctrl_t *dev)
+{
+	const char *p, *comma;
+	size_t len;
+	long level;
+	char *end;
+	int i, n;
+
+	memset(dev, 0, sizeof(*dev));
+	dev->dev = m->index;
+	dev->type = m->type;
+	switch (m->type) {
+	case AUDIO_MIXER_ENUM:
+		for (i = 0; i < m->un.e.num_mem; ++i) {
+			if (parse_member(text, strlen(text),
+			    &m->un.e.member[i].label)) {
+				dev->un.ord = m->un.e.member[i].ord;
+				return 0;
+			}
+		}
+		break;
+	case AUDIO_MIXER_SET:
+		for (p = text; *p != '\0'; p = *comma ? comma + 1 : comma) {
+			comma = p + strcspn(p, ",");
+			len = comma - p;
+			for (i = 0; i < m->un.s.num_mem; ++i) {
+				if (parse_member(p, len, &m->un.s.member[i].label)) {
+					dev->un.mask |= m->un.s.member[i].mask;
+					break;
+				}
+			}
+			if (i == m->un.s.num_mem) {
+				errno = EINVAL;
+				return -1;
+			}
+		}
+		return 0;
+	case AUDIO_MIXER_VALUE:
+		dev->un.value.num_channels = m->un.v.num_channels;
+		for (p = text, n = 0;; p = end + 1) {
+			level = strtol(p, &end, 10);
+			if (end == p || level < AUDIO_MIN_GAIN ||
+			    level > AUDIO_MAX_GAIN || n == m->un.v.num_channels) {
+				errno = EINVAL;
+				return -1;
+			}
+			dev->un.value.level[n++] = level;
+			if (*end != ',') {
+				break;
+			}
+		}
+		if (*end != '\0' || (n != 1 && n != m->un.v.num_channels)) {
+			break;
+		}
+		for (i = n; i < m->un.v.num_channels; ++i) {
+			dev->un.value.level[i] = dev->un.value.level[0];
+		}
+		return 0;
+	}
+	errno = EINVAL;
+	return -1;
+}
+
+/*
+ * The reverse of preset_parse_value(), levels being given one per
+ * channel.  Returns the length written as snprintf(3) would, or -1
+ * with errno set if the value does not fit the control.
+ */
+int
+preset_format_value(const struct mixer_devinfo *m, const mixer_ctrl_t *dev,
+    char *buf, size_t size)
+{
+	size_t len = 0;
+	int i, n;
+
+	if (size > 0) {
+		buf[0] = '\0';
+	}
+	if (dev->type != m->type) {
+		errno = EINVAL;
+		return -1;
+	}
+	switch (m->type) {
+	case AUDIO_MIXER_ENUM:
+		for (i = 0; i < m->un.e.num_mem; ++i) {
+			if (m->un.e.member[i].ord == dev->un.ord) {
+				return snprintf(buf, size, "%.*s",
+				    MAX_AUDIO_DEV_LEN, m->un.e.member[i].label.name);
+			}
+		}
+		break;
+	case AUDIO_MIXER_SET:
+		for (i = 0; i < m->un.s.num_mem; ++i) {
+			if ((dev->un.mask & m->un.s.member[i].mask) == 0) {
+				continue;
+			}
+			n = snprintf(len < size ? buf + len : NULL,
+			    len < size ? size - len : 0, "%s%.*s",
+			    len > 0 ? "," : "",
+			    MAX_AUDIO_DEV_LEN, m->un.s.member[i].label.name);
+			len += n;
+		}
+		return len;
+	case AUDIO_MIXER_VALUE:
+		if (dev->un.value.num_channels < 1 ||
+		    dev->un.value.num_channels > MIXER_MAX_CHANNELS) {
+			break;
+		}
+		for (i = 0; i < dev->un.value.num_channels; ++i) {
+			n = snprintf(len < size ? buf + len : NULL,
+			    len < size ? size - len : 0, "%s%d",
+			    i > 0 ? "," : "", dev->un.value.level[i]);
+			len += n;
+		}
+		return len;
+	}
+	errno = EINVAL;
+	return -1;
+}
@@ -0,0 +1,78 @@
+/*
+ Copyright (c) 2019 Nia Alarie <nia@netbsd.org>
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions
+ are met:
+
+ 1. Redistributions of source code must retain the above copyright
+    notice, this list of conditions and the following disclaimer.
+ 2. Redistributions in binary form must reproduce the above copyright
+    notice, this list of conditions and the following disclaimer in the
+    documentation and/or other materials provided with the distribution.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef AIOMIXER_PRESET_H
+#define AIOMIXER_PRESET_H
+
+#include "mixer.h"
+
+/*
+ * Presets are named sets of control values, kept in a file of
+ * sections of name=value lines as understood by mixerctl(1):
+ *
+ *	# comment
+ *	[headset]
+ *	outputs.master=200,200
+ *	outputs.select=headphones
+ *	record.source=mic,cd
+ *
+ * A file without sections, such as mixerctl.conf(5), can be read as a
+ * single preset, and a new version of it compared with the old to apply
+ * only what was edited.  Values are only checked against the controls
+ * when applied.
+ */
+struct preset_setting {
+	char *name;
+	char *value;
+	unsigned line;
+};
+
+struct preset {
+	char *name;
+	const char *path; /* read from */
+	struct preset_setting *settings;
+	unsigned nsettings, cap;
+};
+
+struct presets {
+	const char *path;
+	struct preset *list;
+	unsigned n, cap;
+};
+
+int presets_load(struct presets *, const char *);
+struct preset *presets_load_conf(struct presets *, const char *);
+struct preset *presets_find(struct presets *, const char *);
+void presets_free(struct presets *);
+int preset_diff(const struct preset *, const struct preset *,
+    struct preset *);
+int preset_parse_value(const struct mixer_devinfo *, const char *,
+    mixer_ctrl_t *);
+int preset_format_value(const struct mixer_devinfo *, const mixer_ctrl_t *,
+    char *, size_t);
+
+#endif /* !AIOMIXER_PRESET_H */
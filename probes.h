@@ -0,0 +1,50 @@
+/*
+ Copyright (c) 2019 Nia Alarie <nia@netbsd.org>
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions
+ are met:
+
+ 1. Redistributions of source code must retain the above copyright
+    notice, this list of conditions and the following disclaimer.
+ 2. Redistributions in binary form must reproduce the above copyright
+    notice, this list of conditions and the following disclaimer in the
+    documentation and/or other materials provided with the distribution.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef AIOMIXER_PROBES_H
+#define AIOMIXER_PROBES_H
+
+/*
+ * Static tracepoints in the "aiomixer" provider.  When built with
+ * USDT=yes these are sys/sdt.h probes (a single nop each until
+ * something like bpftrace or perf attaches); otherwise they vanish.
+ */
+#ifdef AIOMIXER_USDT
+#include <sys/sdt.h>
+
+#define PROBE0(name)			DTRACE_PROBE(aiomixer, name)
+#define PROBE1(name, a)			DTRACE_PROBE1(aiomixer, name, a)
+#define PROBE2(name, a, b)		DTRACE_PROBE2(aiomixer, name, a, b)
+#define PROBE3(name, a, b, c)		DTRACE_PROBE3(aiomixer, name, a, b, c)
+#else
+#define PROBE0(name)			do { } while (0)
+#define PROBE1(name, a)			do { (void)(a); } while (0)
+#define PROBE2(name, a, b)		do { (void)(a); (void)(b); } while (0)
+#define PROBE3(name, a, b, c)		do { (void)(a); (void)(b); (void)(c); } while (0)
+#endif
+
+#endif /* !AIOMIXER_PROBES_H */
@@ -0,0 +1,335 @@
+/*
+ Copyright (c) 2019 Nia Alarie <nia@netbsd.org>
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions
+ are met:
+
+ 1. Redistributions of source code must retain the above copyright
+    notice, this list of conditions and the following disclaimer.
+ 2. Redistributions in binary form must reproduce the above copyright
+    notice, this list of conditions and the following disclaimer in the
+    documentation and/or other materials provided with the distribution.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Publishing wraps another backend and mirrors the topology and every
+ * value read or written through it into a state table other programs
+ * can map, laid out as described in aiomixer_state.h.
+ *
+ * The topology is taken from the enumeration made through the wrapper,
+ * so publishing costs the device no requests of its own: the table is
+ * laid out in a temporary file once the end of the controls has been
+ * reported, and renamed into place complete, so readers never see a
+ * partial topology.  Values show up as they are read or written.
+ */
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "aiomixer_state.h"
+#include "mixer.h"
+
+struct publisher {
+	struct mixer *inner;
+	char *path;
+	char *tmp; /* until the table is in place */
+	int fd;
+	struct mixer_devinfo *info; /* enumerated so far */
+	unsigned ninfo, cap;
+	struct aiomixer_state_header *table; /* NULL until enumerated */
+	size_t size;
+};
+
+static struct aiomixer_state_control *
+pub_control(struct publisher *p, int dev)
+{
+	if (p->table == NULL || dev < 0 ||
+	    (unsigned)dev >= p->table->ncontrols) {
+		return NULL;
+	}
+	return (struct aiomixer_state_control *)((char *)p->table +
+	    p->table->header_size + (size_t)dev * p->table->control_size);
+}
+
+static void
+pub_describe(struct aiomixer_state_control *c, const struct mixer_devinfo *m)
+{
+	c->index = m->index;
+	c->type = m->type;
+	c->mixer_class = m->mixer_class;
+	c->next = m->next;
+	c->prev = m->prev;
+	memcpy(c->label, m->label.name, sizeof(c->label));
+	switch (m->type) {
+	case AUDIO_MIXER_ENUM:
+		c->nmembers = m->un.e.num_mem;
+		for (int i = 0; i < m->un.e.num_mem; ++i) {
+			memcpy(c->members[i].label, m->un.e.member[i].label.name,
+			    sizeof(c->members[i].label));
+			c->members[i].value = m->un.e.member[i].ord;
+		}
+		break;
+	case AUDIO_MIXER_SET:
+		c->nmembers = m->un.s.num_mem;
+		for (int i = 0; i < m->un.s.num_mem; ++i) {
+			memcpy(c->members[i].label, m->un.s.member[i].label.name,
+			    sizeof(c->members[i].label));
+			c->members[i].value = m->un.s.member[i].mask;
+		}
+		break;
+	case AUDIO_MIXER_VALUE:
+		memcpy(c->units, m->un.v.units.name, sizeof(c->units));
+		c->nchannels = m->un.v.num_channels;
+		c->delta = m->un.v.delta;
+		break;
+	}
+}
+
+static void
+pub_update(struct publisher *p, const mixer_ctrl_t *dev)
+{
+	struct aiomixer_state_control *c = pub_control(p, dev->dev);
+	struct aiomixer_state_value v;
+	uint32_t seq;
+
+	if (c == NULL || c->type != dev->type) {
+		return;
+	}
+	v = c->value;
+	v.valid = 1;
+	switch (dev->type) {
+	case AUDIO_MIXER_ENUM:
+		v.ord = dev->un.ord;
+		break;
+	case AUDIO_MIXER_SET:
+		v.mask = dev->un.mask;
+		break;
+	case AUDIO_MIXER_VALUE:
+		for (int i = 0; i < c->nchannels &&
+		    i < dev->un.value.num_channels &&
+		    i < AIOMIXER_STATE_MAX_CHANNELS; ++i) {
+			v.level[i] = dev->un.value.level[i];
+		}
+		break;
+	}
+	/* nothing to wake the readers for */
+	if (memcmp(&v, &c->value, sizeof(v)) == 0) {
+		return;
+	}
+	seq = atomic_load_explicit(&c->seq, memory_order_relaxed);
+	atomic_store_explicit(&c->seq, seq + 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+	c->value = v;
+	atomic_store_explicit(&c->seq, seq + 2, memory_order_release);
+	atomic_fetch_add_explicit(&p->table->generation, 1,
+	    memory_order_release);
+}
+
+/*
+ * Keep a control enumerated through us, in order.
+ */
+static int
+pub_collect(struct publisher *p, const struct mixer_devinfo *m)
+{
+	struct mixer_devinfo *info;
+	unsigned cap;
+
+	if (m->index < 0 || (unsigned)m->index != p->ninfo) {
+		return 0;
+	}
+	if (p->ninfo == p->cap) {
+		cap = p->cap ? p->cap * 2 : 32;
+		if ((info = realloc(p->info, cap * sizeof(*info))) == NULL) {
+			return -1;
+		}
+		p->info = info;
+		p->cap = cap;
+	}
+	p->info[p->ninfo++] = *m;
+	return 0;
+}
+
+/*
+ * Lay out the table for the controls enumerated and put it in place.
+ */
+static int
+pub_layout(struct publisher *p)
+{
+	struct aiomixer_state_header *table;
+
+	p->size = sizeof(struct aiomixer_state_header) +
+	    p->ninfo * sizeof(struct aiomixer_state_control);
+	if (ftruncate(p->fd, p->size) == -1) {
+		return -1;
+	}
+	table = mmap(NULL, p->size, PROT_READ | PROT_WRITE, MAP_SHARED,
+	    p->fd, 0);
+	if (table == MAP_FAILED) {
+		return -1;
+	}
+	table->version = AIOMIXER_STATE_VERSION;
+	table->header_size = sizeof(struct aiomixer_state_header);
+	table->control_size = sizeof(struct aiomixer_state_control);
+	table->ncontrols = p->ninfo;
+	table->pid = getpid();
+	p->table = table;
+	for (unsigned i = 0; i < p->ninfo; ++i) {
+		pub_describe(pub_control(p, i), &p->info[i]);
+	}
+	atomic_store_explicit(&table->magic, AIOMIXER_STATE_MAGIC,
+	    memory_order_release);
+	if (rename(p->tmp, p->path) == -1) {
+		munmap(table, p->size);
+		p->table = NULL;
+		return -1;
+	}
+	close(p->fd);
+	p->fd = -1;
+	free(p->tmp);
+	p->tmp = NULL;
+	free(p->info);
+	p->info = NULL;
+	p->ninfo = p->cap = 0;
+	return 0;
+}
+
+static int
+pub_devinfo(void *cookie, struct mixer_devinfo *m)
+{
+	struct publisher *p = cookie;
+	int index = m->index, ret;
+
+	ret = p->inner->ops->devinfo(p->inner->cookie, m);
+	if (p->table != NULL) {
+		return ret;
+	}
+	if (ret != -1) {
+		return pub_collect(p, m) == -1 ? -1 : ret;
+	}
+	/* the end of the controls, as mixer_enumerate() sees it */
+	if ((errno == ENXIO || errno == EINVAL) && index >= 0 &&
+	    (unsigned)index == p->ninfo) {
+		if (pub_layout(p) == -1) {
+			return -1;
+		}
+		errno = ENXIO;
+	}
+	return -1;
+}
+
+static int
+pub_read(void *cookie, mixer_ctrl_t *dev)
+{
+	struct publisher *p = cookie;
+	int ret;
+
+	if ((ret = p->inner->ops->read(p->inner->cookie, dev)) != -1) {
+		pub_update(p, dev);
+	}
+	return ret;
+}
+
+static int
+pub_write(void *cookie, mixer_ctrl_t *dev)
+{
+	struct publisher *p = cookie;
+	int ret;
+
+	if ((ret = p->inner->ops->write(p->inner->cookie, dev)) != -1) {
+		pub_update(p, dev);
+	}
+	return ret;
+}
+
+static void
+pub_close(void *cookie)
+{
+	struct publisher *p = cookie;
+
+	if (p->table != NULL) {
+		atomic_store_explicit(&p->table->magic, 0,
+		    memory_order_release);
+		unlink(p->path);
+		munmap(p->table, p->size);
+	} else {
+		unlink(p->tmp);
+		close(p->fd);
+	}
+	mixer_close(p->inner);
+	free(p->info);
+	free(p->tmp);
+	free(p->path);
+	free(p);
+}
+
+static const struct mixer_ops pub_ops = {
+	.devinfo = pub_devinfo,
+	.read = pub_read,
+	.write = pub_write,
+	.close = pub_close,
+};
+
+/*
+ * Publish the controls of inner to a new file at path, which appears
+ * once they have been enumerated through the mixer returned.
+ */
+struct mixer *
+mixer_publish(struct mixer *inner, const char *path)
+{
+	struct publisher *p;
+	struct mixer *mixer;
+	size_t len = strlen(path) + sizeof(".XXXXXX");
+	int error;
+
+	if ((p = calloc(1, sizeof(*p))) == NULL) {
+		return NULL;
+	}
+	p->inner = inner;
+	p->fd = -1;
+	if ((p->path = strdup(path)) == NULL ||
+	    (p->tmp = malloc(len)) == NULL) {
+		goto fail;
+	}
+	snprintf(p->tmp, len, "%s.XXXXXX", path);
+	if ((p->fd = mkstemp(p->tmp)) == -1) {
+		goto fail;
+	}
+	if (fchmod(p->fd, 0644) == -1 ||
+	    (mixer = mixer_new(&pub_ops, p)) == NULL) {
+		unlink(p->tmp);
+		goto fail;
+	}
+	return mixer;
+fail:
+	error = errno;
+	if (p->fd != -1) {
+		close(p->fd);
+	}
+	free(p->tmp);
+	free(p->path);
+	free(p);
+	errno = error;
+	return NULL;
+}
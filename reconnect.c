@@ -0,0 +1,414 @@
+/*
+ Copyright (c) 2019 Nia Alarie <nia@netbsd.org>
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions
+ are met:
+
+ 1. Redistributions of source code must retain the above copyright
+    notice, this list of conditions and the following disclaimer.
+ 2. Redistributions in binary form must reproduce the above copyright
+    notice, this list of conditions and the following disclaimer in the
+    documentation and/or other materials provided with the distribution.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Reconnecting to a device that went away under us, as USB devices do
+ * when they are reset.
+ *
+ * A request failing with ENXIO, ENODEV or EBADF, or a run of EIO
+ * failures, marks the device as lost.  ENXIO is also how the end of
+ * the controls is reported, so it does not count for DEVINFO.  From
+ * then on each request first tries to reopen it, backing off
+ * exponentially between attempts and failing with ENXIO meanwhile, so
+ * a device that stays away does not stall the caller.  The first
+ * attempt is made at once, so a request that hits a short reset
+ * usually never sees it.
+ *
+ * A reopened device is only used if its controls match those
+ * enumerated through us before: their fingerprints are compared, so
+ * the caller can carry on without enumerating again.  If they do not
+ * match, requests fail with ESTALE from then on.  With restore, the
+ * values last read from or written to each control are written back
+ * to the reopened device.
+ *
+ * A caller told by other means that the device has gone and come back,
+ * as aiomixer is by hotplug, can say so with mixer_reconnect_detach()
+ * and mixer_reconnect_attach(), keeping whatever is stacked on top.
+ */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "mixer.h"
+
+#define RECONNECT_MIN_US	(50000)
+#define RECONNECT_MAX_US	(2000000)
+/* a couple of fully retried requests' worth */
+#define RECONNECT_EIO		(8)
+
+struct shadow {
+	bool valid;
+	mixer_ctrl_t ctrl;
+};
+
+struct reconnect {
+	struct mixer *inner; /* NULL while lost */
+	struct mixer *(*reopen)(const char *);
+	char *arg;
+	bool restore;
+	bool stale;
+	bool detached; /* told so, not to be reopened */
+	unsigned eio;
+
+	/* the topology as first enumerated */
+	struct mixer_devinfo *info;
+	unsigned ninfo, infocap;
+	bool complete;
+	uint64_t fingerprint;
+
+	struct shadow *shadow;
+	unsigned nshadow;
+
+	uint64_t next_try, backoff;
+};
+
+static uint64_t
+usec_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/*
+ * With restore, write the values last known back to a device come back.
+ */
+static void
+reconnect_restore(struct reconnect *r, struct mixer *m)
+{
+	if (!r->restore) {
+		return;
+	}
+	for (unsigned i = 0; i < r->nshadow; ++i) {
+		if (r->shadow[i].valid) {
+			(void)mixer_write(m, &r->shadow[i].ctrl);
+		}
+	}
+}
+
+static bool
+reconnect_reopen(struct reconnect *r)
+{
+	struct mixer_devinfo *info;
+	struct mixer *m;
+	unsigned n;
+
+	if ((m = r->reopen(r->arg)) == NULL) {
+		return false;
+	}
+	if (mixer_enumerate(m, &info, &n) == -1) {
+		mixer_close(m);
+		return false;
+	}
+	if (r->complete && mixer_fingerprint(info, n) != r->fingerprint) {
+		r->stale = true;
+		free(info);
+		mixer_close(m);
+		return false;
+	}
+	free(info);
+	reconnect_restore(r, m);
+	r->inner = m;
+	return true;
+}
+
+/*
+ * Whether there is a device to send requests to, reopening a lost one
+ * when it is time to try again.
+ */
+static bool
+reconnect_ready(struct reconnect *r)
+{
+	uint64_t now;
+
+	if (r->inner != NULL) {
+		return true;
+	}
+	if (r->stale) {
+		errno = ESTALE;
+		return false;
+	}
+	if (r->detached || (now = usec_now()) < r->next_try) {
+		errno = ENXIO;
+		return false;
+	}
+	if (reconnect_reopen(r)) {
+		return true;
+	}
+	r->next_try = now + r->backoff;
+	if ((r->backoff *= 2) > RECONNECT_MAX_US) {
+		r->backoff = RECONNECT_MAX_US;
+	}
+	errno = r->stale ? ESTALE : ENXIO;
+	return false;
+}
+
+/*
+ * Called after a failed request: whether the device is now lost and
+ * the request worth trying again on a reopened one.
+ */
+static bool
+reconnect_lost(struct reconnect *r, int error)
+{
+	switch (error) {
+	case EIO:
+		if (++r->eio < RECONNECT_EIO) {
+			return false;
+		}
+		break;
+	case ENXIO:
+	case ENODEV:
+	case EBADF:
+		break;
+	default:
+		return false;
+	}
+	mixer_close(r->inner);
+	r->inner = NULL;
+	r->eio = 0;
+	r->next_try = 0;
+	r->backoff = RECONNECT_MIN_US;
+	return reconnect_ready(r);
+}
+
+static void
+reconnect_remember(struct reconnect *r, const mixer_ctrl_t *dev)
+{
+	struct shadow *shadow;
+	unsigned n;
+
+	r->eio = 0;
+	if (dev->dev < 0) {
+		return;
+	}
+	if ((unsigned)dev->dev >= r->nshadow) {
+		n = dev->dev + 1;
+		if ((shadow = realloc(r->shadow, n * sizeof(*shadow))) == NULL) {
+			return;
+		}
+		memset(shadow + r->nshadow, 0, (n - r->nshadow) * sizeof(*shadow));
+		r->shadow = shadow;
+		r->nshadow = n;
+	}
+	r->shadow[dev->dev].valid = true;
+	r->shadow[dev->dev].ctrl = *dev;
+}
+
+static int
+reconnect_devinfo(void *cookie, struct mixer_devinfo *m)
+{
+	struct reconnect *r = cookie;
+	struct mixer_devinfo *info;
+	int ret;
+
+	if (!reconnect_ready(r)) {
+		return -1;
+	}
+	ret = r->inner->ops->devinfo(r->inner->cookie, m);
+	if (ret == -1 && errno != ENXIO && reconnect_lost(r, errno)) {
+		ret = r->inner->ops->devinfo(r->inner->cookie, m);
+	}
+	if (ret != -1) {
+		r->eio = 0;
+	}
+	if (r->complete || m->index < 0 || (unsigned)m->index != r->ninfo) {
+		return ret;
+	}
+	/* enumeration in order, as mixer_enumerate() does it */
+	if (ret == -1) {
+		if (errno == ENXIO || errno == EINVAL) {
+			r->complete = true;
+			r->fingerprint = mixer_fingerprint(r->info, r->ninfo);
+		}
+		return ret;
+	}
+	if (r->ninfo == r->infocap) {
+		r->infocap = r->infocap ? r->infocap * 2 : 32;
+		info = realloc(r->info, r->infocap * sizeof(*info));
+		if (info == NULL) {
+			/* no topology to compare with, so no reconnecting */
+			r->complete = true;
+			r->stale = true;
+			return ret;
+		}
+		r->info = info;
+	}
+	r->info[r->ninfo++] = *m;
+	return ret;
+}
+
+static int
+reconnect_read(void *cookie, mixer_ctrl_t *dev)
+{
+	struct reconnect *r = cookie;
+	int ret;
+
+	if (!reconnect_ready(r)) {
+		return -1;
+	}
+	ret = r->inner->ops->read(r->inner->cookie, dev);
+	if (ret == -1 && reconnect_lost(r, errno)) {
+		ret = r->inner->ops->read(r->inner->cookie, dev);
+	}
+	if (ret != -1) {
+		reconnect_remember(r, dev);
+	}
+	return ret;
+}
+
+static int
+reconnect_write(void *cookie, mixer_ctrl_t *dev)
+{
+	struct reconnect *r = cookie;
+	int ret;
+
+	if (!reconnect_ready(r)) {
+		return -1;
+	}
+	ret = r->inner->ops->write(r->inner->cookie, dev);
+	if (ret == -1 && reconnect_lost(r, errno)) {
+		ret = r->inner->ops->write(r->inner->cookie, dev);
+	}
+	if (ret != -1) {
+		reconnect_remember(r, dev);
+	}
+	return ret;
+}
+
+static void
+reconnect_close(void *cookie)
+{
+	struct reconnect *r = cookie;
+
+	mixer_close(r->inner);
+	free(r->arg);
+	free(r->info);
+	free(r->shadow);
+	free(r);
+}
+
+static const struct mixer_ops reconnect_ops = {
+	.devinfo = reconnect_devinfo,
+	.read = reconnect_read,
+	.write = reconnect_write,
+	.close = reconnect_close,
+};
+
+/*
+ * Wrap inner, which was opened as reopen(arg), to be reopened the same
+ * way when it goes away.
+ */
+struct mixer *
+mixer_reconnect(struct mixer *inner, struct mixer *(*reopen)(const char *),
+    const char *arg, bool restore)
+{
+	struct reconnect *r;
+	struct mixer *mixer;
+
+	if ((r = calloc(1, sizeof(*r))) == NULL) {
+		return NULL;
+	}
+	if ((r->arg = strdup(arg)) == NULL) {
+		free(r);
+		return NULL;
+	}
+	r->inner = inner;
+	r->reopen = reopen;
+	r->restore = restore;
+	r->backoff = RECONNECT_MIN_US;
+	if ((mixer = mixer_new(&reconnect_ops, r)) == NULL) {
+		free(r->arg);
+		free(r);
+	}
+	return mixer;
+}
+
+/*
+ * The device behind m has been reported gone: close it, and fail
+ * requests with ENXIO without trying to reopen it until
+ * mixer_reconnect_attach().  Returns -1 with errno set to EINVAL if m
+ * is not a reconnect wrapper.
+ */
+int
+mixer_reconnect_detach(struct mixer *m)
+{
+	struct reconnect *r;
+
+	if (m == NULL || m->ops != &reconnect_ops) {
+		errno = EINVAL;
+		return -1;
+	}
+	r = m->cookie;
+	mixer_close(r->inner);
+	r->inner = NULL;
+	r->detached = true;
+	return 0;
+}
+
+/*
+ * Carry on through dev, the device behind m come back, closing the one
+ * before if any.  dev may itself be a reconnect wrapper, whose device is
+ * taken over.  Its controls must be those enumerated through m before,
+ * which is for the caller to check.  With restore, the values last
+ * known are written back to it.  Returns -1 with errno set to EINVAL,
+ * leaving dev to the caller, if m is not a reconnect wrapper.
+ */
+int
+mixer_reconnect_attach(struct mixer *m, struct mixer *dev)
+{
+	struct reconnect *r, *from;
+	struct mixer *shell;
+
+	if (m == NULL || m->ops != &reconnect_ops) {
+		errno = EINVAL;
+		return -1;
+	}
+	r = m->cookie;
+	if (dev != NULL && dev->ops == &reconnect_ops) {
+		shell = dev;
+		from = shell->cookie;
+		dev = from->inner;
+		from->inner = NULL;
+		mixer_close(shell);
+	}
+	mixer_close(r->inner);
+	r->inner = dev;
+	r->detached = false;
+	r->stale = false;
+	r->eio = 0;
+	r->next_try = 0;
+	r->backoff = RECONNECT_MIN_US;
+	if (dev != NULL) {
+		reconnect_restore(r, dev);
+	}
+	return 0;
+}
@@ -0,0 +1,710 @@
+/*
+ Copyright (c) 2019 Nia Alarie <nia@netbsd.org>
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions
+ are met:
+
+ 1. Redistributions of source code must retain the above copyright
+    notice, this list of conditions and the following disclaimer.
+ 2. Redistributions in binary form must reproduce the above copyright
+    notice, this list of conditions and the following disclaimer in the
+    documentation and/or other materials provided with the distribution.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Recording and replay of mixer I/O.
+ *
+ * A recording is the magic string followed by one entry per request:
+ *
+ *	u8 op, u32 errno, u64 start time (us), u32 latency (us), payload
+ *
+ * where the payload is the mixer_devinfo (only the index when the
+ * request failed) or the mixer_ctrl.  All integers are little-endian,
+ * labels are MAX_AUDIO_DEV_LEN bytes and only the used enum/set
+ * members and channels are stored.
+ *
+ * Replay answers DEVINFO from the recorded topology and keeps the
+ * current value of each control, seeded by the first recorded read
+ * and updated by writes.  The recorded latencies and errors of each
+ * request/control pair are served back in order, cycling when the
+ * session runs longer than the recording.
+ */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "mixer.h"
+
+#define RECORD_MAGIC	"AIOMIXR1"
+#define RECORD_MAGIC_LEN	(8)
+
+#define MAX_MEMBERS	(32)
+
+#ifndef EFTYPE
+#define EFTYPE		EINVAL
+#endif
+
+enum {
+	REC_DEVINFO = 1,
+	REC_READ,
+	REC_WRITE,
+};
+
+struct recorder {
+	struct mixer *inner;
+	FILE *fp;
+	struct timespec epoch;
+};
+
+struct replay_event {
+	uint32_t latency;
+	int error;
+};
+
+struct replay_seq {
+	struct replay_event *ev;
+	size_t n, cap, pos;
+};
+
+struct replay_devinfo {
+	bool valid;
+	struct mixer_devinfo m;
+	struct replay_seq seq;
+};
+
+struct replay_ctrl {
+	bool valid;
+	mixer_ctrl_t value;
+	struct replay_seq read, write;
+};
+
+struct replay {
+	struct replay_devinfo *info;
+	size_t ninfo;
+	struct replay_ctrl *ctrl;
+	size_t nctrl;
+};
+
+static uint64_t
+usec_since(const struct timespec *epoch)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)(now.tv_sec - epoch->tv_sec) * 1000000 +
+	    (now.tv_nsec - epoch->tv_nsec) / 1000;
+}
+
+static void
+put_u8(FILE *fp, unsigned v)
+{
+	putc(v & 0xff, fp);
+}
+
+static void
+put_u32(FILE *fp, uint32_t v)
+{
+	for (int i = 0; i < 4; ++i) {
+		putc((v >> (8 * i)) & 0xff, fp);
+	}
+}
+
+static void
+put_u64(FILE *fp, uint64_t v)
+{
+	put_u32(fp, v & 0xffffffff);
+	put_u32(fp, v >> 32);
+}
+
+static void
+put_name(FILE *fp, const audio_mixer_name_t *name)
+{
+	fwrite(name->name, 1, MAX_AUDIO_DEV_LEN, fp);
+}
+
+static bool
+get_u8(FILE *fp, unsigned *v)
+{
+	int c;
+
+	if ((c = getc(fp)) == EOF) {
+		return false;
+	}
+	*v = c;
+	return true;
+}
+
+static bool
+get_u32(FILE *fp, uint32_t *v)
+{
+	unsigned c;
+
+	*v = 0;
+	for (int i = 0; i < 4; ++i) {
+		if (!get_u8(fp, &c)) {
+			return false;
+		}
+		*v |= (uint32_t)c << (8 * i);
+	}
+	return true;
+}
+
+static bool
+get_int(FILE *fp, int *v)
+{
+	uint32_t u;
+
+	if (!get_u32(fp, &u)) {
+		return false;
+	}
+	*v = (int32_t)u;
+	return true;
+}
+
+static bool
+get_u64(FILE *fp, uint64_t *v)
+{
+	uint32_t lo, hi;
+
+	if (!get_u32(fp, &lo) || !get_u32(fp, &hi)) {
+		return false;
+	}
+	*v = (uint64_t)hi << 32 | lo;
+	return true;
+}
+
+static bool
+get_name(FILE *fp, audio_mixer_name_t *name)
+{
+	if (fread(name->name, 1, MAX_AUDIO_DEV_LEN, fp) != MAX_AUDIO_DEV_LEN) {
+		return false;
+	}
+	name->name[MAX_AUDIO_DEV_LEN - 1] = '\0';
+	return true;
+}
+
+static void
+put_devinfo(FILE *fp, const struct mixer_devinfo *m)
+{
+	int i;
+
+	put_name(fp, &m->label);
+	put_u32(fp, m->type);
+	put_u32(fp, m->mixer_class);
+	put_u32(fp, m->next);
+	put_u32(fp, m->prev);
+	switch (m->type) {
+	case AUDIO_MIXER_ENUM:
+		put_u8(fp, m->un.e.num_mem);
+		for (i = 0; i < m->un.e.num_mem; ++i) {
+			put_name(fp, &m->un.e.member[i].label);
+			put_u32(fp, m->un.e.member[i].ord);
+		}
+		break;
+	case AUDIO_MIXER_SET:
+		put_u8(fp, m->un.s.num_mem);
+		for (i = 0; i < m->un.s.num_mem; ++i) {
+			put_name(fp, &m->un.s.member[i].label);
+			put_u32(fp, m->un.s.member[i].mask);
+		}
+		break;
+	case AUDIO_MIXER_VALUE:
+		put_name(fp, &m->un.v.units);
+		put_u8(fp, m->un.v.num_channels);
+		put_u32(fp, m->un.v.delta);
+		break;
+	}
+}
+
+static bool
+get_devinfo(FILE *fp, struct mixer_devinfo *m)
+{
+	unsigned n;
+	int i;
+
+	if (!get_name(fp, &m->label) || !get_int(fp, &m->type) ||
+	    !get_int(fp, &m->mixer_class) || !get_int(fp, &m->next) ||
+	    !get_int(fp, &m->prev)) {
+		return false;
+	}
+	switch (m->type) {
+	case AUDIO_MIXER_ENUM:
+		if (!get_u8(fp, &n) || n > MAX_MEMBERS) {
+			return false;
+		}
+		m->un.e.num_mem = n;
+		for (i = 0; i < m->un.e.num_mem; ++i) {
+			if (!get_name(fp, &m->un.e.member[i].label) ||
+			    !get_int(fp, &m->un.e.member[i].ord)) {
+				return false;
+			}
+		}
+		break;
+	case AUDIO_MIXER_SET:
+		if (!get_u8(fp, &n) || n > MAX_MEMBERS) {
+			return false;
+		}
+		m->un.s.num_mem = n;
+		for (i = 0; i < m->un.s.num_mem; ++i) {
+			if (!get_name(fp, &m->un.s.member[i].label) ||
+			    !get_int(fp, &m->un.s.member[i].mask)) {
+				return false;
+			}
+		}
+		break;
+	case AUDIO_MIXER_VALUE:
+		if (!get_name(fp, &m->un.v.units) || !get_u8(fp, &n) ||
+		    n > MIXER_MAX_CHANNELS || !get_int(fp, &m->un.v.delta)) {
+			return false;
+		}
+		m->un.v.num_channels = n;
+		break;
+	}
+	return true;
+}
+
+static void
+put_ctrl(FILE *fp, const mixer_ctrl_t *dev)
+{
+	int nchan;
+
+	put_u32(fp, dev->dev);
+	put_u32(fp, dev->type);
+	switch (dev->type) {
+	case AUDIO_MIXER_ENUM:
+		put_u32(fp, dev->un.ord);
+		break;
+	case AUDIO_MIXER_SET:
+		put_u32(fp, dev->un.mask);
+		break;
+	case AUDIO_MIXER_VALUE:
+		nchan = dev->un.value.num_channels;
+		if (nchan < 0 || nchan > MIXER_MAX_CHANNELS) {
+			nchan = 0;
+		}
+		put_u8(fp, nchan);
+		fwrite(dev->un.value.level, 1, nchan, fp);
+		break;
+	}
+}
+
+static bool
+get_ctrl(FILE *fp, mixer_ctrl_t *dev)
+{
+	unsigned n;
+
+	if (!get_int(fp, &dev->dev) || !get_int(fp, &dev->type)) {
+		return false;
+	}
+	switch (dev->type) {
+	case AUDIO_MIXER_ENUM:
+		return get_int(fp, &dev->un.ord);
+	case AUDIO_MIXER_SET:
+		return get_int(fp, &dev->un.mask);
+	case AUDIO_MIXER_VALUE:
+		if (!get_u8(fp, &n) || n > MIXER_MAX_CHANNELS) {
+			return false;
+		}
+		dev->un.value.num_channels = n;
+		return fread(dev->un.value.level, 1, n, fp) == n;
+	}
+	return true;
+}
+
+/*
+ * Recording wraps another backend and logs each request on its way back.
+ */
+static void
+rec_header(struct recorder *r, unsigned op, int ret, int error,
+    uint64_t start)
+{
+	put_u8(r->fp, op);
+	put_u32(r->fp, ret == -1 ? error : 0);
+	put_u64(r->fp, start);
+	put_u32(r->fp, usec_since(&r->epoch) - start);
+}
+
+static int
+rec_devinfo(void *cookie, struct mixer_devinfo *m)
+{
+	struct recorder *r = cookie;
+	uint64_t start = usec_since(&r->epoch);
+	int ret, error;
+
+	ret = r->inner->ops->devinfo(r->inner->cookie, m);
+	error = errno;
+	rec_header(r, REC_DEVINFO, ret, error, start);
+	put_u32(r->fp, m->index);
+	if (ret != -1) {
+		put_devinfo(r->fp, m);
+	}
+	errno = error;
+	return ret;
+}
+
+static int
+rec_read(void *cookie, mixer_ctrl_t *dev)
+{
+	struct recorder *r = cookie;
+	uint64_t start = usec_since(&r->epoch);
+	int ret, error;
+
+	ret = r->inner->ops->read(r->inner->cookie, dev);
+	error = errno;
+	rec_header(r, REC_READ, ret, error, start);
+	put_ctrl(r->fp, dev);
+	errno = error;
+	return ret;
+}
+
+static int
+rec_write(void *cookie, mixer_ctrl_t *dev)
+{
+	struct recorder *r = cookie;
+	uint64_t start = usec_since(&r->epoch);
+	int ret, error;
+
+	ret = r->inner->ops->write(r->inner->cookie, dev);
+	error = errno;
+	rec_header(r, REC_WRITE, ret, error, start);
+	put_ctrl(r->fp, dev);
+	errno = error;
+	return ret;
+}
+
+static void
+rec_close(void *cookie)
+{
+	struct recorder *r = cookie;
+
+	if (fclose(r->fp) != 0) {
+		perror("aiomixer: recording");
+	}
+	mixer_close(r->inner);
+	free(r);
+}
+
+static const struct mixer_ops rec_ops = {
+	.devinfo = rec_devinfo,
+	.read = rec_read,
+	.write = rec_write,
+	.close = rec_close,
+};
+
+struct mixer *
+mixer_record(struct mixer *inner, const char *path)
+{
+	struct recorder *r;
+	struct mixer *mixer;
+
+	if ((r = calloc(1, sizeof(*r))) == NULL) {
+		return NULL;
+	}
+	if ((r->fp = fopen(path, "wb")) == NULL) {
+		free(r);
+		return NULL;
+	}
+	fwrite(RECORD_MAGIC, 1, RECORD_MAGIC_LEN, r->fp);
+	clock_gettime(CLOCK_MONOTONIC, &r->epoch);
+	r->inner = inner;
+	if ((mixer = mixer_new(&rec_ops, r)) == NULL) {
+		fclose(r->fp);
+		free(r);
+	}
+	return mixer;
+}
+
+static void *
+grow(void *p, size_t *n, size_t want, size_t size)
+{
+	size_t newn = *n ? *n : 16;
+	char *q;
+
+	if (want <= *n) {
+		return p;
+	}
+	while (newn < want) {
+		newn *= 2;
+	}
+	if ((q = realloc(p, newn * size)) == NULL) {
+		return NULL;
+	}
+	memset(q + *n * size, 0, (newn - *n) * size);
+	*n = newn;
+	return q;
+}
+
+static bool
+seq_push(struct replay_seq *seq, uint32_t latency, int error)
+{
+	struct replay_event *ev;
+
+	if ((ev = grow(seq->ev, &seq->cap, seq->n + 1, sizeof(*ev))) == NULL) {
+		return false;
+	}
+	seq->ev = ev;
+	seq->ev[seq->n].latency = latency;
+	seq->ev[seq->n].error = error;
+	seq->n++;
+	return true;
+}
+
+/*
+ * Wait out the next recorded latency and return the recorded error.
+ */
+static int
+seq_next(struct replay_seq *seq)
+{
+	struct replay_event *ev;
+	struct timespec ts;
+
+	if (seq->n == 0) {
+		return 0;
+	}
+	ev = &seq->ev[seq->pos];
+	seq->pos = (seq->pos + 1) % seq->n;
+	ts.tv_sec = ev->latency / 1000000;
+	ts.tv_nsec = (ev->latency % 1000000) * 1000;
+	while (nanosleep(&ts, &ts) == -1 && errno == EINTR)
+		;
+	return ev->error;
+}
+
+static struct replay_devinfo *
+replay_info(struct replay *rp, int index)
+{
+	struct replay_devinfo *info;
+	size_t cap = rp->ninfo;
+
+	if (index < 0) {
+		return NULL;
+	}
+	if ((info = grow(rp->info, &cap, index + 1, sizeof(*info))) == NULL) {
+		return NULL;
+	}
+	rp->info = info;
+	rp->ninfo = cap;
+	return &rp->info[index];
+}
+
+static struct replay_ctrl *
+replay_ctrl(struct replay *rp, int dev)
+{
+	struct replay_ctrl *ctrl;
+	size_t cap = rp->nctrl;
+
+	if (dev < 0) {
+		return NULL;
+	}
+	if ((ctrl = grow(rp->ctrl, &cap, dev + 1, sizeof(*ctrl))) == NULL) {
+		return NULL;
+	}
+	rp->ctrl = ctrl;
+	rp->nctrl = cap;
+	return &rp->ctrl[dev];
+}
+
+static bool
+replay_load(struct replay *rp, FILE *fp)
+{
+	struct replay_devinfo *info;
+	struct replay_ctrl *ctrl;
+	struct mixer_devinfo m;
+	mixer_ctrl_t dev;
+	char magic[RECORD_MAGIC_LEN];
+	unsigned op;
+	uint32_t error, latency;
+	uint64_t start;
+
+	if (fread(magic, 1, sizeof(magic), fp) != sizeof(magic) ||
+	    memcmp(magic, RECORD_MAGIC, sizeof(magic)) != 0) {
+		errno = EFTYPE;
+		return false;
+	}
+	while (get_u8(fp, &op)) {
+		if (!get_u32(fp, &error) || !get_u64(fp, &start) ||
+		    !get_u32(fp, &latency)) {
+			goto truncated;
+		}
+		switch (op) {
+		case REC_DEVINFO:
+			memset(&m, 0, sizeof(m));
+			if (!get_int(fp, &m.index) ||
+			    (error == 0 && !get_devinfo(fp, &m))) {
+				goto truncated;
+			}
+			if ((info = replay_info(rp, m.index)) == NULL) {
+				return false;
+			}
+			if (error == 0 && !info->valid) {
+				info->m = m;
+				info->valid = true;
+			}
+			if (!seq_push(&info->seq, latency, error)) {
+				return false;
+			}
+			break;
+		case REC_READ:
+		case REC_WRITE:
+			memset(&dev, 0, sizeof(dev));
+			if (!get_ctrl(fp, &dev)) {
+				goto truncated;
+			}
+			if ((ctrl = replay_ctrl(rp, dev.dev)) == NULL) {
+				return false;
+			}
+			if (error == 0 && !ctrl->valid) {
+				ctrl->value = dev;
+				ctrl->valid = true;
+			}
+			if (!seq_push(op == REC_READ ? &ctrl->read : &ctrl->write,
+			    latency, error)) {
+				return false;
+			}
+			break;
+		default:
+			goto truncated;
+		}
+	}
+	return true;
+truncated:
+	errno = EFTYPE;
+	return false;
+}
+
+static int
+replay_devinfo(void *cookie, struct mixer_devinfo *m)
+{
+	struct replay *rp = cookie;
+	struct replay_devinfo *info;
+	int error;
+
+	if (m->index < 0 || (size_t)m->index >= rp->ninfo) {
+		errno = ENXIO;
+		return -1;
+	}
+	info = &rp->info[m->index];
+	if ((error = seq_next(&info->seq)) != 0) {
+		errno = error;
+		return -1;
+	}
+	if (!info->valid) {
+		errno = ENXIO;
+		return -1;
+	}
+	*m = info->m;
+	return 0;
+}
+
+static int
+replay_read(void *cookie, mixer_ctrl_t *dev)
+{
+	struct replay *rp = cookie;
+	struct replay_ctrl *ctrl;
+	int error;
+
+	if (dev->dev < 0 || (size_t)dev->dev >= rp->nctrl) {
+		errno = EINVAL;
+		return -1;
+	}
+	ctrl = &rp->ctrl[dev->dev];
+	if ((error = seq_next(&ctrl->read)) != 0) {
+		errno = error;
+		return -1;
+	}
+	if (!ctrl->valid || ctrl->value.type != dev->type) {
+		errno = EINVAL;
+		return -1;
+	}
+	*dev = ctrl->value;
+	return 0;
+}
+
+static int
+replay_write(void *cookie, mixer_ctrl_t *dev)
+{
+	struct replay *rp = cookie;
+	struct replay_ctrl *ctrl;
+	int error;
+
+	if (dev->dev < 0 || (size_t)dev->dev >= rp->nctrl) {
+		errno = EINVAL;
+		return -1;
+	}
+	ctrl = &rp->ctrl[dev->dev];
+	if ((error = seq_next(&ctrl->write)) != 0) {
+		errno = error;
+		return -1;
+	}
+	ctrl->value = *dev;
+	ctrl->valid = true;
+	return 0;
+}
+
+static void
+replay_close(void *cookie)
+{
+	struct replay *rp = cookie;
+	size_t i;
+
+	for (i = 0; i < rp->ninfo; ++i) {
+		free(rp->info[i].seq.ev);
+	}
+	for (i = 0; i < rp->nctrl; ++i) {
+		free(rp->ctrl[i].read.ev);
+		free(rp->ctrl[i].write.ev);
+	}
+	free(rp->info);
+	free(rp->ctrl);
+	free(rp);
+}
+
+static const struct mixer_ops replay_ops = {
+	.devinfo = replay_devinfo,
+	.read = replay_read,
+	.write = replay_write,
+	.close = replay_close,
+};
+
+struct mixer *
+mixer_open_replay(const char *path)
+{
+	struct replay *rp;
+	struct mixer *mixer;
+	FILE *fp;
+	bool ok;
+
+	if ((rp = calloc(1, sizeof(*rp))) == NULL) {
+		return NULL;
+	}
+	if ((fp = fopen(path, "rb")) == NULL) {
+		free(rp);
+		return NULL;
+	}
+	ok = replay_load(rp, fp);
+	fclose(fp);
+	if (!ok || (mixer = mixer_new(&replay_ops, rp)) == NULL) {
+		replay_close(rp);
+		return NULL;
+	}
+	return mixer;
+}
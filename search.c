@@ -0,0 +1,165 @@
+/*
+ Copyright (c) 2019 Nia Alarie <nia@netbsd.org>
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions
+ are met:
+
+ 1. Redistributions of source code must retain the above copyright
+    notice, this list of conditions and the following disclaimer.
+ 2. Redistributions in binary form must reproduce the above copyright
+    notice, this list of conditions and the following disclaimer in the
+    documentation and/or other materials provided with the distribution.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "search.h"
+
+enum {
+	NO_MATCH,
+	COMPONENT_MATCH,
+	SUBSTRING_MATCH,
+};
+
+bool
+search_add(struct search *s, const char *name)
+{
+	size_t len = strlen(name) + 1, cap, *offs;
+	unsigned ncap, *hits, *scratch;
+	char *text;
+
+	if (s->n == s->ncap) {
+		ncap = s->ncap ? s->ncap * 2 : 64;
+		/* those grown are kept, the capacity only once all are */
+		offs = realloc(s->offs, ncap * sizeof(*offs));
+		if (offs != NULL) {
+			s->offs = offs;
+		}
+		hits = realloc(s->hits, ncap * sizeof(*hits));
+		if (hits != NULL) {
+			s->hits = hits;
+		}
+		scratch = realloc(s->scratch, ncap * sizeof(*scratch));
+		if (scratch != NULL) {
+			s->scratch = scratch;
+		}
+		if (offs == NULL || hits == NULL || scratch == NULL) {
+			return false;
+		}
+		s->ncap = ncap;
+	}
+	if (s->len + len > s->cap) {
+		for (cap = s->cap; s->len + len > cap;) {
+			cap = cap ? cap * 2 : 1024;
+		}
+		if ((text = realloc(s->text, cap)) == NULL) {
+			return false;
+		}
+		s->text = text;
+		s->cap = cap;
+	}
+	for (size_t i = 0; i < len; ++i) {
+		s->text[s->len + i] = tolower((unsigned char)name[i]);
+	}
+	s->offs[s->n++] = s->len;
+	s->len += len;
+	/* invalidate the previous result */
+	s->qlen = SEARCH_MAX_QUERY;
+	return true;
+}
+
+static int
+match(const char *name, const char *query)
+{
+	const char *p = name;
+	int result = NO_MATCH;
+
+	while ((p = strstr(p, query)) != NULL) {
+		if (p == name || p[-1] == '.') {
+			return COMPONENT_MATCH;
+		}
+		result = SUBSTRING_MATCH;
+		p++;
+	}
+	return result;
+}
+
+/*
+ * Typing usually appends to the query, in which case only the previous
+ * hits can still match and only they are examined.  A longer query
+ * never promotes a substring match to a component match, but it can
+ * demote one the other way.
+ */
+const unsigned *
+search_update(struct search *s, const char *query, unsigned *nhits)
+{
+	char q[SEARCH_MAX_QUERY];
+	size_t qlen;
+	unsigned i, n, id, ncomp = 0, nsub = 0, ndemoted = 0, a, b;
+	bool narrowing;
+	int m;
+
+	for (qlen = 0; query[qlen] != '\0' && qlen < sizeof(q) - 1; ++qlen) {
+		q[qlen] = tolower((unsigned char)query[qlen]);
+	}
+	q[qlen] = '\0';
+
+	narrowing = s->qlen < SEARCH_MAX_QUERY && s->qlen <= qlen &&
+	    memcmp(s->query, q, s->qlen) == 0;
+	n = narrowing ? s->nhits : s->n;
+	for (i = 0; i < n; ++i) {
+		id = narrowing ? s->hits[i] : i;
+		if ((m = match(s->text + s->offs[id], q)) == COMPONENT_MATCH) {
+			s->hits[ncomp++] = id;
+		} else if (m == SUBSTRING_MATCH) {
+			s->scratch[nsub++] = id;
+			if (narrowing && i < s->ncomp) {
+				ndemoted++;
+			}
+		}
+	}
+	/*
+	 * scratch holds two runs in id order, the demoted matches and the
+	 * remaining substring matches; merge them behind the component
+	 * matches.
+	 */
+	for (a = 0, b = ndemoted, i = ncomp; a < ndemoted || b < nsub; ++i) {
+		if (b == nsub || (a < ndemoted && s->scratch[a] < s->scratch[b])) {
+			s->hits[i] = s->scratch[a++];
+		} else {
+			s->hits[i] = s->scratch[b++];
+		}
+	}
+	s->nhits = ncomp + nsub;
+	s->ncomp = ncomp;
+	memcpy(s->query, q, qlen + 1);
+	s->qlen = qlen;
+	*nhits = s->nhits;
+	return s->hits;
+}
+
+void
+search_free(struct search *s)
+{
+	free(s->text);
+	free(s->offs);
+	free(s->hits);
+	free(s->scratch);
+	memset(s, 0, sizeof(*s));
+}
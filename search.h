@@ -0,0 +1,57 @@
+/*
+ Copyright (c) 2019 Nia Alarie <nia@netbsd.org>
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions
+ are met:
+
+ 1. Redistributions of source code must retain the above copyright
+    notice, this list of conditions and the following disclaimer.
+ 2. Redistributions in binary form must reproduce the above copyright
+    notice, this list of conditions and the following disclaimer in the
+    documentation and/or other materials provided with the distribution.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef AIOMIXER_SEARCH_H
+#define AIOMIXER_SEARCH_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#define SEARCH_MAX_QUERY	(64)
+
+/*
+ * Incremental substring search over control names.  Matches where
+ * the query starts a dot-separated component (e.g. "mu" in
+ * outputs.master.mute) come before other substring matches, each in
+ * the order the names were added.
+ */
+struct search {
+	char *text; /* lowercased names, NUL-separated */
+	size_t len, cap;
+	size_t *offs;
+	unsigned n, ncap;
+	unsigned *hits, *scratch;
+	unsigned nhits, ncomp;
+	char query[SEARCH_MAX_QUERY];
+	size_t qlen;
+};
+
+bool search_add(struct search *, const char *);
+const unsigned *search_update(struct search *, const char *, unsigned *);
+void search_free(struct search *);
+
+#endif /* !AIOMIXER_SEARCH_H */
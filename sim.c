@@ -0,0 +1,501 @@
+/*
+ Copyright (c) 2019 Nia Alarie <nia@netbsd.org>
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions
+ are met:
+
+ 1. Redistributions of source code must retain the above copyright
+    notice, this list of conditions and the following disclaimer.
+ 2. Redistributions in binary form must reproduce the above copyright
+    notice, this list of conditions and the following disclaimer in the
+    documentation and/or other materials provided with the distribution.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * A simulated mixer device with a generated topology, for scaling
+ * tests on machines without (or with small) audio hardware.  The
+ * topology is described by a comma-separated list of name=value
+ * pairs:
+ *
+ *	classes		number of mixer classes (default 3)
+ *	controls	number of controls, spread over the classes (24)
+ *	channels	channels of each value control (2)
+ *	members		members of each generated enum/set (4)
+ *	chain		length of each next/prev chain (2): a value
+ *			control followed by a mute enum, a source set
+ *			and a mode enum, in that order
+ *
+ * and to imitate misbehaving hardware:
+ *
+ *	latency		fixed delay of every request, in us (0)
+ *	jitter		uniformly distributed extra delay, in us (0)
+ *	stall		chance of a request stalling, per mille (0)
+ *	stallus		length of a stall, in us (500000)
+ *	eio		chance of a request failing with EIO, per mille (0)
+ *	enxio		chance of a read or write failing with ENXIO,
+ *			per mille (0)
+ *	drift		interval between changes made behind our back
+ *			to a random control, in ms (0, never)
+ *	seed		random seed (1)
+ */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "mixer.h"
+
+#define SIM_MAX_MEMBERS		(32)
+#define SIM_MAX_CHAIN		(4)
+
+struct sim_params {
+	unsigned classes;
+	unsigned controls;
+	unsigned channels;
+	unsigned members;
+	unsigned chain;
+	unsigned latency;
+	unsigned jitter;
+	unsigned stall;
+	unsigned stallus;
+	unsigned eio;
+	unsigned enxio;
+	unsigned drift;
+	unsigned seed;
+};
+
+struct sim_ctrl {
+	struct mixer_devinfo info;
+	mixer_ctrl_t value;
+};
+
+struct sim {
+	struct sim_params p;
+	struct sim_ctrl *ctrls;
+	unsigned nctrls;
+	uint64_t rng;
+	struct timespec last_drift;
+};
+
+static const char *class_names[] = {
+	"inputs", "outputs", "record", "monitor", "equalization", "effects",
+};
+
+static bool
+sim_parse(struct sim_params *p, const char *spec)
+{
+	static const struct {
+		const char *name;
+		size_t offset;
+		unsigned min, max;
+	} keys[] = {
+		{ "classes", offsetof(struct sim_params, classes), 1, 1024 },
+		{ "controls", offsetof(struct sim_params, controls), 0, 65536 },
+		{ "channels", offsetof(struct sim_params, channels),
+		    1, MIXER_MAX_CHANNELS },
+		{ "members", offsetof(struct sim_params, members),
+		    1, SIM_MAX_MEMBERS },
+		{ "chain", offsetof(struct sim_params, chain), 1, SIM_MAX_CHAIN },
+		{ "latency", offsetof(struct sim_params, latency), 0, 10000000 },
+		{ "jitter", offsetof(struct sim_params, jitter), 0, 10000000 },
+		{ "stall", offsetof(struct sim_params, stall), 0, 1000 },
+		{ "stallus", offsetof(struct sim_params, stallus), 0, 10000000 },
+		{ "eio", offsetof(struct sim_params, eio), 0, 1000 },
+		{ "enxio", offsetof(struct sim_params, enxio), 0, 1000 },
+		{ "drift", offsetof(struct sim_params, drift), 0, 3600000 },
+		{ "seed", offsetof(struct sim_params, seed), 0, UINT32_MAX },
+	};
+	char *copy, *tok, *last, *eq, *end;
+	unsigned long v;
+	size_t i;
+	bool ok = true;
+
+	if ((copy = strdup(spec)) == NULL) {
+		return false;
+	}
+	for (tok = strtok_r(copy, ",", &last); tok != NULL && ok;
+	    tok = strtok_r(NULL, ",", &last)) {
+		ok = false;
+		if ((eq = strchr(tok, '=')) == NULL) {
+			break;
+		}
+		*eq++ = '\0';
+		v = strtoul(eq, &end, 10);
+		if (*eq == '\0' || *end != '\0') {
+			break;
+		}
+		for (i = 0; i < sizeof(keys) / sizeof(keys[0]); ++i) {
+			if (strcmp(tok, keys[i].name) == 0 &&
+			    v >= keys[i].min && v <= keys[i].max) {
+				*(unsigned *)((char *)p + keys[i].offset) = v;
+				ok = true;
+			}
+		}
+	}
+	free(copy);
+	if (!ok) {
+		errno = EINVAL;
+	}
+	return ok;
+}
+
+static void
+sim_name(audio_mixer_name_t *label, const char *fmt, unsigned n)
+{
+	memset(label, 0, sizeof(*label));
+	snprintf(label->name, sizeof(label->name), fmt, n);
+}
+
+/*
+ * Class entries come first, like on real hardware, then the controls
+ * in chains, dealt round-robin to the classes.
+ */
+static bool
+sim_generate(struct sim *sim)
+{
+	struct sim_params *p = &sim->p;
+	struct mixer_devinfo *m;
+	struct sim_ctrl *c;
+	unsigned i, j, link = 0, group = 0, class = 0;
+
+	sim->nctrls = p->classes + p->controls;
+	if ((sim->ctrls = calloc(sim->nctrls, sizeof(*sim->ctrls))) == NULL) {
+		return false;
+	}
+	for (i = 0; i < p->classes; ++i) {
+		m = &sim->ctrls[i].info;
+		m->index = i;
+		m->type = AUDIO_MIXER_CLASS;
+		m->mixer_class = i;
+		m->next = m->prev = AUDIO_MIXER_LAST;
+		if (i < sizeof(class_names) / sizeof(class_names[0])) {
+			snprintf(m->label.name, sizeof(m->label.name), "%s",
+			    class_names[i]);
+		} else {
+			sim_name(&m->label, "class%u", i);
+		}
+	}
+	for (i = p->classes; i < sim->nctrls; ++i) {
+		c = &sim->ctrls[i];
+		m = &c->info;
+		if (link == p->chain || i == p->classes) {
+			link = 0;
+			group++;
+			class = (group - 1) % p->classes;
+		}
+		m->index = i;
+		m->mixer_class = class;
+		m->prev = link == 0 ? AUDIO_MIXER_LAST : (int)i - 1;
+		m->next = (link + 1 < p->chain && i + 1 < sim->nctrls) ?
+		    (int)i + 1 : AUDIO_MIXER_LAST;
+		c->value.dev = i;
+		switch (link++) {
+		case 0:
+			m->type = AUDIO_MIXER_VALUE;
+			sim_name(&m->label, "ctl%u", group - 1);
+			m->un.v.num_channels = p->channels;
+			m->un.v.delta = 8;
+			c->value.un.value.num_channels = p->channels;
+			for (j = 0; j < p->channels; ++j) {
+				c->value.un.value.level[j] = 128;
+			}
+			break;
+		case 1:
+			m->type = AUDIO_MIXER_ENUM;
+			sim_name(&m->label, "mute", 0);
+			m->un.e.num_mem = 2;
+			sim_name(&m->un.e.member[0].label, "off", 0);
+			m->un.e.member[0].ord = 0;
+			sim_name(&m->un.e.member[1].label, "on", 0);
+			m->un.e.member[1].ord = 1;
+			break;
+		case 2:
+			m->type = AUDIO_MIXER_SET;
+			sim_name(&m->label, "source", 0);
+			m->un.s.num_mem = p->members;
+			for (j = 0; j < p->members; ++j) {
+				sim_name(&m->un.s.member[j].label, "src%u", j);
+				m->un.s.member[j].mask = 1u << j;
+			}
+			c->value.un.mask = 1;
+			break;
+		default:
+			m->type = AUDIO_MIXER_ENUM;
+			sim_name(&m->label, "mode", 0);
+			m->un.e.num_mem = p->members;
+			for (j = 0; j < p->members; ++j) {
+				sim_name(&m->un.e.member[j].label, "mode%u", j);
+				m->un.e.member[j].ord = j;
+			}
+			break;
+		}
+		c->value.type = m->type;
+	}
+	return true;
+}
+
+/*
+ * xorshift64*, so that a seed gives the same faults everywhere.
+ */
+static uint32_t
+sim_random(struct sim *sim)
+{
+	sim->rng ^= sim->rng >> 12;
+	sim->rng ^= sim->rng << 25;
+	sim->rng ^= sim->rng >> 27;
+	return (sim->rng * 2685821657736338717ULL) >> 32;
+}
+
+static bool
+sim_chance(struct sim *sim, unsigned permille)
+{
+	return permille > 0 && sim_random(sim) % 1000 < permille;
+}
+
+static void
+sim_sleep(unsigned usec)
+{
+	struct timespec ts;
+
+	ts.tv_sec = usec / 1000000;
+	ts.tv_nsec = (usec % 1000000) * 1000;
+	while (nanosleep(&ts, &ts) == -1 && errno == EINTR)
+		;
+}
+
+/*
+ * Change random controls as if another program had, once for every
+ * drift interval passed since the last time.
+ */
+static void
+sim_drift(struct sim *sim)
+{
+	struct timespec now;
+	struct sim_ctrl *c;
+	long long elapsed;
+	int i, n;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	elapsed = (now.tv_sec - sim->last_drift.tv_sec) * 1000LL +
+	    (now.tv_nsec - sim->last_drift.tv_nsec) / 1000000;
+	if (elapsed < sim->p.drift || sim->p.controls == 0) {
+		return;
+	}
+	sim->last_drift = now;
+	for (; elapsed >= sim->p.drift; elapsed -= sim->p.drift) {
+		c = &sim->ctrls[sim->p.classes +
+		    sim_random(sim) % sim->p.controls];
+		switch (c->info.type) {
+		case AUDIO_MIXER_ENUM:
+			n = c->info.un.e.num_mem;
+			c->value.un.ord =
+			    c->info.un.e.member[sim_random(sim) % n].ord;
+			break;
+		case AUDIO_MIXER_SET:
+			n = c->info.un.s.num_mem;
+			c->value.un.mask = 0;
+			for (i = 0; i < n; ++i) {
+				if (sim_random(sim) & 1) {
+					c->value.un.mask |=
+					    c->info.un.s.member[i].mask;
+				}
+			}
+			break;
+		case AUDIO_MIXER_VALUE:
+			n = sim_random(sim) % (AUDIO_MAX_GAIN + 1);
+			for (i = 0; i < c->value.un.value.num_channels; ++i) {
+				c->value.un.value.level[i] = n;
+			}
+			break;
+		}
+	}
+}
+
+/*
+ * Everything that happens before a request is answered: the delay,
+ * other programs' changes and injected errors.  Enumeration never
+ * fails with ENXIO since that ends it.
+ */
+static int
+sim_begin(struct sim *sim, bool devinfo)
+{
+	unsigned delay = sim->p.latency;
+
+	if (sim->p.jitter > 0) {
+		delay += sim_random(sim) % (sim->p.jitter + 1);
+	}
+	if (sim_chance(sim, sim->p.stall)) {
+		delay += sim->p.stallus;
+	}
+	if (delay > 0) {
+		sim_sleep(delay);
+	}
+	if (sim->p.drift > 0) {
+		sim_drift(sim);
+	}
+	if (sim_chance(sim, sim->p.eio)) {
+		return EIO;
+	}
+	if (!devinfo && sim_chance(sim, sim->p.enxio)) {
+		return ENXIO;
+	}
+	return 0;
+}
+
+static struct sim_ctrl *
+sim_lookup(struct sim *sim, const mixer_ctrl_t *dev)
+{
+	struct sim_ctrl *c;
+
+	if (dev->dev < 0 || (unsigned)dev->dev >= sim->nctrls) {
+		errno = ENXIO;
+		return NULL;
+	}
+	c = &sim->ctrls[dev->dev];
+	if (c->info.type == AUDIO_MIXER_CLASS || c->info.type != dev->type) {
+		errno = EINVAL;
+		return NULL;
+	}
+	return c;
+}
+
+static int
+sim_devinfo(void *cookie, struct mixer_devinfo *m)
+{
+	struct sim *sim = cookie;
+	int error;
+
+	if ((error = sim_begin(sim, true)) != 0) {
+		errno = error;
+		return -1;
+	}
+	if (m->index < 0 || (unsigned)m->index >= sim->nctrls) {
+		errno = ENXIO;
+		return -1;
+	}
+	*m = sim->ctrls[m->index].info;
+	return 0;
+}
+
+static int
+sim_read(void *cookie, mixer_ctrl_t *dev)
+{
+	struct sim_ctrl *c;
+	int error;
+
+	if ((error = sim_begin(cookie, false)) != 0) {
+		errno = error;
+		return -1;
+	}
+	if ((c = sim_lookup(cookie, dev)) == NULL) {
+		return -1;
+	}
+	*dev = c->value;
+	return 0;
+}
+
+static int
+sim_write(void *cookie, mixer_ctrl_t *dev)
+{
+	struct sim_ctrl *c;
+	int i, error;
+
+	if ((error = sim_begin(cookie, false)) != 0) {
+		errno = error;
+		return -1;
+	}
+	if ((c = sim_lookup(cookie, dev)) == NULL) {
+		return -1;
+	}
+	switch (dev->type) {
+	case AUDIO_MIXER_ENUM:
+		for (i = 0; i < c->info.un.e.num_mem; ++i) {
+			if (c->info.un.e.member[i].ord == dev->un.ord) {
+				break;
+			}
+		}
+		if (i == c->info.un.e.num_mem) {
+			errno = EINVAL;
+			return -1;
+		}
+		c->value.un.ord = dev->un.ord;
+		break;
+	case AUDIO_MIXER_SET:
+		c->value.un.mask = dev->un.mask;
+		break;
+	case AUDIO_MIXER_VALUE:
+		if (dev->un.value.num_channels != c->info.un.v.num_channels) {
+			errno = EINVAL;
+			return -1;
+		}
+		c->value.un.value = dev->un.value;
+		break;
+	}
+	return 0;
+}
+
+static void
+sim_close(void *cookie)
+{
+	struct sim *sim = cookie;
+
+	free(sim->ctrls);
+	free(sim);
+}
+
+static const struct mixer_ops sim_ops = {
+	.devinfo = sim_devinfo,
+	.read = sim_read,
+	.write = sim_write,
+	.close = sim_close,
+};
+
+struct mixer *
+mixer_open_sim(const char *spec)
+{
+	struct sim *sim;
+	struct mixer *mixer;
+
+	if ((sim = calloc(1, sizeof(*sim))) == NULL) {
+		return NULL;
+	}
+	sim->p.classes = 3;
+	sim->p.controls = 24;
+	sim->p.channels = 2;
+	sim->p.members = 4;
+	sim->p.chain = 2;
+	sim->p.stallus = 500000;
+	sim->p.seed = 1;
+	if (!sim_parse(&sim->p, spec)) {
+		sim_close(sim);
+		return NULL;
+	}
+	/* xorshift must not start from zero */
+	sim->rng = (uint64_t)sim->p.seed << 32 | 0x9e3779b9;
+	clock_gettime(CLOCK_MONOTONIC, &sim->last_drift);
+	if (!sim_generate(sim) ||
+	    (mixer = mixer_new(&sim_ops, sim)) == NULL) {
+		sim_close(sim);
+		return NULL;
+	}
+	return mixer;
+}
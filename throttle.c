@@ -0,0 +1,225 @@
+/*
+ Copyright (c) 2019 Nia Alarie <nia@netbsd.org>
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions
+ are met:
+
+ 1. Redistributions of source code must retain the above copyright
+    notice, this list of conditions and the following disclaimer.
+ 2. Redistributions in binary form must reproduce the above copyright
+    notice, this list of conditions and the following disclaimer in the
+    documentation and/or other materials provided with the distribution.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Rate limiting of writes, for devices that glitch or stall when
+ * written to quickly, and for callers that write a control faster than
+ * anyone can hear.  Each control is written at most rate times a
+ * second.  A write coming sooner is held back, replacing whatever was
+ * held for the control before, and made by mixer_throttle_flush() once
+ * the control is due.  Reads of a control with a write held answer the
+ * value held, so the caller sees its writes at once.
+ */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "mixer.h"
+
+struct held {
+	bool pending;
+	uint64_t last; /* when the last write was made */
+	mixer_ctrl_t ctrl;
+};
+
+struct throttle {
+	struct mixer *inner;
+	uint64_t interval; /* microseconds */
+	struct held *held; /* by control index */
+	unsigned nheld, npending;
+};
+
+static const struct mixer_ops throttle_ops;
+
+static uint64_t
+usec_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static struct held *
+throttle_held(struct throttle *t, int dev, bool grow)
+{
+	struct held *held;
+	unsigned n;
+
+	if (dev < 0) {
+		return NULL;
+	}
+	if ((unsigned)dev >= t->nheld) {
+		if (!grow) {
+			return NULL;
+		}
+		n = (unsigned)dev + 1 > 2 * t->nheld ?
+		    (unsigned)dev + 1 : 2 * t->nheld;
+		if ((held = realloc(t->held, n * sizeof(*held))) == NULL) {
+			return NULL;
+		}
+		memset(held + t->nheld, 0, (n - t->nheld) * sizeof(*held));
+		t->held = held;
+		t->nheld = n;
+	}
+	return &t->held[dev];
+}
+
+static int
+throttle_devinfo(void *cookie, struct mixer_devinfo *m)
+{
+	struct throttle *t = cookie;
+
+	return mixer_get_devinfo(t->inner, m);
+}
+
+static int
+throttle_read(void *cookie, mixer_ctrl_t *dev)
+{
+	struct throttle *t = cookie;
+	struct held *h = throttle_held(t, dev->dev, false);
+
+	if (h != NULL && h->pending && h->ctrl.type == dev->type) {
+		*dev = h->ctrl;
+		return 0;
+	}
+	return mixer_read(t->inner, dev);
+}
+
+static int
+throttle_write(void *cookie, mixer_ctrl_t *dev)
+{
+	struct throttle *t = cookie;
+	struct held *h = throttle_held(t, dev->dev, true);
+	uint64_t now = usec_now();
+
+	/* without room to hold it, it is not held */
+	if (h == NULL) {
+		return mixer_write(t->inner, dev);
+	}
+	if (!h->pending && now - h->last >= t->interval) {
+		h->last = now;
+		return mixer_write(t->inner, dev);
+	}
+	if (!h->pending) {
+		h->pending = true;
+		t->npending++;
+	}
+	h->ctrl = *dev;
+	return 0;
+}
+
+/*
+ * Makes the writes held back that are due, or all of them.  Returns
+ * how many are still held.  A failed write is dropped; unless failed
+ * is NULL, flushing stops there, leaving its control in *failed and
+ * errno set, and the rest are made on the next call.
+ */
+static int
+throttle_flush(struct throttle *t, bool all, int *failed)
+{
+	uint64_t now = usec_now();
+	struct held *h;
+
+	for (unsigned i = 0; i < t->nheld && t->npending > 0; ++i) {
+		h = &t->held[i];
+		if (!h->pending || (!all && now - h->last < t->interval)) {
+			continue;
+		}
+		h->pending = false;
+		h->last = now;
+		t->npending--;
+		if (mixer_write(t->inner, &h->ctrl) == -1 && failed != NULL) {
+			*failed = h->ctrl.dev;
+			break;
+		}
+	}
+	return t->npending;
+}
+
+static void
+throttle_close(void *cookie)
+{
+	struct throttle *t = cookie;
+
+	/* the last value written is the one that sticks */
+	(void)throttle_flush(t, true, NULL);
+	mixer_close(t->inner);
+	free(t->held);
+	free(t);
+}
+
+static const struct mixer_ops throttle_ops = {
+	.devinfo = throttle_devinfo,
+	.read = throttle_read,
+	.write = throttle_write,
+	.close = throttle_close,
+};
+
+struct mixer *
+mixer_throttle(struct mixer *inner, unsigned rate)
+{
+	struct throttle *t;
+	struct mixer *mixer;
+
+	if (rate == 0) {
+		errno = EINVAL;
+		return NULL;
+	}
+	if ((t = calloc(1, sizeof(*t))) == NULL) {
+		return NULL;
+	}
+	t->inner = inner;
+	t->interval = 1000000 / rate;
+	if ((mixer = mixer_new(&throttle_ops, t)) == NULL) {
+		free(t);
+		return NULL;
+	}
+	/* held writes never reach the device, so only its requests count */
+	mixer->inner = inner;
+	return mixer;
+}
+
+/*
+ * Returns how many writes are still held back by m after making those
+ * due, 0 if m is not a throttle.  *failed is set to -1, or to the
+ * control whose write failed with errno set, the writes due after it
+ * being left for the next call.
+ */
+int
+mixer_throttle_flush(struct mixer *m, int *failed)
+{
+	*failed = -1;
+	if (m == NULL || m->ops != &throttle_ops) {
+		return 0;
+	}
+	return throttle_flush(m->cookie, false, failed);
+}